@@ -0,0 +1,539 @@
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+//== INCLUDES =================================================================
+
+#include "Bvh.h"
+#include "Morton.h"
+#include "StopWatch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+#include <utility>
+
+#if HAVE_OPENMP
+#  include <omp.h>
+#endif
+
+
+//== IMPLEMENTATION ===========================================================
+
+
+namespace {
+
+/// number of bins of the SAH builder
+constexpr int NUM_BINS = 16;
+
+/// largest leaf the SAH builder creates
+constexpr int MAX_LEAF = 8;
+
+/// leaf size of the LBVH builder
+constexpr int LBVH_LEAF = 4;
+
+/// subtrees with more primitives are built as separate tasks
+constexpr int TASK_SIZE = 4096;
+
+/// below this depth, nodes are split in the middle, which bounds the depth
+/// of degenerate hierarchies (see traverse_bvh())
+constexpr int MAX_DEPTH = 64;
+
+/// cost of traversing a node relative to intersecting a primitive
+constexpr double TRAVERSAL_COST = 1.0;
+
+
+/// Builds the topology of a hierarchy by partitioning the primitive order.
+/// Nodes are allocated in pairs from a shared counter, so their order depends
+/// on the scheduling; build_bvh() stores them in depth-first order afterwards.
+class Builder
+{
+public:
+
+    /// topology of a node
+    struct Node
+    {
+        int first = 0;  ///< first primitive (in order)
+        int count = 0;  ///< number of primitives
+        int child = -1; ///< first child, -1 for leaves
+    };
+
+    Builder(const std::vector<Aabb>& _boxes, std::vector<int>& _order)
+        : boxes_(_boxes)
+        , order_(_order)
+        , nodes_(std::max<size_t>(1, 2 * _boxes.size() - 1))
+        , num_nodes_(1)
+    {
+        centroids_.reserve(_boxes.size());
+        for (const Aabb& b: _boxes) centroids_.push_back(b.center());
+    }
+
+    /// build with the binned surface area heuristic
+    void build_sah(int _node, int _begin, int _end, int _depth);
+
+    /// build from Morton codes (see build_bvh())
+    void build_lbvh(int _node, int _begin, int _end, int _depth);
+
+    /// compute and sort the Morton codes of the primitive centroids
+    void sort_morton();
+
+    const std::vector<Node>& nodes() const { return nodes_; }
+
+private:
+
+    /// make \c _node a leaf
+    void leaf(int _node, int _begin, int _end)
+    {
+        nodes_[_node].first = _begin;
+        nodes_[_node].count = _end - _begin;
+    }
+
+    /// split \c _node at \c _mid and build the children, large ones as separate tasks
+    template <class Build>
+    void split(int _node, int _begin, int _mid, int _end, int _depth, Build _build)
+    {
+        const int child = num_nodes_.fetch_add(2);
+        nodes_[_node].first = _begin;
+        nodes_[_node].count = _end - _begin;
+        nodes_[_node].child = child;
+
+        if (_mid - _begin > TASK_SIZE)
+        {
+#if HAVE_OPENMP
+#  pragma omp task default(shared) firstprivate(child, _begin, _mid, _depth, _build)
+#endif
+            (this->*_build)(child, _begin, _mid, _depth + 1);
+        }
+        else
+        {
+            (this->*_build)(child, _begin, _mid, _depth + 1);
+        }
+        (this->*_build)(child + 1, _mid, _end, _depth + 1);
+    }
+
+    /// split in the middle along \c _axis (fallback if SAH binning fails)
+    int median(int _begin, int _end, int _axis)
+    {
+        const int mid = (_begin + _end) / 2;
+        std::nth_element(order_.begin() + _begin, order_.begin() + mid, order_.begin() + _end,
+                         [&](int a, int b) {
+                             const double ca = centroids_[a][_axis], cb = centroids_[b][_axis];
+                             return ca < cb || (ca == cb && a < b);
+                         });
+        return mid;
+    }
+
+    template <class It, class Less>
+    static void parallel_sort(It _begin, It _end, Less _less);
+
+private:
+
+    const std::vector<Aabb>& boxes_;
+    std::vector<vec3>        centroids_;
+    std::vector<int>&        order_;
+    std::vector<uint32_t>    codes_;
+    std::vector<Node>        nodes_;
+    std::atomic<int>         num_nodes_;
+};
+
+
+//-----------------------------------------------------------------------------
+
+
+void Builder::build_sah(int _node, int _begin, int _end, int _depth)
+{
+    const int count = _end - _begin;
+    if (count == 1) return leaf(_node, _begin, _end);
+
+    Aabb bounds, centroid_bounds;
+    for (int i = _begin; i < _end; ++i)
+    {
+        bounds.grow(boxes_[order_[i]]);
+        centroid_bounds.grow(centroids_[order_[i]]);
+    }
+
+    // bin along the axis of largest centroid extent
+    const vec3 extent = centroid_bounds.max - centroid_bounds.min;
+    int axis = 0;
+    if (extent[1] > extent[axis]) axis = 1;
+    if (extent[2] > extent[axis]) axis = 2;
+
+    if (!(extent[axis] > 0) || _depth >= MAX_DEPTH)
+    {
+        if (count <= MAX_LEAF) return leaf(_node, _begin, _end);
+        return split(_node, _begin, median(_begin, _end, axis), _end, _depth, &Builder::build_sah);
+    }
+
+    const double lo    = centroid_bounds.min[axis];
+    const double scale = NUM_BINS / extent[axis];
+    auto bin = [&](int _prim) {
+        return std::min(NUM_BINS - 1, int((centroids_[_prim][axis] - lo) * scale));
+    };
+
+    int  bin_count[NUM_BINS] = {};
+    Aabb bin_box[NUM_BINS];
+    for (int i = _begin; i < _end; ++i)
+    {
+        const int b = bin(order_[i]);
+        ++bin_count[b];
+        bin_box[b].grow(boxes_[order_[i]]);
+    }
+
+    // sweep from the right, then from the left to evaluate all split planes
+    double right_cost[NUM_BINS];
+    Aabb   right;
+    int    right_count = 0;
+    for (int b = NUM_BINS - 1; b > 0; --b)
+    {
+        right.grow(bin_box[b]);
+        right_count += bin_count[b];
+        right_cost[b] = right.area() * right_count;
+    }
+
+    double best_cost  = std::numeric_limits<double>::infinity();
+    int    best_split = -1;
+    Aabb   left;
+    int    left_count = 0;
+    for (int b = 0; b < NUM_BINS - 1; ++b)
+    {
+        left.grow(bin_box[b]);
+        left_count += bin_count[b];
+        if (left_count == 0 || left_count == count) continue;
+
+        const double cost = left.area() * left_count + right_cost[b + 1];
+        if (cost < best_cost)
+        {
+            best_cost  = cost;
+            best_split = b;
+        }
+    }
+
+    const double area = bounds.area();
+    best_cost = TRAVERSAL_COST + (area > 0 ? best_cost / area : count);
+    if (count <= MAX_LEAF && best_cost >= count) return leaf(_node, _begin, _end);
+
+    int mid = _begin;
+    if (best_split >= 0)
+    {
+        mid = int(std::partition(order_.begin() + _begin, order_.begin() + _end,
+                                 [&](int _prim) { return bin(_prim) <= best_split; })
+                  - order_.begin());
+    }
+    if (mid == _begin || mid == _end) mid = median(_begin, _end, axis);
+
+    split(_node, _begin, mid, _end, _depth, &Builder::build_sah);
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+template <class It, class Less>
+void Builder::parallel_sort(It _begin, It _end, Less _less)
+{
+    if (_end - _begin < 32768)
+    {
+        std::sort(_begin, _end, _less);
+        return;
+    }
+
+    It mid = _begin + (_end - _begin) / 2;
+#if HAVE_OPENMP
+#  pragma omp task default(shared) firstprivate(_begin, mid, _less)
+#endif
+    parallel_sort(_begin, mid, _less);
+    parallel_sort(mid, _end, _less);
+#if HAVE_OPENMP
+#  pragma omp taskwait
+#endif
+    std::inplace_merge(_begin, mid, _end, _less);
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void Builder::sort_morton()
+{
+    Aabb centroid_bounds;
+    for (const vec3& c: centroids_) centroid_bounds.grow(c);
+    const vec3 extent = centroid_bounds.max - centroid_bounds.min;
+
+    // quantize centroids to a 1024^3 grid
+    std::vector<uint32_t> codes(centroids_.size());
+    for (size_t i = 0; i < centroids_.size(); ++i)
+    {
+        uint32_t q[3];
+        for (int j = 0; j < 3; ++j)
+        {
+            const double x = extent[j] > 0 ? (centroids_[i][j] - centroid_bounds.min[j]) / extent[j] : 0.0;
+            q[j] = uint32_t(std::min(1023.0, std::max(0.0, x * 1024.0)));
+        }
+        codes[i] = morton3(q[0], q[1], q[2]);
+    }
+
+    // sort by code, ties by primitive index (deterministic)
+    parallel_sort(order_.begin(), order_.end(), [&](int a, int b) {
+        return codes[a] < codes[b] || (codes[a] == codes[b] && a < b);
+    });
+
+    codes_.resize(order_.size());
+    for (size_t i = 0; i < order_.size(); ++i) codes_[i] = codes[order_[i]];
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void Builder::build_lbvh(int _node, int _begin, int _end, int _depth)
+{
+    if (_end - _begin <= LBVH_LEAF) return leaf(_node, _begin, _end);
+
+    // split where the highest differing bit of the (sorted) codes changes
+    int mid = (_begin + _end) / 2;
+    const uint32_t first = codes_[_begin], last = codes_[_end - 1];
+    if (first != last && _depth < MAX_DEPTH)
+    {
+        uint32_t bit = 1u << 31;
+        while (!((first ^ last) & bit)) bit >>= 1;
+        mid = int(std::partition_point(codes_.begin() + _begin, codes_.begin() + _end,
+                                       [&](uint32_t c) { return !(c & bit); })
+                  - codes_.begin());
+    }
+
+    split(_node, _begin, mid, _end, _depth, &Builder::build_lbvh);
+}
+
+
+} // namespace
+
+
+//-----------------------------------------------------------------------------
+
+
+void build_bvh(const std::vector<Aabb>& _boxes,
+               BvhMethod                _method,
+               std::vector<BvhNode>&    _nodes,
+               std::vector<int>&        _order,
+               BvhStats&                _stats)
+{
+    StopWatch timer;
+    timer.start();
+
+    _nodes.clear();
+    _order.resize(_boxes.size());
+    std::iota(_order.begin(), _order.end(), 0);
+    _stats = BvhStats();
+    _stats.trees = 1;
+    _stats.primitives = _boxes.size();
+    if (_boxes.empty()) return;
+
+    // build the topology in parallel
+    Builder builder(_boxes, _order);
+    auto build = [&]() {
+        if (_method == BvhMethod::LBVH)
+        {
+            builder.sort_morton();
+            builder.build_lbvh(0, 0, int(_boxes.size()), 0);
+        }
+        else
+        {
+            builder.build_sah(0, 0, int(_boxes.size()), 0);
+        }
+    };
+
+#if HAVE_OPENMP
+    if (omp_in_parallel())
+    {
+#  pragma omp taskgroup
+        build();
+    }
+    else
+    {
+#  pragma omp parallel
+#  pragma omp single
+        build();
+    }
+#else
+    build();
+#endif
+
+    // store nodes in depth-first order, children next to each other
+    const std::vector<Builder::Node>& nodes = builder.nodes();
+    _nodes.emplace_back();
+    std::vector<std::pair<int, int>> stack = { {0, 0} }; // (builder node, output node)
+    std::vector<int> depth = { 0 };
+    while (!stack.empty())
+    {
+        const auto [from, to] = stack.back();
+        const int d = depth.back();
+        stack.pop_back();
+        depth.pop_back();
+
+        const Builder::Node& n = nodes[from];
+        _stats.depth = std::max(_stats.depth, size_t(d));
+        if (n.child < 0)
+        {
+            _nodes[to].first = n.first;
+            _nodes[to].count = n.count;
+            ++_stats.leaves;
+            _stats.max_leaf = std::max(_stats.max_leaf, size_t(n.count));
+        }
+        else
+        {
+            const int child = int(_nodes.size());
+            _nodes[to].first = child;
+            _nodes[to].count = 0;
+            _nodes.emplace_back();
+            _nodes.emplace_back();
+            stack.push_back({n.child + 1, child + 1});
+            stack.push_back({n.child,     child});
+            depth.push_back(d + 1);
+            depth.push_back(d + 1);
+        }
+    }
+    _stats.nodes = _nodes.size();
+
+    // fit boxes bottom-up
+    struct LeafBoxes
+    {
+        const std::vector<Aabb>& boxes;
+        const std::vector<int>&  order;
+        const Aabb& operator[](int i) const { return boxes[order[i]]; }
+    };
+    refit_bvh(_nodes, LeafBoxes{_boxes, _order});
+
+    timer.stop();
+    _stats.build_ms = timer.elapsed();
+
+    // SAH cost relative to intersecting all primitives of the root
+    const double root_area = Aabb{_nodes[0].bb_min, _nodes[0].bb_max}.area();
+    double cost = 0;
+    if (root_area > 0)
+    {
+        for (const BvhNode& n: _nodes)
+        {
+            const double p = Aabb{n.bb_min, n.bb_max}.area() / root_area;
+            cost += p * (n.count > 0 ? double(n.count) : TRAVERSAL_COST);
+        }
+    }
+    else
+    {
+        cost = double(_boxes.size());
+    }
+    _stats.sah_cost = cost * double(_boxes.size());
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void collapse_bvh(std::vector<BvhNode>& _nodes, int _max_leaf)
+{
+    // primitive ranges of all subtrees, children are stored after their parents
+    std::vector<BvhNode> ranges(_nodes);
+    for (size_t i = _nodes.size(); i-- > 0; )
+    {
+        if (_nodes[i].count > 0) continue;
+        const BvhNode& a = ranges[_nodes[i].first];
+        const BvhNode& b = ranges[_nodes[i].first + 1];
+        ranges[i].first = std::min(a.first, b.first);
+        ranges[i].count = a.count + b.count;
+    }
+
+    // copy the remaining nodes, again with siblings next to each other
+    std::vector<BvhNode> nodes(1, ranges[0]);
+    std::vector<std::pair<int, int>> stack(1, {0, 0}); // (old, new) index
+    while (!stack.empty())
+    {
+        const auto [from, to] = stack.back();
+        stack.pop_back();
+        if (_nodes[from].count > 0 || ranges[from].count <= _max_leaf) continue;
+
+        const int child = _nodes[from].first;
+        nodes[to].first = int(nodes.size());
+        nodes[to].count = 0;
+        for (int k = 0; k < 2; ++k)
+        {
+            stack.push_back({child + k, int(nodes.size())});
+            nodes.push_back(ranges[child + k]);
+        }
+    }
+    _nodes.swap(nodes);
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void cluster_triangles(const std::vector<std::array<int, 3>>& _triangles,
+                       const std::vector<Aabb>&               _boxes,
+                       size_t                                 _num_vertices,
+                       int                                    _cluster_size,
+                       int                                    _max_leaf,
+                       TriangleClusters&                      _clusters)
+{
+    // order the triangles like the leaves of a hierarchy over all of them,
+    // so that consecutive triangles (and hence clusters) are compact
+    std::vector<BvhNode> nodes;
+    std::vector<int> order;
+    BvhStats stats;
+    build_bvh(_boxes, BvhMethod::SAH, nodes, order, stats);
+
+    // a small hierarchy over the triangles of each cluster
+    const size_t size = size_t(_cluster_size);
+    const size_t num_clusters = (_triangles.size() + size - 1) / size;
+    _clusters.triangles.assign(num_clusters, {});
+    _clusters.nodes.assign(num_clusters, {});
+    _clusters.vertices.assign(num_clusters, {});
+    _clusters.indices.assign(num_clusters, {});
+#if HAVE_OPENMP
+#  pragma omp parallel for schedule(dynamic)
+#endif
+    for (long c=0; c<long(num_clusters); ++c)
+    {
+        const size_t begin = size_t(c) * size;
+        const size_t end   = std::min(_triangles.size(), begin + size);
+        std::vector<Aabb> cluster_boxes;
+        for (size_t t=begin; t<end; ++t)
+            cluster_boxes.push_back(_boxes[order[t]]);
+        std::vector<int> cluster_order;
+        BvhStats cluster_stats;
+        build_bvh(cluster_boxes, BvhMethod::SAH, _clusters.nodes[c], cluster_order, cluster_stats);
+        collapse_bvh(_clusters.nodes[c], _max_leaf);
+
+        std::vector<int>& triangles = _clusters.triangles[c];
+        for (int j: cluster_order) triangles.push_back(order[begin + size_t(j)]);
+    }
+
+    // local vertex indices, in the order of the first use of each vertex
+    std::vector<int> local(_num_vertices, -1);
+    for (size_t c=0; c<num_clusters; ++c)
+    {
+        std::vector<int>&      used    = _clusters.vertices[c];
+        std::vector<uint16_t>& indices = _clusters.indices[c];
+        indices.reserve(3 * _clusters.triangles[c].size());
+        for (int t: _clusters.triangles[c])
+        {
+            for (int v: _triangles[t])
+            {
+                if (local[v] < 0)
+                {
+                    local[v] = int(used.size());
+                    used.push_back(v);
+                }
+                indices.push_back(uint16_t(local[v]));
+            }
+        }
+        for (int v: used) local[v] = -1;
+    }
+}
+
+
+//=============================================================================
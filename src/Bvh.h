@@ -0,0 +1,256 @@
+#pragma once
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+#include "Ray.h"
+#include "vec3.h"
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+
+/// \file Bvh.h Bounding volume hierarchies over arbitrary primitives, used by
+/// CompiledScene for the triangles of each mesh and for the scene's objects.
+
+
+/// Algorithm used to build a bounding volume hierarchy
+enum class BvhMethod
+{
+    /// top-down binned surface area heuristic (best trees)
+    SAH,
+    /// linear BVH from sorted Morton codes (fastest build)
+    LBVH
+};
+
+
+/// \class Aabb Bvh.h
+/// Axis-aligned bounding box
+struct Aabb
+{
+    vec3 min = vec3( std::numeric_limits<double>::infinity());
+    vec3 max = vec3(-std::numeric_limits<double>::infinity());
+
+    /// enlarge the box to contain \c _p
+    void grow(const vec3& _p) { min = ::min(min, _p); max = ::max(max, _p); }
+
+    /// enlarge the box to contain \c _b
+    void grow(const Aabb& _b) { min = ::min(min, _b.min); max = ::max(max, _b.max); }
+
+    /// center of the box
+    vec3 center() const { return 0.5 * (min + max); }
+
+    /// surface area of the box (0 for empty boxes)
+    double area() const
+    {
+        const vec3 e = max - min;
+        if (e[0] < 0 || e[1] < 0 || e[2] < 0) return 0;
+        return 2.0 * (e[0]*e[1] + e[1]*e[2] + e[2]*e[0]);
+    }
+};
+
+
+/// \class BvhNode Bvh.h
+/// Node of a bounding volume hierarchy. The two children of an inner node are
+/// stored next to each other, and after the parent.
+struct BvhNode
+{
+    /// bounding box of the node
+    vec3 bb_min, bb_max;
+    /// leaf: index of the first primitive; inner node: index of the first child
+    int first = 0;
+    /// leaf: number of primitives; inner node: 0
+    int count = 0;
+};
+
+
+/// \class BvhStats Bvh.h
+/// Build time and quality of one or more hierarchies
+struct BvhStats
+{
+    /// number of hierarchies
+    size_t trees = 0;
+    /// wall-clock build time in milliseconds
+    double build_ms = 0;
+    /// number of primitives, nodes and leaves
+    size_t primitives = 0, nodes = 0, leaves = 0;
+    /// largest leaf and deepest leaf
+    size_t max_leaf = 0, depth = 0;
+    /// SAH cost relative to a single leaf, summed weighted by primitives
+    /// (divide by \c primitives for the average)
+    double sah_cost = 0;
+
+    /// accumulate the statistics of another hierarchy
+    void merge(const BvhStats& _s)
+    {
+        trees      += _s.trees;
+        build_ms   += _s.build_ms;
+        primitives += _s.primitives;
+        nodes      += _s.nodes;
+        leaves     += _s.leaves;
+        max_leaf    = std::max(max_leaf, _s.max_leaf);
+        depth       = std::max(depth, _s.depth);
+        sah_cost   += _s.sah_cost;
+    }
+};
+
+/// print statistics
+inline std::ostream& operator<<(std::ostream& _os, const BvhStats& _s)
+{
+    _os << _s.trees << (_s.trees == 1 ? " tree, " : " trees, ")
+        << _s.primitives << " primitives, " << _s.nodes << " nodes ("
+        << double(_s.nodes * sizeof(BvhNode)) / 1024.0 << " KB), built in "
+        << _s.build_ms << " ms; SAH cost "
+        << (_s.primitives ? _s.sah_cost / double(_s.primitives) : 0.0)
+        << ", depth " << _s.depth << ", leaf size "
+        << (_s.leaves ? double(_s.primitives) / double(_s.leaves) : 0.0) << " avg/"
+        << _s.max_leaf << " max";
+    return _os;
+}
+
+
+/// Build a hierarchy over the primitives with bounding boxes \c _boxes.
+/// Subtrees are built in parallel (OpenMP tasks); if called from inside a
+/// parallel region, the tasks are added to the current team.
+/// \param[out] _nodes nodes in depth-first order, the root is _nodes[0]
+/// \param[out] _order primitive indices in leaf order; leaves refer to ranges of _order
+/// \param[out] _stats build time and tree quality
+void build_bvh(const std::vector<Aabb>& _boxes,
+               BvhMethod                _method,
+               std::vector<BvhNode>&    _nodes,
+               std::vector<int>&        _order,
+               BvhStats&                _stats);
+
+/// Replace all subtrees of \c _nodes (built by build_bvh()) with at most
+/// \c _max_leaf primitives by single leaves, to save nodes where a few more
+/// primitive tests are cheap. A subtree's primitives are a contiguous range
+/// of the leaf order, so the order of build_bvh() stays valid.
+void collapse_bvh(std::vector<BvhNode>& _nodes, int _max_leaf);
+
+/// Triangles of a mesh cut into spatially compact clusters, see cluster_triangles()
+struct TriangleClusters
+{
+    /// per cluster: its triangles in the leaf order of its hierarchy
+    std::vector<std::vector<int>> triangles;
+    /// per cluster: hierarchy whose leaves refer to ranges of its triangles
+    std::vector<std::vector<BvhNode>> nodes;
+    /// per cluster: the vertices it uses, in the order of their first use
+    std::vector<std::vector<int>> vertices;
+    /// per cluster: three indices into its vertices per triangle
+    std::vector<std::vector<uint16_t>> indices;
+};
+
+/// Cut the triangles \c _triangles (with bounding boxes \c _boxes) of a mesh
+/// with \c _num_vertices vertices into clusters of at most \c _cluster_size
+/// triangles, for the compressed and paged storage of meshes. The triangles
+/// are ordered like the leaves of a hierarchy over all of them, so that
+/// consecutive triangles (and hence clusters) are compact. Every cluster gets
+/// a hierarchy collapsed to leaves of \c _max_leaf triangles (collapse_bvh())
+/// and its own local vertex indices.
+void cluster_triangles(const std::vector<std::array<int, 3>>& _triangles,
+                       const std::vector<Aabb>&               _boxes,
+                       size_t                                 _num_vertices,
+                       int                                    _cluster_size,
+                       int                                    _max_leaf,
+                       TriangleClusters&                      _clusters);
+
+/// Recompute the node boxes of a hierarchy bottom-up, after its primitives
+/// moved. \c _boxes are indexed like the leaves, i.e. already permuted by
+/// the \c _order of build_bvh().
+template <class Nodes, class Boxes>
+void refit_bvh(Nodes& _nodes, const Boxes& _boxes)
+{
+    // children are stored after their parents
+    for (size_t i = _nodes.size(); i-- > 0; )
+    {
+        BvhNode& n = _nodes[i];
+        Aabb box;
+        if (n.count > 0)
+        {
+            for (int j = n.first; j < n.first + n.count; ++j) box.grow(_boxes[j]);
+        }
+        else
+        {
+            for (int c = n.first; c < n.first + 2; ++c)
+            {
+                box.grow(_nodes[c].bb_min);
+                box.grow(_nodes[c].bb_max);
+            }
+        }
+        n.bb_min = box.min;
+        n.bb_max = box.max;
+    }
+}
+
+
+/// Conservative slab test of \c _ray against the box of \c _node within the
+/// ray segment (0, _t_max]. The far distance is enlarged by a few ulps, so
+/// that rounding errors never cull a box that contains a hit (see Pharr et
+/// al., Physically Based Rendering). The ray's sign bits select the near and
+/// far side of each slab, so no comparison and swap is needed.
+inline bool intersect_node(const Ray& _ray, const BvhNode& _node, double _t_max)
+{
+    constexpr double gamma3 = 3 * std::numeric_limits<double>::epsilon() / (1 - 3 * std::numeric_limits<double>::epsilon());
+
+    const vec3* sides[2] = { &_node.bb_min, &_node.bb_max };
+    double t0 = 0, t1 = _t_max;
+    for (int i = 0; i < 3; ++i)
+    {
+        const double t_near = ((*sides[    _ray.sign[i]])[i] - _ray.origin[i]) * _ray.inv_direction[i];
+        const double t_far  = ((*sides[1 - _ray.sign[i]])[i] - _ray.origin[i]) * _ray.inv_direction[i] * (1 + 2 * gamma3);
+
+        // written such that NaNs (0 * inf) leave the interval unchanged
+        t0 = t_near > t0 ? t_near : t0;
+        t1 = t_far  < t1 ? t_far  : t1;
+        if (t0 > t1) return false;
+    }
+    return true;
+}
+
+
+/// Visit all leaves of the hierarchy \c _nodes (rooted at \c _nodes[0])
+/// whose boxes are hit by \c _ray closer than \c _t_max(), which may shrink
+/// while traversing. \c _leaf(first, count) is called for each such leaf.
+template <class TMax, class Leaf>
+void traverse_bvh(const BvhNode* _nodes, const Ray& _ray, TMax _t_max, Leaf _leaf)
+{
+    // allow for a slightly later hit than the current closest one,
+    // hits at the same distance are decided by primitive order
+    constexpr double slack = 1 + 1e-9;
+
+    // build_bvh() limits the depth to less than 128
+    int stack[128];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0)
+    {
+        const BvhNode& node = _nodes[stack[--top]];
+        if (!intersect_node(_ray, node, _t_max() * slack)) continue;
+
+        if (node.count > 0)
+        {
+            _leaf(node.first, node.count);
+        }
+        else
+        {
+            // visit the child closer to the ray origin first
+            const BvhNode& a = _nodes[node.first];
+            const BvhNode& b = _nodes[node.first + 1];
+            const double da = dot(a.bb_min + a.bb_max - 2.0 * _ray.origin, _ray.direction);
+            const double db = dot(b.bb_min + b.bb_max - 2.0 * _ray.origin, _ray.direction);
+            if (da <= db) { stack[top++] = node.first + 1; stack[top++] = node.first;     }
+            else          { stack[top++] = node.first;     stack[top++] = node.first + 1; }
+        }
+    }
+}
@@ -66,6 +66,10 @@ public:
 
         // compute lower left corner on the image plane
         lower_left = center - 0.5f*w*x_dir - 0.5f*h*y_dir;
+
+        // for project()
+        view_dir   = view;
+        plane_dist = dist;
     }
 
 
@@ -82,6 +86,28 @@ public:
     }
 
 
+    /// project a point into the image (the inverse of primary_ray()).
+    ///
+    /// \param[in] _p point in 3D space
+    /// \param[out] _x, _y continuous pixel coordinates, such that the primary ray through (_x, _y) passes through \c _p
+    /// \param[out] _depth distance of \c _p from the eye along the viewing direction
+    /// \return false if \c _p is not in front of the eye
+    bool project(const vec3& _p, double& _x, double& _y, double& _depth) const
+    {
+        const vec3 q = _p - eye;
+        _depth = dot(q, view_dir);
+        if (!(_depth > 0)) return false;
+
+        const double s = plane_dist / _depth;
+        _x = dot(q, x_dir) / dot(x_dir, x_dir) * s + 0.5 * width;
+        _y = dot(q, y_dir) / dot(y_dir, y_dir) * s + 0.5 * height;
+        return true;
+    }
+
+    /// unit viewing direction
+    const vec3& view_direction() const { return view_dir; }
+
+
 public:
 
     /// position of the eye in 3D space (camera center)
@@ -108,6 +134,8 @@ private:
     vec3 x_dir;
     vec3 y_dir;
     vec3 lower_left;
+    vec3 view_dir;
+    double plane_dist;
 };
 
 
@@ -0,0 +1,165 @@
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+#include "Checkpoint.h"
+#include "Image.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+
+
+namespace {
+
+/// magic and version of checkpoint files
+const char MAGIC[4] = {'R', 'T', 'C', 'K'};
+constexpr uint32_t VERSION = 1;
+
+/// longest key that is read from a file
+constexpr uint32_t MAX_KEY_LENGTH = 1 << 16;
+
+void write32le(std::ostream& _os, uint32_t _v)
+{
+    for (int i = 0; i < 4; ++i) _os.put(char((_v >> (8 * i)) & 0xFF));
+}
+
+uint32_t read32le(std::istream& _is)
+{
+    unsigned char b[4] = {0, 0, 0, 0};
+    _is.read(reinterpret_cast<char*>(b), 4);
+    return uint32_t(b[0]) | uint32_t(b[1]) << 8 | uint32_t(b[2]) << 16 | uint32_t(b[3]) << 24;
+}
+
+} // namespace
+
+
+//-----------------------------------------------------------------------------
+
+
+Checkpoint::Checkpoint(const std::filesystem::path& _filename, const std::string& _key,
+                       unsigned int _width, unsigned int _height, unsigned int _tile_size)
+    : filename_(_filename), key_(_key), tile_size_(_tile_size),
+      tiles_(make_tiles(_width, _height, _tile_size)), done_(tiles_.size(), false),
+      canvas_(_width, _height)
+{
+    std::ifstream file(filename_, std::fstream::binary);
+    char magic[4] = {0, 0, 0, 0};
+    file.read(magic, 4);
+    if (file && std::equal(magic, magic + 4, MAGIC) && read32le(file) == VERSION &&
+        read32le(file) == _width && read32le(file) == _height && read32le(file) == _tile_size)
+    {
+        const uint32_t length = read32le(file);
+        std::string key(std::min(length, MAX_KEY_LENGTH), '\0');
+        file.read(key.data(), std::streamsize(key.size()));
+
+        // tiles up to the first incomplete one (the run may have been killed while writing)
+        std::vector<unsigned char> bgr;
+        while (file && key == key_) {
+            const uint32_t i = read32le(file);
+            if (!file || i >= tiles_.size()) break;
+            const Tile& t = tiles_[i];
+            bgr.resize(t.size() * 3);
+            file.read(reinterpret_cast<char*>(bgr.data()), std::streamsize(bgr.size()));
+            if (!file) break;
+
+            const size_t row = size_t(t.width) * 3;
+            for (unsigned int y = 0; y < t.height; ++y)
+                std::copy(bgr.begin() + long(y * row), bgr.begin() + long((y + 1) * row),
+                          canvas_.bgr.begin() + long((size_t(t.y0 + y) * canvas_.width + t.x0) * 3));
+            resumed_ += !done_[i];
+            done_[i] = true;
+        }
+    }
+    file.close();
+
+    // start a clean file, without a tile that was cut off or another render's tiles
+    rewrite();
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void Checkpoint::rewrite()
+{
+    const std::filesystem::path temporary = filename_.string() + ".tmp";
+    {
+        std::ofstream file(temporary, std::fstream::binary);
+        file.write(MAGIC, 4);
+        write32le(file, VERSION);
+        write32le(file, canvas_.width);
+        write32le(file, canvas_.height);
+        write32le(file, tile_size_);
+        write32le(file, uint32_t(key_.size()));
+        file.write(key_.data(), std::streamsize(key_.size()));
+        if (!file) throw std::runtime_error("cannot write checkpoint " + temporary.string());
+    }
+    std::filesystem::rename(temporary, filename_);
+
+    pending_.clear();
+    for (size_t i = 0; i < tiles_.size(); ++i)
+        if (done_[i]) pending_.push_back(i);
+    if (!flush()) throw std::runtime_error("cannot write checkpoint " + filename_.string());
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void Checkpoint::add(size_t _i, const std::vector<vec3>& _pixels)
+{
+    const Tile& t = tiles_[_i];
+    const vec3* color = _pixels.data();
+    for (unsigned int y = 0; y < t.height; ++y) {
+        unsigned char* dst = canvas_.bgr.data() + (size_t(t.y0 + y) * canvas_.width + t.x0) * 3;
+        for (unsigned int x = 0; x < t.width; ++x, ++color, dst += 3) {
+            dst[0] = Image::to_byte((*color)[2]);
+            dst[1] = Image::to_byte((*color)[1]);
+            dst[2] = Image::to_byte((*color)[0]);
+        }
+    }
+    done_[_i] = true;
+    pending_.push_back(_i);
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+bool Checkpoint::flush()
+{
+    if (pending_.empty()) return true;
+
+    std::ofstream file(filename_, std::fstream::binary | std::fstream::app);
+    for (size_t i: pending_) {
+        const Tile& t = tiles_[i];
+        write32le(file, uint32_t(i));
+        const size_t row = size_t(t.width) * 3;
+        for (unsigned int y = 0; y < t.height; ++y)
+            file.write(reinterpret_cast<const char*>(canvas_.bgr.data() + (size_t(t.y0 + y) * canvas_.width + t.x0) * 3),
+                       std::streamsize(row));
+    }
+    file.flush();
+    if (!file) return false;
+    pending_.clear();
+    return true;
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void Checkpoint::remove()
+{
+    std::error_code ec;
+    std::filesystem::remove(filename_, ec);
+    pending_.clear();
+}
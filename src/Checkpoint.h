@@ -0,0 +1,81 @@
+#pragma once
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+#include "PartialImage.h"
+#include "Tile.h"
+#include "vec3.h"
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+
+/// \class Checkpoint Checkpoint.h
+/// The finished tiles of a long render, saved to a file from time to time,
+/// so that a render that is killed (e.g. a preempted job) continues where
+/// it stopped when it is started again. A checkpoint only resumes the render
+/// it was written by: the same scene (see Scene::contentHash()), image size,
+/// tile size and options that change the image.
+///
+/// File format (little endian): the magic "RTCK", the version (1), the width
+/// and height of the image, the tile size and the length of the key as 32-bit
+/// integers, followed by the key. Then, appended by each flush(), the tiles as
+/// their index in make_tiles() order (32 bits) and their pixels as BGR bytes,
+/// bottom row first. A tile cut off at the end of the file is ignored.
+class Checkpoint
+{
+public:
+
+    /// Open the checkpoint \c _filename of the render described by \c _key
+    /// of a \c _width x \c _height image cut into tiles of \c _tile_size.
+    /// Tiles of an earlier run of the same render are kept; a checkpoint of
+    /// another render (or none) is replaced by an empty one.
+    /// Throws std::runtime_error if the file cannot be written.
+    Checkpoint(const std::filesystem::path& _filename, const std::string& _key,
+               unsigned int _width, unsigned int _height, unsigned int _tile_size);
+
+    /// the tiles of the image, row by row from the bottom
+    const std::vector<Tile>& tiles() const { return tiles_; }
+
+    /// Is tile \c _i finished?
+    bool done(size_t _i) const { return done_[_i]; }
+
+    /// number of tiles taken over from an earlier run
+    size_t resumed() const { return resumed_; }
+
+    /// Store the colors \c _pixels of tile \c _i, row by row (see
+    /// Scene::renderTiles()). They are written to the file by the next flush().
+    void add(size_t _i, const std::vector<vec3>& _pixels);
+
+    /// Append the tiles added since the last flush to the file
+    bool flush();
+
+    /// the image, complete once all tiles are done
+    const Canvas& canvas() const { return canvas_; }
+
+    /// Delete the file, e.g. after the image has been written
+    void remove();
+
+private:
+
+    /// write the header and the finished tiles to a new file
+    void rewrite();
+
+    std::filesystem::path filename_;
+    std::string key_;
+    unsigned int tile_size_;
+    std::vector<Tile> tiles_;
+    std::vector<bool> done_;
+    /// finished tiles not yet written to the file
+    std::vector<size_t> pending_;
+    size_t resumed_ = 0;
+    Canvas canvas_;
+};
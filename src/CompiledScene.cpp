@@ -0,0 +1,870 @@
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+//== INCLUDES =================================================================
+
+#include "CompiledScene.h"
+
+#include "Plane.h"
+#include "Sphere.h"
+#include "Cylinder.h"
+#include "Mesh.h"
+#include "SolveQuadratic.h"
+#include "Intersection.h"
+#include "StopWatch.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+
+#if HAVE_OPENMP
+#  include <omp.h>
+#endif
+
+
+//== IMPLEMENTATION ===========================================================
+
+
+namespace {
+
+/// Enlarge \c _box by a tiny margin, so that rounding in the intersection
+/// tests never finds a hit just outside the box of its primitive.
+Aabb padded(Aabb _box)
+{
+    const vec3 margin(1e-9 * (1.0 + std::max({std::abs(_box.min[0]), std::abs(_box.min[1]), std::abs(_box.min[2]),
+                                              std::abs(_box.max[0]), std::abs(_box.max[1]), std::abs(_box.max[2])})));
+    _box.min = _box.min - margin;
+    _box.max = _box.max + margin;
+    return _box;
+}
+
+} // namespace
+
+
+CompiledScene::CompiledScene(std::pmr::memory_resource* _resource)
+    : spheres_(_resource)
+    , cylinders_(_resource)
+    , planes_(_resource)
+    , triangles_(_resource)
+    , meshes_(_resource)
+    , vertex_normals_(_resource)
+    , mesh_nodes_(_resource)
+    , object_nodes_(_resource)
+    , object_prims_(_resource)
+    , object_grid_(_resource)
+    , materials_(_resource)
+    , material_classes_(_resource)
+    , object_material_(_resource)
+    , object_slot_(_resource)
+    , objects_(_resource)
+{
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+CompiledScene::CompiledScene(const CompiledScene& _other, std::pmr::memory_resource* _resource)
+    : CompiledScene(_resource)
+{
+    // (assignment keeps the memory resource of the arrays)
+    spheres_           = _other.spheres_;
+    cylinders_         = _other.cylinders_;
+    planes_            = _other.planes_;
+    triangles_         = _other.triangles_;
+    meshes_            = _other.meshes_;
+    vertex_normals_    = _other.vertex_normals_;
+    mesh_nodes_        = _other.mesh_nodes_;
+    object_nodes_      = _other.object_nodes_;
+    object_prims_      = _other.object_prims_;
+    object_grid_       = _other.object_grid_;
+    mesh_bvh_stats_    = _other.mesh_bvh_stats_;
+    object_bvh_stats_  = _other.object_bvh_stats_;
+    object_grid_stats_ = _other.object_grid_stats_;
+    materials_         = _other.materials_;
+    material_classes_  = _other.material_classes_;
+    object_material_   = _other.object_material_;
+    object_slot_       = _other.object_slot_;
+    objects_           = _other.objects_;
+
+    if (_other.lazy_)
+    {
+        lazy_ = std::make_unique<Lazy>();
+        lazy_->method = _other.lazy_->method;
+        lazy_->meshes = _other.lazy_->meshes;
+        lazy_->once   = std::make_unique<std::once_flag[]>(meshes_.size());
+
+        // hierarchies that are built already must not be built again
+        for (size_t m = 0; m < meshes_.size(); ++m)
+            if (!mesh_nodes_[m].empty()) std::call_once(lazy_->once[m], []() {});
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+int CompiledScene::add_material(const Material& _material)
+{
+    for (size_t i=0; i<materials_.size(); ++i)
+        if (materials_[i] == _material) return int(i);
+
+    materials_.push_back(_material);
+    material_classes_.emplace_back(_material);
+    return int(materials_.size()) - 1;
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void CompiledScene::compile(const std::pmr::vector<Object_ptr>& _objects, BvhMethod _method, bool _lazy,
+                            Accelerator _accelerator)
+{
+    // start from scratch, but keep the memory resource
+    *this = CompiledScene(objects_.get_allocator().resource());
+
+    for (Object_ptr o: _objects)
+    {
+        const int id = int(objects_.size());
+        objects_.push_back(o);
+        object_material_.push_back(add_material(o->material));
+
+        if (auto s = dynamic_cast<const Sphere*>(o))
+        {
+            const size_t i = spheres_.size();
+            spheres_.resize(i+1);
+            spheres_.object[i] = id;
+            object_slot_.push_back(int(i));
+            store(i, *s);
+        }
+        else if (auto c = dynamic_cast<const Cylinder*>(o))
+        {
+            const size_t i = cylinders_.size();
+            cylinders_.resize(i+1);
+            cylinders_.object[i] = id;
+            object_slot_.push_back(int(i));
+            store(i, *c);
+        }
+        else if (auto p = dynamic_cast<const Plane*>(o))
+        {
+            const size_t i = planes_.size();
+            planes_.resize(i+1);
+            planes_.object[i] = id;
+            object_slot_.push_back(int(i));
+            store(i, *p);
+        }
+        else if (auto m = dynamic_cast<const Mesh*>(o))
+        {
+            const int normal_offset = int(vertex_normals_.size());
+            for (const auto& v: m->vertices_)
+                vertex_normals_.push_back(v.normal);
+
+            object_slot_.push_back(int(meshes_.size()));
+            meshes_.bb_min.push_back(m->bb_min_);
+            meshes_.bb_max.push_back(m->bb_max_);
+            meshes_.compressed.push_back(m->compressed_);
+            meshes_.paged.push_back(m->paged_);
+            meshes_.begin.push_back(int(triangles_.size()));
+            for (const auto& t: m->triangles_)
+            {
+                const vec3& p0 = m->vertices_[t.i0].position;
+                const vec3  e1 = p0 - m->vertices_[t.i1].position;
+                const vec3  e2 = p0 - m->vertices_[t.i2].position;
+                triangles_.px .push_back(p0[0]); triangles_.py .push_back(p0[1]); triangles_.pz .push_back(p0[2]);
+                triangles_.e1x.push_back(e1[0]); triangles_.e1y.push_back(e1[1]); triangles_.e1z.push_back(e1[2]);
+                triangles_.e2x.push_back(e2[0]); triangles_.e2y.push_back(e2[1]); triangles_.e2z.push_back(e2[2]);
+                triangles_.normal.push_back(t.normal);
+                triangles_.n0.push_back(normal_offset + t.i0);
+                triangles_.n1.push_back(normal_offset + t.i1);
+                triangles_.n2.push_back(normal_offset + t.i2);
+                triangles_.id.push_back(int(triangles_.id.size()) - meshes_.begin.back());
+            }
+            meshes_.end.push_back(int(triangles_.size()));
+            meshes_.phong.push_back(m->draw_mode_ == Mesh::PHONG);
+            meshes_.object.push_back(id);
+        }
+        else
+        {
+            throw std::logic_error("CompiledScene: unsupported object type");
+        }
+    }
+
+    mesh_nodes_.resize(meshes_.size());
+    if (_lazy)
+    {
+        // only remember how to build; see intersect_mesh()
+        lazy_ = std::make_unique<Lazy>();
+        lazy_->method = _method;
+        lazy_->once   = std::make_unique<std::once_flag[]>(meshes_.size());
+        for (size_t m = 0; m < meshes_.size(); ++m)
+            if (needs_bvh(m)) ++lazy_->meshes;
+    }
+    else
+    {
+        build_mesh_bvhs(_method);
+    }
+    build_object_bvh(_method, _accelerator);
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void CompiledScene::build_mesh_bvh(size_t _m, BvhMethod _method, std::vector<BvhNode>& _nodes, BvhStats& _stats)
+{
+    // only uses the default allocator: this may run concurrently for different meshes
+    const int begin = meshes_.begin[_m], n = meshes_.end[_m] - begin;
+
+    std::vector<Aabb> boxes(n);
+    for (int i = 0; i < n; ++i)
+    {
+        const vec3 p0(triangles_.px [begin+i], triangles_.py [begin+i], triangles_.pz [begin+i]);
+        const vec3 e1(triangles_.e1x[begin+i], triangles_.e1y[begin+i], triangles_.e1z[begin+i]);
+        const vec3 e2(triangles_.e2x[begin+i], triangles_.e2y[begin+i], triangles_.e2z[begin+i]);
+        boxes[i].grow(p0);
+        boxes[i].grow(p0 - e1);
+        boxes[i].grow(p0 - e2);
+        boxes[i] = padded(boxes[i]);
+    }
+
+    std::vector<int> order;
+    build_bvh(boxes, _method, _nodes, order, _stats);
+
+    // store the triangles of this mesh in leaf order
+    auto permute = [&](auto& _array) {
+        std::vector<typename std::decay_t<decltype(_array)>::value_type> tmp(n);
+        for (int i = 0; i < n; ++i) tmp[i] = _array[begin + order[i]];
+        std::copy(tmp.begin(), tmp.end(), _array.begin() + begin);
+    };
+    for (auto a: {&triangles_.px, &triangles_.py, &triangles_.pz,
+                  &triangles_.e1x, &triangles_.e1y, &triangles_.e1z,
+                  &triangles_.e2x, &triangles_.e2y, &triangles_.e2z})
+        permute(*a);
+    permute(triangles_.normal);
+    permute(triangles_.n0);
+    permute(triangles_.n1);
+    permute(triangles_.n2);
+    permute(triangles_.id);
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+bool CompiledScene::needs_bvh(size_t _m) const
+{
+    return meshes_.begin[_m] < meshes_.end[_m] && !meshes_.compressed[_m] && !meshes_.paged[_m];
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void CompiledScene::build_mesh_bvhs(BvhMethod _method)
+{
+    StopWatch timer;
+    timer.start();
+
+    const size_t num_meshes = meshes_.size();
+    std::vector<std::vector<BvhNode>> nodes(num_meshes);
+    std::vector<BvhStats> stats(num_meshes);
+
+    auto build = [&](size_t m) {
+        if (needs_bvh(m)) build_mesh_bvh(m, _method, nodes[m], stats[m]);
+    };
+
+#if HAVE_OPENMP
+#  pragma omp parallel
+#  pragma omp single
+    for (size_t m = 0; m < num_meshes; ++m)
+    {
+#  pragma omp task firstprivate(m)
+        build(m);
+    }
+#else
+    for (size_t m = 0; m < num_meshes; ++m) build(m);
+#endif
+
+    for (size_t m = 0; m < num_meshes; ++m)
+    {
+        mesh_nodes_[m].assign(nodes[m].begin(), nodes[m].end());
+        if (!nodes[m].empty()) mesh_bvh_stats_.merge(stats[m]);
+    }
+    mesh_bvh_stats_.build_ms = timer.stop();
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void CompiledScene::build_lazy_bvh(size_t _m)
+{
+    std::vector<BvhNode> nodes;
+    BvhStats stats;
+    build_mesh_bvh(_m, lazy_->method, nodes, stats);
+    mesh_nodes_[_m].assign(nodes.begin(), nodes.end());
+
+    std::lock_guard<std::mutex> lock(lazy_->mutex);
+    mesh_bvh_stats_.merge(stats);
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+Aabb CompiledScene::bounds(const Prim& _prim) const
+{
+    const int i = _prim.slot;
+    Aabb box;
+
+    switch (_prim.kind)
+    {
+        case SPHERE:
+        {
+            const vec3 center(spheres_.cx[i], spheres_.cy[i], spheres_.cz[i]);
+            const vec3 extent(spheres_.radius[i]);
+            box.grow(center - extent);
+            box.grow(center + extent);
+            break;
+        }
+
+        case CYLINDER:
+        {
+            // caps are disks of the given radius around the ends of the axis
+            const vec3   center(cylinders_.cx[i], cylinders_.cy[i], cylinders_.cz[i]);
+            const vec3   axis  (cylinders_.ax[i], cylinders_.ay[i], cylinders_.az[i]);
+            const double radius = cylinders_.radius[i];
+            const double height = cylinders_.height[i];
+            vec3 extent;
+            for (int j = 0; j < 3; ++j)
+                extent[j] = std::abs(axis[j]) * 0.5 * height + radius * std::sqrt(std::max(0.0, 1.0 - axis[j]*axis[j]));
+            box.grow(center - extent);
+            box.grow(center + extent);
+            break;
+        }
+
+        case TRIANGLE:
+        {
+            box.grow(meshes_.bb_min[i]);
+            box.grow(meshes_.bb_max[i]);
+            break;
+        }
+    }
+
+    return padded(box);
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void CompiledScene::build_object_bvh(BvhMethod _method, Accelerator _accelerator)
+{
+    std::vector<Prim> prims;
+    for (size_t i = 0; i < spheres_.size();   ++i) prims.push_back({SPHERE,   int(i)});
+    for (size_t i = 0; i < cylinders_.size(); ++i) prims.push_back({CYLINDER, int(i)});
+    for (size_t i = 0; i < meshes_.size();    ++i) prims.push_back({TRIANGLE, int(i)});
+
+    std::vector<Aabb> boxes;
+    boxes.reserve(prims.size());
+    for (const Prim& p: prims) boxes.push_back(bounds(p));
+
+    if (_accelerator == Accelerator::GRID || (_accelerator == Accelerator::AUTO && Grid::suitable(boxes)))
+    {
+        object_prims_.assign(prims.begin(), prims.end());
+        object_grid_.build(boxes, object_grid_stats_);
+        return;
+    }
+
+    std::vector<BvhNode> nodes;
+    std::vector<int>     order;
+    build_bvh(boxes, _method, nodes, order, object_bvh_stats_);
+
+    object_nodes_.assign(nodes.begin(), nodes.end());
+    for (int i: order) object_prims_.push_back(prims[i]);
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+std::vector<Aabb> CompiledScene::object_boxes() const
+{
+    std::vector<Aabb> boxes;
+    boxes.reserve(object_prims_.size());
+    for (const Prim& p: object_prims_) boxes.push_back(bounds(p));
+    return boxes;
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void CompiledScene::refit(const std::vector<int>& _objects)
+{
+    for (int id: _objects)
+    {
+        Object_ptr   o    = objects_[id];
+        const size_t slot = size_t(object_slot_[id]);
+
+        object_material_[id] = add_material(o->material);
+
+        if      (auto s = dynamic_cast<const Sphere*>(o))   store(slot, *s);
+        else if (auto c = dynamic_cast<const Cylinder*>(o)) store(slot, *c);
+        else if (auto p = dynamic_cast<const Plane*>(o))    store(slot, *p);
+    }
+    if (_objects.empty()) return;
+
+    // moved spheres and cylinders change the cells of the grid (cheap to
+    // build again) or the boxes of the object hierarchy
+    if (uses_grid())
+    {
+        object_grid_.build(object_boxes(), object_grid_stats_);
+        return;
+    }
+    struct Boxes
+    {
+        const CompiledScene& scene;
+        Aabb operator[](int _i) const { return scene.bounds(scene.object_prims_[_i]); }
+    };
+    refit_bvh(object_nodes_, Boxes{*this});
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void CompiledScene::store(size_t _slot, const Sphere& _sphere)
+{
+    spheres_.cx[_slot]     = _sphere.center[0];
+    spheres_.cy[_slot]     = _sphere.center[1];
+    spheres_.cz[_slot]     = _sphere.center[2];
+    spheres_.radius[_slot] = _sphere.radius;
+}
+
+
+void CompiledScene::store(size_t _slot, const Cylinder& _cylinder)
+{
+    cylinders_.cx[_slot]     = _cylinder.center[0];
+    cylinders_.cy[_slot]     = _cylinder.center[1];
+    cylinders_.cz[_slot]     = _cylinder.center[2];
+    cylinders_.ax[_slot]     = _cylinder.axis[0];
+    cylinders_.ay[_slot]     = _cylinder.axis[1];
+    cylinders_.az[_slot]     = _cylinder.axis[2];
+    cylinders_.radius[_slot] = _cylinder.radius;
+    cylinders_.height[_slot] = _cylinder.height;
+}
+
+
+void CompiledScene::store(size_t _slot, const Plane& _plane)
+{
+    planes_.cx[_slot] = _plane.center[0];
+    planes_.cy[_slot] = _plane.center[1];
+    planes_.cz[_slot] = _plane.center[2];
+    planes_.nx[_slot] = _plane.normal[0];
+    planes_.ny[_slot] = _plane.normal[1];
+    planes_.nz[_slot] = _plane.normal[2];
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+bool CompiledScene::intersect(const Ray& _ray,
+                              int&       _object,
+                              vec3&      _point,
+                              vec3&      _normal,
+                              double&    _t) const
+{
+    return intersect(_ray, Primary(), _object, _point, _normal, _t);
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+bool CompiledScene::intersect(const Ray&     _ray,
+                              const Primary& _primary,
+                              int&           _object,
+                              vec3&          _point,
+                              vec3&          _normal,
+                              double&        _t) const
+{
+    Hit hit;
+    if (!intersect(_ray, _primary, hit)) return false;
+
+    _object = hit.object;
+    _t      = hit.t;
+    hit_attributes(_ray, hit, _point, _normal);
+    return true;
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+bool CompiledScene::intersect(const Ray& _ray, const Primary& _primary, Hit& _hit) const
+{
+    _hit = Hit();
+
+    // The rasterized primitive is intersected exactly. If the ray hits it,
+    // that hit bounds the search, which then only has to confirm that
+    // nothing is closer. (Rasterization is not exact at edges.)
+    if (_primary.prim >= 0)
+    {
+        const Prim& p = object_prims_[_primary.prim];
+        if (p.kind == TRIANGLE && _primary.triangle >= 0)
+        {
+            // (a lazy hierarchy reorders the triangles, but any triangle hit is a valid bound)
+            if (lazy_)
+                std::call_once(lazy_->once[p.slot], [&]() { const_cast<CompiledScene*>(this)->build_lazy_bvh(size_t(p.slot)); });
+            intersect_face(_ray, p.slot, meshes_.begin[p.slot] + _primary.triangle, _hit);
+        }
+        else if (p.kind != TRIANGLE)
+        {
+            intersect_prim(_ray, _primary.prim, _hit);
+        }
+    }
+
+    if (_primary.prims)
+    {
+        for (int j: *_primary.prims)
+            intersect_prim(_ray, j, _hit);
+    }
+    else if (uses_grid())
+    {
+        object_grid_.traverse(_ray,
+                              [&]() { return _hit.t; },
+                              [&](int _j) { intersect_prim(_ray, _j, _hit); });
+    }
+    else if (!object_nodes_.empty())
+    {
+        traverse_bvh(object_nodes_.data(), _ray,
+                     [&]() { return _hit.t; },
+                     [&](int _first, int _count) {
+                         for (int j = _first; j < _first + _count; ++j)
+                             intersect_prim(_ray, j, _hit);
+                     });
+    }
+
+    for (int i=0, n=int(planes_.size()); i<n; ++i)
+        intersect_plane(_ray, i, _hit);
+
+    return _hit.object >= 0;
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void CompiledScene::cull(const Frustum& _frustum, std::vector<int>& _prims) const
+{
+    _prims.clear();
+
+    // without a hierarchy, the boxes of all primitives are tested
+    if (uses_grid())
+    {
+        for (int j = 0; j < int(object_prims_.size()); ++j)
+        {
+            const Aabb box = bounds(object_prims_[j]);
+            if (_frustum.intersects(box.min, box.max)) _prims.push_back(j);
+        }
+        return;
+    }
+    if (object_nodes_.empty()) return;
+
+    std::vector<int> stack = { 0 };
+    while (!stack.empty())
+    {
+        const BvhNode& node = object_nodes_[stack.back()];
+        stack.pop_back();
+        if (!_frustum.intersects(node.bb_min, node.bb_max)) continue;
+
+        if (node.count > 0)
+        {
+            for (int j = node.first; j < node.first + node.count; ++j)
+            {
+                const Aabb box = bounds(object_prims_[j]);
+                if (_frustum.intersects(box.min, box.max)) _prims.push_back(j);
+            }
+        }
+        else
+        {
+            stack.push_back(node.first + 1);
+            stack.push_back(node.first);
+        }
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void CompiledScene::intersect_prim(const Ray& _ray, int _j, Hit& _hit) const
+{
+    const Prim& p = object_prims_[_j];
+    switch (p.kind)
+    {
+        case SPHERE:   intersect_sphere  (_ray, p.slot, _hit); break;
+        case CYLINDER: intersect_cylinder(_ray, p.slot, _hit); break;
+        case TRIANGLE: intersect_mesh    (_ray, p.slot, _hit); break;
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void CompiledScene::intersect_sphere(const Ray& _ray, int _i, Hit& _hit) const
+{
+    const vec3& dir = _ray.direction;
+    const double a  = dot(dir, dir);
+
+    const vec3 oc = _ray.origin - vec3(spheres_.cx[_i], spheres_.cy[_i], spheres_.cz[_i]);
+    const double r = spheres_.radius[_i];
+
+    std::array<double, 2> t;
+    size_t nsol = solveQuadratic(a, 2 * dot(dir, oc), dot(oc, oc) - r * r, t);
+
+    double tmin = Object::NO_INTERSECTION;
+    for (size_t j = 0; j < nsol; ++j)
+        if (t[j] > 0) tmin = std::min(tmin, t[j]);
+
+    if (tmin != Object::NO_INTERSECTION && _hit.closer(tmin, spheres_.object[_i]))
+    {
+        _hit.t      = tmin;
+        _hit.object = spheres_.object[_i];
+        _hit.kind   = SPHERE;
+        _hit.index  = _i;
+        _hit.order  = 0;
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void CompiledScene::intersect_cylinder(const Ray& _ray, int _i, Hit& _hit) const
+{
+    const vec3& d = _ray.direction;
+
+    const vec3   center(cylinders_.cx[_i], cylinders_.cy[_i], cylinders_.cz[_i]);
+    const vec3   axis  (cylinders_.ax[_i], cylinders_.ay[_i], cylinders_.az[_i]);
+    const double radius = cylinders_.radius[_i];
+    const double height = cylinders_.height[_i];
+
+    const vec3 m      = _ray.origin - center;
+    const vec3 m_perp = m - dot(m, axis) * axis;
+    const vec3 d_perp = d - dot(d, axis) * axis;
+
+    std::array<double, 2> t;
+    size_t nsol = solveQuadratic(dot(d_perp, d_perp),
+                                 2.0 * dot(m_perp, d_perp),
+                                 dot(m_perp, m_perp) - radius*radius, t);
+    if (nsol == 2 && t[0] > t[1]) std::swap(t[0], t[1]);
+
+    // first solution in front of the viewer that lies within the height
+    for (size_t j = 0; j < nsol; ++j)
+    {
+        if (t[j] > 0)
+        {
+            const vec3   p = _ray.origin + t[j] * d;
+            const double h = dot(p - center, axis);
+            if (h >= -height/2 && h <= height/2)
+            {
+                if (_hit.closer(t[j], cylinders_.object[_i]))
+                {
+                    _hit.t      = t[j];
+                    _hit.object = cylinders_.object[_i];
+                    _hit.kind   = CYLINDER;
+                    _hit.index  = _i;
+                    _hit.order  = 0;
+                }
+                break;
+            }
+        }
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void CompiledScene::intersect_plane(const Ray& _ray, int _i, Hit& _hit) const
+{
+    const vec3& dir = _ray.direction;
+
+    const vec3 normal(planes_.nx[_i], planes_.ny[_i], planes_.nz[_i]);
+    const vec3 oc = _ray.origin - vec3(planes_.cx[_i], planes_.cy[_i], planes_.cz[_i]);
+
+    const double denom = dot(normal, dir);
+    if (fabs(denom) < 0.000000001) return;
+
+    const double t = -dot(normal, oc) / denom;
+    if (t <= 0) return;
+
+    if (_hit.closer(t, planes_.object[_i]))
+    {
+        _hit.t      = t;
+        _hit.object = planes_.object[_i];
+        _hit.kind   = PLANE;
+        _hit.index  = _i;
+        _hit.order  = 0;
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void CompiledScene::intersect_mesh(const Ray& _ray, int _m, Hit& _hit) const
+{
+    if (!intersect_box(_ray, meshes_.bb_min[_m], meshes_.bb_max[_m])) return;
+
+    const int object = meshes_.object[_m];
+
+    const CompressedMesh* cm = meshes_.compressed[_m];
+    const PagedMesh*      pm = meshes_.paged[_m];
+    if (cm || pm)
+    {
+        double   t, beta, gamma;
+        uint32_t triangle;
+        const bool found = cm ? cm->intersect(_ray, t, triangle, beta, gamma)
+                              : pm->intersect(_ray, t, triangle, beta, gamma);
+        if (found && _hit.closer(t, object))
+        {
+            _hit.t      = t;
+            _hit.object = object;
+            _hit.kind   = TRIANGLE;
+            _hit.index  = int(triangle);
+            _hit.mesh   = _m;
+            _hit.order  = 0;
+            _hit.beta   = beta;
+            _hit.gamma  = gamma;
+        }
+        return;
+    }
+
+    const int begin = meshes_.begin[_m];
+    if (begin == meshes_.end[_m]) return;
+
+    // the first ray that reaches the mesh builds its hierarchy, others wait
+    // (building reorders the triangles of this mesh only, so it is logically const)
+    if (lazy_)
+        std::call_once(lazy_->once[_m], [&]() { const_cast<CompiledScene*>(this)->build_lazy_bvh(size_t(_m)); });
+
+    traverse_bvh(mesh_nodes_[_m].data(), _ray,
+                 [&]() { return _hit.t; },
+                 [&](int _first, int _count) {
+                     for (int i = begin + _first, end = i + _count; i < end; ++i)
+                         intersect_face(_ray, _m, i, _hit);
+                 });
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void CompiledScene::intersect_face(const Ray& _ray, int _m, int _i, Hit& _hit) const
+{
+    const vec3 p0(triangles_.px [_i], triangles_.py [_i], triangles_.pz [_i]);
+    const vec3 e1(triangles_.e1x[_i], triangles_.e1y[_i], triangles_.e1z[_i]);
+    const vec3 e2(triangles_.e2x[_i], triangles_.e2y[_i], triangles_.e2z[_i]);
+
+    double t, beta, gamma;
+    if (!intersect_triangle(_ray, p0, e1, e2, t, beta, gamma)) return;
+
+    const int object = meshes_.object[_m];
+    if (_hit.closer(t, object, triangles_.id[_i]))
+    {
+        _hit.t      = t;
+        _hit.object = object;
+        _hit.kind   = TRIANGLE;
+        _hit.index  = _i;
+        _hit.mesh   = _m;
+        _hit.order  = triangles_.id[_i];
+        _hit.beta   = beta;
+        _hit.gamma  = gamma;
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void CompiledScene::hit_attributes(const Ray& _ray, const Hit& _hit, vec3& _point, vec3& _normal) const
+{
+    const int i = _hit.index;
+
+    switch (_hit.kind)
+    {
+        case SPHERE:
+        {
+            const vec3 center(spheres_.cx[i], spheres_.cy[i], spheres_.cz[i]);
+            _point  = _ray(_hit.t);
+            _normal = (_point - center) / spheres_.radius[i];
+            break;
+        }
+
+        case CYLINDER:
+        {
+            const vec3 center(cylinders_.cx[i], cylinders_.cy[i], cylinders_.cz[i]);
+            const vec3 axis  (cylinders_.ax[i], cylinders_.ay[i], cylinders_.az[i]);
+            _point = _ray.origin + _hit.t * _ray.direction;
+
+            const vec3 normal = normalize((_point - center) - dot(_point - center, axis) * axis);
+            _normal = (dot(_ray.direction, normal) > 0) ? -normal : normal;
+            break;
+        }
+
+        case PLANE:
+        {
+            _point  = _ray.origin + _hit.t * _ray.direction;
+            _normal = vec3(planes_.nx[i], planes_.ny[i], planes_.nz[i]);
+            break;
+        }
+
+        case TRIANGLE:
+        {
+            if (const CompressedMesh* cm = meshes_.compressed[_hit.mesh])
+            {
+                cm->hit_attributes(_ray, _hit.t, uint32_t(i), _hit.beta, _hit.gamma, meshes_.phong[_hit.mesh], _point, _normal);
+                break;
+            }
+            if (const PagedMesh* pm = meshes_.paged[_hit.mesh])
+            {
+                pm->hit_attributes(_ray, _hit.t, uint32_t(i), _hit.beta, _hit.gamma, meshes_.phong[_hit.mesh], _point, _normal);
+                break;
+            }
+
+            _point = _hit.t * _ray.direction + _ray.origin;
+
+            if (!meshes_.phong[_hit.mesh])
+            {
+                _normal = triangles_.normal[i];
+            }
+            else
+            {
+                // interpolate vertex normals with the barycentric coordinates of the hit
+                const double alpha = 1 - _hit.beta - _hit.gamma;
+
+                _normal = normalize(alpha      * vertex_normals_[triangles_.n0[i]]
+                                  + _hit.beta  * vertex_normals_[triangles_.n1[i]]
+                                  + _hit.gamma * vertex_normals_[triangles_.n2[i]]);
+            }
+            break;
+        }
+    }
+}
+
+
+//=============================================================================
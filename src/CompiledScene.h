@@ -0,0 +1,361 @@
+#pragma once
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+#include "Bvh.h"
+#include "Grid.h"
+#include "Frustum.h"
+#include "Object.h"
+#include "Material.h"
+#include "CompressedMesh.h"
+#include "PagedMesh.h"
+#include "Ray.h"
+#include "vec3.h"
+
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <vector>
+
+class Sphere;
+class Cylinder;
+class Plane;
+
+
+/// \class CompiledScene CompiledScene.h
+/// A flattened, render-only copy of a scene's objects. The Object hierarchy
+/// is convenient for loading and authoring, but each intersection test costs
+/// a pointer chase and a virtual call. After loading, Scene::read() compiles
+/// all objects into contiguous per-type arrays (structure of arrays) and a
+/// separate material table. Spheres, cylinders and meshes are found through
+/// a bounding volume hierarchy or a uniform grid over the objects (see
+/// Grid.h), the triangles of each mesh through a hierarchy over its triangles
+/// (see Bvh.h); planes are unbounded and intersected in a loop.
+class CompiledScene
+{
+public:
+
+    /// Construct an empty compiled scene whose arrays are allocated from
+    /// \c _resource (usually the scene's SceneArena).
+    explicit CompiledScene(std::pmr::memory_resource* _resource = std::pmr::get_default_resource());
+
+    /// Construct a copy of \c _other whose arrays are allocated from
+    /// \c _resource, e.g. a replica in the memory of another NUMA node.
+    /// Compressed and paged meshes are shared; lazily built mesh hierarchies
+    /// that \c _other has not built yet are built separately by the copy.
+    CompiledScene(const CompiledScene& _other, std::pmr::memory_resource* _resource);
+
+    /// Flatten \c _objects into per-type primitive arrays and build their
+    /// hierarchies with \c _method. With \c _lazy, the hierarchy of a mesh is
+    /// only built when the first ray reaches its bounding box (thread-safe),
+    /// so meshes that are never hit cost no build time and memory.
+    /// \c _accelerator selects the structure over the objects; with AUTO, a
+    /// grid is built if Grid::suitable() accepts their bounding boxes.
+    /// The objects have to outlive the compiled scene.
+    void compile(const std::pmr::vector<Object_ptr>& _objects,
+                 BvhMethod _method = BvhMethod::SAH, bool _lazy = false,
+                 Accelerator _accelerator = Accelerator::BVH);
+
+    /// Update the compiled copies of the objects \c _objects after their
+    /// geometry or material was changed in place. Spheres, cylinders and
+    /// planes are stored again in their slots; of meshes only the material
+    /// is updated (changed mesh geometry requires compile()). Afterwards the
+    /// object hierarchy is refit, or a grid over the objects built again, once.
+    void refit(const std::vector<int>& _objects);
+
+    /// Computes the closest intersection point between a ray and all primitives.
+    /// Ties are broken in favour of the object that was loaded first, which
+    /// reproduces the behaviour of intersecting the objects one after another.
+    /// \param[in] _ray the ray to intersect the scene with
+    /// \param[out] _object index of the closest object (see object())
+    /// \param[out] _point the point of intersection
+    /// \param[out] _normal the surface normal at intersection point
+    /// \param[out] _t ray parameter at intersection point
+    bool intersect(const Ray& _ray,
+                   int&       _object,
+                   vec3&      _point,
+                   vec3&      _normal,
+                   double&    _t) const;
+
+    /// Collect the primitives (spheres, cylinders and meshes) whose bounds
+    /// intersect \c _frustum, e.g. the candidates of the primary rays of a
+    /// screen tile. Planes are unbounded and always intersected.
+    void cull(const Frustum& _frustum, std::vector<int>& _prims) const;
+
+    /// primitive kinds, used to compute hit attributes after the search
+    enum Kind { SPHERE, CYLINDER, PLANE, TRIANGLE };
+
+    /// What is known about a primary ray before it is intersected
+    struct Primary
+    {
+        /// candidate primitives of its screen tile (see cull()), nullptr for all
+        const std::vector<int>* prims = nullptr;
+        /// primitive and triangle rasterized at its pixel (see VisibilityBuffer), -1 if none
+        int prim = -1, triangle = -1;
+    };
+
+    /// Like intersect(), but for a primary ray: only tests the candidates
+    /// found by cull() (and all planes), and starts from the rasterized hit,
+    /// which bounds the search. Gives the same result as intersect().
+    bool intersect(const Ray&     _ray,
+                   const Primary& _primary,
+                   int&           _object,
+                   vec3&          _point,
+                   vec3&          _normal,
+                   double&        _t) const;
+
+    /// Compact record of the closest hit found so far during intersect().
+    /// The search only records which primitive was hit where; point and
+    /// normal are computed by hit_attributes() for the final closest hit.
+    struct Hit
+    {
+        double t      = Object::NO_INTERSECTION;
+        int    object = -1;
+        /// primitive kind (see Kind), index in its array and mesh of a triangle
+        int    kind   = -1;
+        int    index  = -1;
+        int    mesh   = -1;
+        /// original order of a triangle within its mesh (breaks ties)
+        int    order  = -1;
+        /// barycentric coordinates of vertices 1 and 2 of a hit triangle
+        double beta   = 0, gamma = 0;
+
+        /// Is a hit at \c _t on primitive \c _order of object \c _object
+        /// closer than the current one? Ties are broken by object index, then
+        /// by the original triangle order within a mesh.
+        bool closer(double _t, int _object, int _order = 0) const
+        {
+            return _t < t || (_t == t && (_object < object || (_object == object && _order < order)));
+        }
+    };
+
+    /// Find the closest hit of \c _ray (see intersect() above) without
+    /// computing its point and normal, e.g. for shadow rays. \c _primary
+    /// describes a primary ray like for intersect().
+    bool intersect(const Ray& _ray, const Primary& _primary, Hit& _hit) const;
+
+    /// Like intersect(const Ray&, const Primary&, Hit&) for a ray that is not primary.
+    bool intersect(const Ray& _ray, Hit& _hit) const { return intersect(_ray, Primary(), _hit); }
+
+    /// Compute the point and normal of \c _hit, the closest hit of \c _ray.
+    void hit_attributes(const Ray& _ray, const Hit& _hit, vec3& _point, vec3& _normal) const;
+
+    /// Number of primitives in the object hierarchy or grid (spheres, cylinders and meshes)
+    size_t num_bounded() const { return object_prims_.size(); }
+
+    /// The authoring object that corresponds to object index \c _object.
+    Object_ptr object(int _object) const { return objects_[_object]; }
+
+    /// The material of object index \c _object.
+    const Material& material(int _object) const { return materials_[object_material_[_object]]; }
+
+    /// The class of the material of object index \c _object.
+    const MaterialClass& material_class(int _object) const { return material_classes_[object_material_[_object]]; }
+
+    /// Number of compiled objects
+    size_t num_objects() const { return objects_.size(); }
+
+    /// Number of distinct materials in the material table
+    size_t num_materials() const { return materials_.size(); }
+
+    /// Number of compiled triangles (over all meshes)
+    size_t num_triangles() const { return triangles_.size(); }
+
+    /// Build statistics of the triangle hierarchies of all meshes (build_ms
+    /// is the wall-clock time of building them in parallel, or the summed
+    /// time of lazy builds). Only call while no rays are traced.
+    const BvhStats& mesh_bvh_stats() const { return mesh_bvh_stats_; }
+
+    /// Are mesh hierarchies built lazily (see compile())?
+    bool lazy_bvh() const { return lazy_ != nullptr; }
+
+    /// Number of meshes whose hierarchy is built lazily, built or not yet
+    size_t num_lazy_meshes() const { return lazy_ ? lazy_->meshes : 0; }
+
+    /// Build statistics of the hierarchy over spheres, cylinders and meshes
+    const BvhStats& object_bvh_stats() const { return object_bvh_stats_; }
+
+    /// Are spheres, cylinders and meshes found through a grid instead of a hierarchy?
+    bool uses_grid() const { return !object_grid_.empty(); }
+
+    /// Build statistics of the grid over spheres, cylinders and meshes (see uses_grid())
+    const GridStats& object_grid_stats() const { return object_grid_stats_; }
+
+private:
+
+    /// rasterizes the compiled primitives
+    friend class VisibilityBuffer;
+
+
+    /// primitive of the object hierarchy: kind (SPHERE, CYLINDER or
+    /// TRIANGLE for meshes) and slot in its per-type array
+    struct Prim
+    {
+        int kind;
+        int slot;
+    };
+
+    /// add \c _material to the material table (if not present), return its index
+    int add_material(const Material& _material);
+
+    void intersect_sphere  (const Ray& _ray, int _i, Hit& _hit) const;
+    void intersect_cylinder(const Ray& _ray, int _i, Hit& _hit) const;
+    void intersect_plane   (const Ray& _ray, int _i, Hit& _hit) const;
+    void intersect_mesh    (const Ray& _ray, int _m, Hit& _hit) const;
+
+    /// intersect triangle \c _i of mesh \c _m
+    void intersect_face(const Ray& _ray, int _m, int _i, Hit& _hit) const;
+
+    /// intersect primitive \c _j of the object hierarchy
+    void intersect_prim(const Ray& _ray, int _j, Hit& _hit) const;
+
+    /// does mesh \c _m have a triangle hierarchy here? Compressed and paged
+    /// meshes bring their own hierarchies over their clusters instead.
+    bool needs_bvh(size_t _m) const;
+
+    /// build the triangle hierarchy of mesh \c _m, reordering its triangles into leaf order
+    void build_mesh_bvh(size_t _m, BvhMethod _method, std::vector<BvhNode>& _nodes, BvhStats& _stats);
+
+    /// build the triangle hierarchies of all meshes in parallel
+    void build_mesh_bvhs(BvhMethod _method);
+
+    /// build the hierarchy of mesh \c _m on first use (see intersect_mesh())
+    void build_lazy_bvh(size_t _m);
+
+    /// build the hierarchy or the grid over spheres, cylinders and meshes
+    void build_object_bvh(BvhMethod _method, Accelerator _accelerator);
+
+    /// bounding boxes of object_prims_
+    std::vector<Aabb> object_boxes() const;
+
+    /// bounding box of object hierarchy primitive \c _prim
+    Aabb bounds(const Prim& _prim) const;
+
+    /// write the geometry of an object into slot \c _slot of its array
+    void store(size_t _slot, const Sphere& _sphere);
+    void store(size_t _slot, const Cylinder& _cylinder);
+    void store(size_t _slot, const Plane& _plane);
+
+private:
+
+    /// all arrays are allocated from the scene's memory resource
+    template <class T> using Array = std::pmr::vector<T>;
+    using Resource = std::pmr::memory_resource*;
+
+    /// spheres: center and radius
+    struct Spheres
+    {
+        explicit Spheres(Resource r) : cx(r), cy(r), cz(r), radius(r), object(r) {}
+        Array<double> cx, cy, cz, radius;
+        Array<int>    object;
+        size_t size() const { return object.size(); }
+        void resize(size_t n) { for (auto a: {&cx, &cy, &cz, &radius}) a->resize(n); object.resize(n); }
+    } spheres_;
+
+    /// cylinders: center, unit axis, radius and height
+    struct Cylinders
+    {
+        explicit Cylinders(Resource r)
+            : cx(r), cy(r), cz(r), ax(r), ay(r), az(r), radius(r), height(r), object(r) {}
+        Array<double> cx, cy, cz, ax, ay, az, radius, height;
+        Array<int>    object;
+        size_t size() const { return object.size(); }
+        void resize(size_t n) { for (auto a: {&cx, &cy, &cz, &ax, &ay, &az, &radius, &height}) a->resize(n); object.resize(n); }
+    } cylinders_;
+
+    /// planes: point on the plane and normal
+    struct Planes
+    {
+        explicit Planes(Resource r) : cx(r), cy(r), cz(r), nx(r), ny(r), nz(r), object(r) {}
+        Array<double> cx, cy, cz, nx, ny, nz;
+        Array<int>    object;
+        size_t size() const { return object.size(); }
+        void resize(size_t n) { for (auto a: {&cx, &cy, &cz, &nx, &ny, &nz}) a->resize(n); object.resize(n); }
+    } planes_;
+
+    /// triangles of all meshes: first vertex p0 and the edges p0-p1, p0-p2.
+    /// Shading data (face normal, vertex normal indices) is kept separate,
+    /// as it is only needed for the closest hit. The triangles of each mesh
+    /// are stored in the leaf order of its hierarchy; id is the index of the
+    /// triangle in the mesh, which breaks ties between equally close hits.
+    struct Triangles
+    {
+        explicit Triangles(Resource r)
+            : px(r), py(r), pz(r), e1x(r), e1y(r), e1z(r), e2x(r), e2y(r), e2z(r)
+            , normal(r), n0(r), n1(r), n2(r), id(r) {}
+        Array<double> px, py, pz, e1x, e1y, e1z, e2x, e2y, e2z;
+        Array<vec3>   normal;
+        Array<int>    n0, n1, n2;
+        Array<int>    id;
+        size_t size() const { return px.size(); }
+    } triangles_;
+
+    /// meshes: bounding box and range of triangles in triangles_.
+    /// Compressed and paged meshes are not flattened (that would undo the
+    /// memory savings), but intersected by their own kernels.
+    struct Meshes
+    {
+        explicit Meshes(Resource r)
+            : bb_min(r), bb_max(r), begin(r), end(r), phong(r), compressed(r), paged(r), object(r) {}
+        Array<vec3> bb_min, bb_max;
+        Array<int>  begin, end;
+        Array<bool> phong;
+        Array<const CompressedMesh*> compressed;
+        Array<const PagedMesh*>      paged;
+        Array<int>  object;
+        size_t size() const { return object.size(); }
+    } meshes_;
+
+    /// vertex normals of all meshes, indexed by Triangles::n0/n1/n2
+    Array<vec3> vertex_normals_;
+
+    /// triangle hierarchy of each mesh; leaves index triangles
+    /// relative to the first triangle of their mesh
+    Array<Array<BvhNode>> mesh_nodes_;
+
+    /// state of lazily built mesh hierarchies
+    struct Lazy
+    {
+        BvhMethod  method = BvhMethod::SAH;
+        /// number of meshes with a lazy hierarchy
+        size_t     meshes = 0;
+        /// one flag per mesh
+        std::unique_ptr<std::once_flag[]> once;
+        /// guards mesh_bvh_stats_
+        std::mutex mutex;
+    };
+    std::unique_ptr<Lazy> lazy_;
+
+    /// hierarchy over spheres, cylinders and meshes, and its primitives in
+    /// leaf order; or, if a grid is used, no nodes and the primitives in
+    /// the order of the objects
+    Array<BvhNode> object_nodes_;
+    Array<Prim>    object_prims_;
+
+    /// grid over object_prims_ (empty if the hierarchy is used)
+    Grid object_grid_;
+
+    BvhStats  mesh_bvh_stats_;
+    BvhStats  object_bvh_stats_;
+    GridStats object_grid_stats_;
+
+    /// material table, and the class of each material
+    Array<Material> materials_;
+    Array<MaterialClass> material_classes_;
+
+    /// material index per object
+    Array<int> object_material_;
+
+    /// index of each object in its per-type array
+    Array<int> object_slot_;
+
+    /// authoring objects, indexed by object index
+    Array<Object_ptr> objects_;
+};
@@ -0,0 +1,337 @@
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+//== INCLUDES =================================================================
+
+#include "CompressedMesh.h"
+#include "Intersection.h"
+#include "Object.h"
+
+#include <algorithm>
+#include <limits>
+
+
+//== IMPLEMENTATION ===========================================================
+
+
+CompressedMesh::CompressedMesh(const std::vector<vec3>& _positions,
+                               const std::vector<vec3>& _normals,
+                               const std::vector<std::array<int, 3>>& _triangles,
+                               std::pmr::memory_resource* _resource)
+    : clusters_(_resource)
+    , nodes_(_resource)
+    , cluster_order_(_resource)
+    , cluster_nodes_(_resource)
+    , positions_(_resource)
+    , normals_(_resource)
+    , indices_(_resource)
+{
+    // quantization grid spanning the bounding box
+    vec3 bb_max(std::numeric_limits<double>::lowest());
+    bb_min_ = vec3(std::numeric_limits<double>::max());
+    for (const vec3& p: _positions)
+    {
+        bb_min_ = min(bb_min_, p);
+        bb_max  = max(bb_max, p);
+    }
+    for (int i=0; i<3; ++i)
+    {
+        const double extent = bb_max[i] - bb_min_[i];
+        scale_[i] = (extent > 0) ? extent / 65535.0 : 1.0;
+    }
+
+    std::vector<std::array<uint16_t, 3>> quantized(_positions.size());
+    for (size_t v=0; v<_positions.size(); ++v)
+        for (int i=0; i<3; ++i)
+            quantized[v][i] = uint16_t(std::lround((_positions[v][i] - bb_min_[i]) / scale_[i]));
+
+    // decoded triangle boxes
+    auto decode = [&](const std::array<uint16_t, 3>& _q) {
+        return vec3(bb_min_[0] + _q[0]*scale_[0], bb_min_[1] + _q[1]*scale_[1], bb_min_[2] + _q[2]*scale_[2]);
+    };
+    std::vector<Aabb> boxes(_triangles.size());
+    for (size_t t=0; t<_triangles.size(); ++t)
+        for (int k=0; k<3; ++k)
+            boxes[t].grow(decode(quantized[_triangles[t][k]]));
+
+    // spatially compact clusters with their own hierarchies and local vertex
+    // ranges. The number of duplicated vertices is not known in advance, so
+    // collect them in temporary arrays and copy them into the (monotonic)
+    // resource at the end.
+    TriangleClusters clustered;
+    cluster_triangles(_triangles, boxes, _positions.size(), CLUSTER_SIZE, MAX_CLUSTER_LEAF, clustered);
+
+    const size_t num_clusters = clustered.triangles.size();
+    clusters_.reserve(num_clusters);
+    indices_.reserve(3 * _triangles.size());
+    std::vector<uint16_t> positions;
+    std::vector<uint32_t> normals;
+    std::vector<ClusterNode> cluster_nodes_q;
+
+    for (size_t c=0; c<num_clusters; ++c)
+    {
+        Cluster cluster;
+        cluster.first_vertex  = uint32_t(positions.size() / 3);
+        cluster.first_node    = uint32_t(cluster_nodes_q.size());
+        cluster.num_triangles = uint32_t(clustered.triangles[c].size());
+        std::fill(cluster.bb_min, cluster.bb_min+3, std::numeric_limits<uint16_t>::max());
+        std::fill(cluster.bb_max, cluster.bb_max+3, 0);
+
+        for (int v: clustered.vertices[c])
+        {
+            for (int i=0; i<3; ++i)
+            {
+                positions.push_back(quantized[v][i]);
+                cluster.bb_min[i] = std::min(cluster.bb_min[i], quantized[v][i]);
+                cluster.bb_max[i] = std::max(cluster.bb_max[i], quantized[v][i]);
+            }
+            normals.push_back(encode_normal(_normals[v]));
+        }
+        indices_.insert(indices_.end(), clustered.indices[c].begin(), clustered.indices[c].end());
+
+        // quantized boxes of the triangles, in the leaf order of the cluster's hierarchy
+        std::vector<std::array<uint16_t, 6>> triangle_boxes;
+        for (int t: clustered.triangles[c])
+        {
+            std::array<uint16_t, 6> box;
+            std::fill(box.begin(), box.begin()+3, std::numeric_limits<uint16_t>::max());
+            std::fill(box.begin()+3, box.end(), 0);
+            for (int v: _triangles[t])
+            {
+                for (int i=0; i<3; ++i)
+                {
+                    box[i]   = std::min(box[i],   quantized[v][i]);
+                    box[i+3] = std::max(box[i+3], quantized[v][i]);
+                }
+            }
+            triangle_boxes.push_back(box);
+        }
+
+        // exact node boxes on the quantization grid (children are stored after their parents) ...
+        const std::vector<BvhNode>& tree = clustered.nodes[c];
+        std::vector<std::array<uint16_t, 6>> node_boxes(tree.size());
+        for (size_t n=tree.size(); n-- > 0; )
+        {
+            const bool leaf = tree[n].count > 0;
+            std::array<uint16_t, 6>& box = node_boxes[n];
+            box = leaf ? triangle_boxes[tree[n].first] : node_boxes[tree[n].first];
+            const int last = leaf ? tree[n].first + tree[n].count : tree[n].first + 2;
+            for (int j=tree[n].first+1; j<last; ++j)
+            {
+                const std::array<uint16_t, 6>& b = leaf ? triangle_boxes[j] : node_boxes[j];
+                for (int i=0; i<3; ++i)
+                {
+                    box[i]   = std::min(box[i],   b[i]);
+                    box[i+3] = std::max(box[i+3], b[i+3]);
+                }
+            }
+        }
+
+        // ... rounded outwards to 8 bits relative to the cluster box
+        for (size_t n=0; n<tree.size(); ++n)
+        {
+            ClusterNode node;
+            for (int i=0; i<3; ++i)
+            {
+                const uint32_t extent = cluster.bb_max[i] - cluster.bb_min[i];
+                const uint32_t lo = node_boxes[n][i]   - cluster.bb_min[i];
+                const uint32_t hi = node_boxes[n][i+3] - cluster.bb_min[i];
+                node.bb_min[i] = uint8_t(extent ? lo * 255 / extent : 0);
+                node.bb_max[i] = uint8_t(extent ? (hi * 255 + extent - 1) / extent : 0);
+            }
+            node.first = uint8_t(tree[n].first);
+            node.count = uint8_t(tree[n].count);
+            cluster_nodes_q.push_back(node);
+        }
+
+        clusters_.push_back(cluster);
+    }
+
+    positions_.assign(positions.begin(), positions.end());
+    normals_  .assign(normals.begin(),   normals.end());
+    cluster_nodes_.assign(cluster_nodes_q.begin(), cluster_nodes_q.end());
+
+    // hierarchy over the (decoded) cluster boxes
+    if (clusters_.empty()) return;
+    boxes.assign(clusters_.size(), Aabb());
+    for (size_t c=0; c<clusters_.size(); ++c)
+    {
+        for (int i=0; i<3; ++i)
+        {
+            boxes[c].min[i] = bb_min_[i] + clusters_[c].bb_min[i]*scale_[i];
+            boxes[c].max[i] = bb_min_[i] + clusters_[c].bb_max[i]*scale_[i];
+        }
+    }
+    std::vector<BvhNode> nodes;
+    std::vector<int> order;
+    BvhStats stats;
+    build_bvh(boxes, BvhMethod::SAH, nodes, order, stats);
+    nodes_.assign(nodes.begin(), nodes.end());
+    cluster_order_.assign(order.begin(), order.end());
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+size_t CompressedMesh::memory_bytes() const
+{
+    return sizeof(*this)
+         + clusters_ .size() * sizeof(Cluster)
+         + nodes_    .size() * sizeof(BvhNode)
+         + cluster_order_.size() * sizeof(uint32_t)
+         + cluster_nodes_.size() * sizeof(ClusterNode)
+         + positions_.size() * sizeof(uint16_t)
+         + normals_  .size() * sizeof(uint32_t)
+         + indices_  .size() * sizeof(uint16_t);
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+uint32_t CompressedMesh::encode_normal(const vec3& _n)
+{
+    // project onto the octahedron |x|+|y|+|z| = 1, fold the lower half over
+    const double l1 = std::abs(_n[0]) + std::abs(_n[1]) + std::abs(_n[2]);
+    double u = (l1 > 0) ? _n[0] / l1 : 0;
+    double v = (l1 > 0) ? _n[1] / l1 : 0;
+    if (_n[2] < 0)
+    {
+        const double fu = (1 - std::abs(v)) * (u >= 0 ? 1 : -1);
+        const double fv = (1 - std::abs(u)) * (v >= 0 ? 1 : -1);
+        u = fu;
+        v = fv;
+    }
+
+    auto snorm16 = [](double x) {
+        return uint32_t(uint16_t(int16_t(std::lround(std::clamp(x, -1.0, 1.0) * 32767.0))));
+    };
+    return snorm16(u) | (snorm16(v) << 16);
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+vec3 CompressedMesh::decode_normal(uint32_t _code)
+{
+    double u = int16_t(_code & 0xFFFF) / 32767.0;
+    double v = int16_t(_code >> 16)    / 32767.0;
+    double z = 1 - std::abs(u) - std::abs(v);
+    if (z < 0)
+    {
+        const double fu = (1 - std::abs(v)) * (u >= 0 ? 1 : -1);
+        const double fv = (1 - std::abs(u)) * (v >= 0 ? 1 : -1);
+        u = fu;
+        v = fv;
+    }
+    return normalize(vec3(u, v, z));
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+bool CompressedMesh::intersect(const Ray& _ray, double& _t, uint32_t& _triangle,
+                               double& _beta, double& _gamma) const
+{
+    _t = Object::NO_INTERSECTION;
+    if (nodes_.empty()) return false;
+
+    // clusters front to back, only those whose boxes are closer than the
+    // closest hit (with the slack of traverse_bvh())
+    constexpr double slack = 1 + 1e-9;
+    traverse_bvh(nodes_.data(), _ray, [&]() { return _t; }, [&](int _first, int _count)
+    {
+        for (int k=_first; k<_first+_count; ++k)
+        {
+            const uint32_t c = cluster_order_[k];
+            const Cluster& cluster = clusters_[c];
+            const ClusterNode* tree = &cluster_nodes_[cluster.first_node];
+            const uint32_t first = c * CLUSTER_SIZE;
+
+            // the cluster's own hierarchy, front to back like traverse_bvh()
+            uint8_t stack[128];
+            int top = 0;
+            stack[top++] = 0;
+            while (top > 0)
+            {
+                const ClusterNode& node = tree[stack[--top]];
+                if (!intersect_node(_ray, node_box(cluster, node), _t * slack)) continue;
+
+                if (node.count > 0)
+                {
+                    for (uint32_t t=first+node.first; t<first+node.first+node.count; ++t)
+                    {
+                        const vec3 p0 = position(cluster.first_vertex + indices_[3*t  ]);
+                        const vec3 p1 = position(cluster.first_vertex + indices_[3*t+1]);
+                        const vec3 p2 = position(cluster.first_vertex + indices_[3*t+2]);
+
+                        double tt, beta, gamma;
+                        if (intersect_triangle(_ray, p0, p0-p1, p0-p2, tt, beta, gamma) && tt < _t)
+                        {
+                            _t        = tt;
+                            _triangle = t;
+                            _beta     = beta;
+                            _gamma    = gamma;
+                        }
+                    }
+                }
+                else
+                {
+                    const BvhNode a = node_box(cluster, tree[node.first]);
+                    const BvhNode b = node_box(cluster, tree[node.first + 1]);
+                    const double da = dot(a.bb_min + a.bb_max - 2.0 * _ray.origin, _ray.direction);
+                    const double db = dot(b.bb_min + b.bb_max - 2.0 * _ray.origin, _ray.direction);
+                    if (da <= db) { stack[top++] = uint8_t(node.first + 1); stack[top++] = node.first;                }
+                    else          { stack[top++] = node.first;                stack[top++] = uint8_t(node.first + 1); }
+                }
+            }
+        }
+    });
+
+    return _t != Object::NO_INTERSECTION;
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void CompressedMesh::hit_attributes(const Ray& _ray, double _t, uint32_t _triangle,
+                                    double _beta, double _gamma, bool _phong,
+                                    vec3& _point, vec3& _normal) const
+{
+    const uint32_t base = cluster_of(_triangle).first_vertex;
+    const uint32_t i0 = base + indices_[3*_triangle  ];
+    const uint32_t i1 = base + indices_[3*_triangle+1];
+    const uint32_t i2 = base + indices_[3*_triangle+2];
+    const vec3 p0 = position(i0);
+    const vec3 p1 = position(i1);
+    const vec3 p2 = position(i2);
+
+    _point = _t * _ray.direction + _ray.origin;
+
+    if (!_phong)
+    {
+        _normal = normalize(cross(p1-p0, p2-p0));
+    }
+    else
+    {
+        const double alpha = 1 - _beta - _gamma;
+
+        _normal = normalize(alpha  * decode_normal(normals_[i0])
+                          + _beta  * decode_normal(normals_[i1])
+                          + _gamma * decode_normal(normals_[i2]));
+    }
+}
+
+
+//=============================================================================
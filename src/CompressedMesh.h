@@ -0,0 +1,160 @@
+#pragma once
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+#include "Bvh.h"
+#include "Ray.h"
+#include "vec3.h"
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+
+/// \class CompressedMesh CompressedMesh.h
+/// Memory-saving storage of a triangle mesh for very large models.
+/// Triangles are ordered like the leaves of a hierarchy over all of them and
+/// grouped into clusters of at most `CLUSTER_SIZE` triangles. Every cluster has its own copy of the
+/// vertices it references, so triangles can use 16-bit local indices.
+/// Vertex positions are quantized to 16 bits per coordinate relative to the
+/// mesh bounding box, and vertex normals are stored octahedron-encoded in
+/// 2x16 bits. Face normals are recomputed from the decoded positions.
+/// All data is decoded on the fly during intersection. Rays find the
+/// clusters through a hierarchy over their boxes, and the triangles of a
+/// cluster through a small hierarchy per cluster whose 8-byte nodes store
+/// their boxes in 8 bits per coordinate relative to the cluster box. Both
+/// are traversed front to back and culled by the closest hit so far.
+class CompressedMesh
+{
+public:
+
+    /// maximum number of triangles per cluster
+    static constexpr int CLUSTER_SIZE = 128;
+
+    /// maximum number of triangles per leaf of a cluster's hierarchy
+    static constexpr int MAX_CLUSTER_LEAF = 4;
+
+    /// Compress an indexed face set. \c _triangles holds three vertex indices
+    /// per triangle; \c _normals holds one normal per vertex.
+    CompressedMesh(const std::vector<vec3>& _positions,
+                   const std::vector<vec3>& _normals,
+                   const std::vector<std::array<int, 3>>& _triangles,
+                   std::pmr::memory_resource* _resource = std::pmr::get_default_resource());
+
+    /// Find the closest intersection of \c _ray with the mesh.
+    /// \param[in] _ray the ray to intersect the mesh with
+    /// \param[out] _t ray parameter at the intersection point
+    /// \param[out] _triangle index of the intersected triangle
+    /// \param[out] _beta, _gamma barycentric coordinates of the hit (see intersect_triangle())
+    bool intersect(const Ray& _ray, double& _t, uint32_t& _triangle, double& _beta, double& _gamma) const;
+
+    /// Compute intersection point and normal for a hit returned by intersect().
+    /// \param[in] _phong interpolate vertex normals (true) or use the face normal (false)
+    void hit_attributes(const Ray& _ray, double _t, uint32_t _triangle, double _beta, double _gamma,
+                        bool _phong, vec3& _point, vec3& _normal) const;
+
+    /// number of triangles
+    size_t num_triangles() const { return indices_.size() / 3; }
+
+    /// number of (cluster-local) vertices, including duplicates at cluster borders
+    size_t num_vertices() const { return positions_.size() / 3; }
+
+    /// bytes used by the compressed representation
+    size_t memory_bytes() const;
+
+
+public:
+
+    /// encode a unit vector into 2x16 bits using the octahedral mapping
+    static uint32_t encode_normal(const vec3& _n);
+
+    /// decode a normal produced by encode_normal()
+    static vec3 decode_normal(uint32_t _code);
+
+
+private:
+
+    /// a group of spatially close triangles sharing a local vertex range
+    struct Cluster
+    {
+        /// index of the first vertex of this cluster
+        uint32_t first_vertex;
+        /// index of the root of this cluster's hierarchy in cluster_nodes_
+        uint32_t first_node;
+        /// number of triangles in this cluster
+        uint32_t num_triangles;
+        /// quantized bounding box of the cluster
+        uint16_t bb_min[3], bb_max[3];
+    };
+
+    /// node of the hierarchy over the triangles of a cluster (see BvhNode)
+    struct ClusterNode
+    {
+        /// box in 255ths of the cluster box, rounded outwards
+        uint8_t bb_min[3], bb_max[3];
+        /// leaf: first triangle within the cluster; inner node: first child within the cluster
+        uint8_t first;
+        /// leaf: number of triangles; inner node: 0
+        uint8_t count;
+    };
+
+    /// decode the box of \c _node of \c _cluster's hierarchy
+    BvhNode node_box(const Cluster& _cluster, const ClusterNode& _node) const
+    {
+        // every step rounds monotonically, so the sides never move past the
+        // decoded positions of the vertices inside the node
+        BvhNode box;
+        for (int i=0; i<3; ++i)
+        {
+            const double extent = _cluster.bb_max[i] - _cluster.bb_min[i];
+            box.bb_min[i] = bb_min_[i] + (_cluster.bb_min[i] + _node.bb_min[i] * extent / 255.0) * scale_[i];
+            box.bb_max[i] = bb_min_[i] + (_cluster.bb_min[i] + _node.bb_max[i] * extent / 255.0) * scale_[i];
+        }
+        return box;
+    }
+
+    /// decode quantized position of vertex \c _i
+    vec3 position(uint32_t _i) const
+    {
+        const uint16_t* q = &positions_[3*_i];
+        return vec3(bb_min_[0] + q[0]*scale_[0],
+                    bb_min_[1] + q[1]*scale_[1],
+                    bb_min_[2] + q[2]*scale_[2]);
+    }
+
+    /// cluster that contains triangle \c _triangle
+    const Cluster& cluster_of(uint32_t _triangle) const
+    {
+        return clusters_[_triangle / CLUSTER_SIZE];
+    }
+
+private:
+
+    /// minimum of the bounding box, origin of the quantization grid
+    vec3 bb_min_;
+    /// size of one quantization step per axis
+    vec3 scale_;
+
+    /// clusters; cluster i holds triangles [i*CLUSTER_SIZE, (i+1)*CLUSTER_SIZE)
+    std::pmr::vector<Cluster>  clusters_;
+    /// hierarchy over the cluster boxes; its leaves refer to ranges of cluster_order_
+    std::pmr::vector<BvhNode>  nodes_;
+    std::pmr::vector<uint32_t> cluster_order_;
+    /// the hierarchies of all clusters, one after the other
+    std::pmr::vector<ClusterNode> cluster_nodes_;
+    /// quantized positions, three per vertex
+    std::pmr::vector<uint16_t> positions_;
+    /// octahedron-encoded vertex normals
+    std::pmr::vector<uint32_t> normals_;
+    /// cluster-local vertex indices, three per triangle
+    std::pmr::vector<uint16_t> indices_;
+};
@@ -10,77 +10,93 @@
 //== INCLUDES =================================================================
 #include "Cylinder.h"
 #include "SolveQuadratic.h"
+#include <algorithm>
 #include <array>
 #include <cmath>
     //== IMPLEMENTATION =========================================================
-    bool
-        Cylinder::
-    intersect(const Ray&  _ray,
-              vec3&       _intersection_point,
-              vec3&       _intersection_normal,
-              double&     _intersection_t) const
+void
+Cylinder::
+intersect(const RayBatch& _batch, int _id) const
 {
     /** \todo
-     * - compute the first valid intersection `_ray` with the cylinder
+     * - compute the first valid intersection of each ray with the cylinder
      *   (valid means in front of the viewer: t > 0)
-     * - store intersection point in `_intersection_point`
-     * - store ray parameter in `_intersection_t`
-     * - store normal at *intersection*point in `_intersection_normal`.
-     * - return whether there is an intersection with t > 0
+     * - store its ray parameter if it is closer than the ray's closest hit
     */
-    std::array<double, 2> t;
-    double h;
-    _intersection_t = NO_INTERSECTION;
-    vec3 p;
+    const double cx = center[0], cy = center[1], cz = center[2];
+    const double ax = axis[0], ay = axis[1], az = axis[2];
+    const double half = height/2;
+    const double rr   = radius*radius;
 
-    vec3 m = _ray.origin - center;
-    vec3 d = _ray.direction;
+    const double *ox = _batch.ox, *oy = _batch.oy, *oz = _batch.oz;
+    const double *dx = _batch.dx, *dy = _batch.dy, *dz = _batch.dz;
+    double *tmin   = _batch.t;
+    int    *object = _batch.object;
+    int    *prim   = _batch.prim;
+    const int n    = _batch.size;
 
-    vec3 m_perp = m - dot(m, axis) * axis;
-    vec3 d_perp = d - dot(d, axis) * axis;
+#if HAVE_OPENMP
+#  pragma omp simd
+#endif
+    for (int i = 0; i < n; ++i)
+    {
+        // components of m = origin - center and d perpendicular to the axis
+        const double mx = ox[i] - cx, my = oy[i] - cy, mz = oz[i] - cz;
+        const double ma = mx*ax + my*ay + mz*az;
+        const double da = dx[i]*ax + dy[i]*ay + dz[i]*az;
+        const double mpx = mx - ma*ax, mpy = my - ma*ay, mpz = mz - ma*az;
+        const double dpx = dx[i] - da*ax, dpy = dy[i] - da*ay, dpz = dz[i] - da*az;
 
-    double A = dot(d_perp, d_perp);
-    double B = 2.0 * dot(m_perp, d_perp);
-    double C = dot(m_perp, m_perp) - radius*radius;
+        // solutions that do not exist stay at NO_INTERSECTION
+        double t0 = NO_INTERSECTION, t1 = NO_INTERSECTION;
+        solveQuadratic(dpx*dpx + dpy*dpy + dpz*dpz,
+                       2.0 * (mpx*dpx + mpy*dpy + mpz*dpz),
+                       (mpx*mpx + mpy*mpy + mpz*mpz) - rr,
+                       t0, t1);
 
-    size_t solutions = solveQuadratic(A,B,C,t);
+        // discard intersections behind the viewer or outside the cylinder height
+        const double h0 = (ox[i] + t0*dx[i] - cx)*ax + (oy[i] + t0*dy[i] - cy)*ay + (oz[i] + t0*dz[i] - cz)*az;
+        const double h1 = (ox[i] + t1*dx[i] - cx)*ax + (oy[i] + t1*dy[i] - cy)*ay + (oz[i] + t1*dz[i] - cz)*az;
+        t0 = (t0 > 0) ? t0 : NO_INTERSECTION;
+        t0 = (h0 >= -half) ? t0 : NO_INTERSECTION;
+        t0 = (h0 <=  half) ? t0 : NO_INTERSECTION;
+        t1 = (t1 > 0) ? t1 : NO_INTERSECTION;
+        t1 = (h1 >= -half) ? t1 : NO_INTERSECTION;
+        t1 = (h1 <=  half) ? t1 : NO_INTERSECTION;
 
-    if (solutions == 0) {
-        return false;
-    }
-    if (solutions == 2 && t[0] > t[1]) {
-        std::swap(t[0], t[1]);
+        // the first valid intersection
+        const double t = std::min(t0, t1);
+
+        // replace the closest hit by selections (not branches), so that the loop vectorizes
+        const double t_hit = tmin[i];
+        const int    o_hit = object[i], p_hit = prim[i];
+        const bool   closer = t < t_hit;
+        tmin[i]   = closer ? t   : t_hit;
+        object[i] = closer ? _id : o_hit;
+        prim[i]   = closer ? 0   : p_hit;
     }
+}
 
-    for (size_t i = 0; i < solutions; ++i) {
-        if (t[i] > 0) {
-            p = _ray.origin + t[i] * _ray.direction;
-            h = dot((p - center), axis);
 
-            // is intersection within cylinder height?
-            if (h >= -height/2 && h <= height/2) {
-                _intersection_t = t[i];
-                _intersection_point = p;
+//-----------------------------------------------------------------------------
 
-                // (x - c) - ((x - c) * v)* v
-                vec3 radial = (_intersection_point - center)
-                              - dot((_intersection_point - center), axis) * axis;
 
-                vec3 normal = normalize(radial);
+void
+Cylinder::
+hit_attributes(const Ray& _ray, const HitRecord& _hit, vec3& _point, vec3& _normal) const
+{
+    _point = _ray.origin + _hit.t * _ray.direction;
 
-                // ray is coming from outside -> invert normal
-                // ray is coming from inside -> normal
-                if (dot(_ray.direction, normal) > 0) {
-                    _intersection_normal = -normal;
+    // (x - c) - ((x - c) * v)* v
+    vec3 radial = (_point - center) - dot((_point - center), axis) * axis;
 
-                } else {
-                    _intersection_normal = normal;
-                }
+    vec3 normal = normalize(radial);
 
-                return true;
-            }
-        }
+    // ray is coming from outside -> invert normal
+    // ray is coming from inside -> normal
+    if (dot(_ray.direction, normal) > 0) {
+        _normal = -normal;
+    } else {
+        _normal = normal;
     }
-
-    return false;
 }
@@ -0,0 +1,577 @@
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+//== INCLUDES =================================================================
+
+#include "Distributed.h"
+#include "Scene.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <netdb.h>
+#  include <netinet/in.h>
+#  include <poll.h>
+#  include <signal.h>
+#  include <sys/socket.h>
+#  include <sys/wait.h>
+#  include <unistd.h>
+#endif
+
+
+//== IMPLEMENTATION ===========================================================
+
+#ifndef _WIN32
+
+namespace {
+
+/// message types of the coordinator/worker protocol
+enum MessageType : uint32_t
+{
+    HELLO  = 1, ///< coordinator -> worker: scene path and options
+    READY  = 2, ///< worker -> coordinator: image width and height
+    FAILED = 3, ///< worker -> coordinator: error message
+    TILE   = 4, ///< coordinator -> worker: tile id and rectangle
+    RESULT = 5, ///< worker -> coordinator: tile id and pixel colors
+    BYE    = 6  ///< coordinator -> worker: no more tiles
+};
+
+/// every message starts with its type and payload size
+struct MessageHeader
+{
+    uint32_t type;
+    uint32_t size;
+};
+
+/// longest text a peer may send: scene path and options (HELLO) or an error message (FAILED)
+constexpr size_t MAX_TEXT_SIZE = 1 << 16;
+
+/// largest payload a worker may send: the result of a tile of \c _tile_size, or a text
+size_t max_result_size(unsigned int _tile_size)
+{
+    return std::max(sizeof(uint32_t) + size_t(_tile_size) * _tile_size * sizeof(vec3), MAX_TEXT_SIZE);
+}
+
+bool send_all(int _fd, const void* _data, size_t _size)
+{
+    const char* p = static_cast<const char*>(_data);
+    while (_size > 0)
+    {
+        ssize_t n = ::send(_fd, p, _size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p     += n;
+        _size -= size_t(n);
+    }
+    return true;
+}
+
+bool recv_all(int _fd, void* _data, size_t _size)
+{
+    char* p = static_cast<char*>(_data);
+    while (_size > 0)
+    {
+        ssize_t n = ::recv(_fd, p, _size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p     += n;
+        _size -= size_t(n);
+    }
+    return true;
+}
+
+bool send_message(int _fd, uint32_t _type, const void* _data = nullptr, size_t _size = 0)
+{
+    MessageHeader header{_type, uint32_t(_size)};
+    return send_all(_fd, &header, sizeof(header)) && send_all(_fd, _data, _size);
+}
+
+/// receive a message; fails for payloads larger than \c _max_size, so that
+/// a broken or malicious peer cannot make us allocate arbitrary memory
+bool recv_message(int _fd, uint32_t& _type, std::vector<char>& _data, size_t _max_size)
+{
+    MessageHeader header;
+    if (!recv_all(_fd, &header, sizeof(header)) || header.size > _max_size) return false;
+    _type = header.type;
+    _data.resize(header.size);
+    return recv_all(_fd, _data.data(), _data.size());
+}
+
+} // namespace
+
+
+//-----------------------------------------------------------------------------
+
+
+TileCoordinator::TileCoordinator(const std::string& _program, const RenderSettings& _settings)
+    : program_(_program)
+    , settings_(_settings)
+{
+    // a dying worker must not kill the coordinator
+    signal(SIGPIPE, SIG_IGN);
+
+    for (int i=0; i<settings_.num_workers; ++i)
+        spawn_local_worker(i);
+    for (const std::string& address: settings_.worker_addresses)
+        connect_remote_worker(address);
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+TileCoordinator::~TileCoordinator()
+{
+    for (Worker& w: workers_)
+    {
+        if (w.fd >= 0)
+        {
+            send_message(w.fd, BYE);
+            close(w.fd);
+        }
+        // a local worker still busy with a re-dispatched tile is not waited for
+        if (w.pid > 0 && w.tile >= 0)
+            kill(w.pid, SIGTERM);
+        if (w.pid > 0)
+            waitpid(w.pid, nullptr, 0);
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void TileCoordinator::spawn_local_worker(int _index)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0)
+        throw std::runtime_error("socketpair() failed: " + std::string(strerror(errno)));
+
+    // share the cores between the local workers
+    const unsigned int cores   = std::max(1u, std::thread::hardware_concurrency());
+    const unsigned int threads = std::max(1u, cores / unsigned(settings_.num_workers));
+    const std::string  fd      = std::to_string(fds[1]);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        throw std::runtime_error("fork() failed: " + std::string(strerror(errno)));
+
+    if (pid == 0)
+    {
+        // child: keep our end of the socket open across exec
+        fcntl(fds[1], F_SETFD, 0);
+        // progress output of the workers would garble the coordinator's
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) dup2(devnull, STDOUT_FILENO);
+        setenv("OMP_NUM_THREADS", std::to_string(threads).c_str(), 1);
+        execl(program_.c_str(), program_.c_str(), "--worker-fd", fd.c_str(), static_cast<char*>(nullptr));
+        std::cerr << "ERROR: cannot start worker " << program_ << ": " << strerror(errno) << std::endl;
+        _exit(1);
+    }
+
+    close(fds[1]);
+    Worker w;
+    w.fd   = fds[0];
+    w.pid  = pid;
+    w.name = "local worker " + std::to_string(_index);
+    workers_.push_back(w);
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void TileCoordinator::connect_remote_worker(const std::string& _address)
+{
+    const size_t colon = _address.rfind(':');
+    if (colon == std::string::npos)
+        throw std::runtime_error("Worker address must be HOST:PORT, got " + _address);
+    const std::string host = _address.substr(0, colon);
+    const std::string port = _address.substr(colon + 1);
+
+    addrinfo hints{};
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result  = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0)
+        throw std::runtime_error("Cannot resolve worker address " + _address);
+
+    int fd = -1;
+    for (addrinfo* a = result; a && fd < 0; a = a->ai_next)
+    {
+        fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+        if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+
+    if (fd < 0)
+    {
+        std::cerr << "WARNING: cannot connect to worker " << _address << std::endl;
+        return;
+    }
+
+    Worker w;
+    w.fd   = fd;
+    w.name = "worker " + _address;
+    workers_.push_back(w);
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void TileCoordinator::drop(Worker& _worker, const std::string& _reason)
+{
+    std::cerr << "\nWARNING: " << _worker.name << " " << _reason << ", dropping it." << std::endl;
+    close(_worker.fd);
+    _worker.fd = -1;
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+Image TileCoordinator::render(const std::filesystem::path& _scene)
+{
+    using Clock = std::chrono::steady_clock;
+
+    // send scene and image options, wait until all workers have loaded the scene
+    std::string hello = std::filesystem::absolute(_scene).string();
+    for (const std::string& option: settings_.forwarded)
+        hello += '\0' + option;
+
+    for (Worker& w: workers_)
+        if (!send_message(w.fd, HELLO, hello.data(), hello.size()))
+            drop(w, "is not reachable");
+
+    unsigned int width = 0, height = 0;
+    for (Worker& w: workers_)
+    {
+        if (w.fd < 0) continue;
+
+        uint32_t type;
+        std::vector<char> data;
+        if (!recv_message(w.fd, type, data, MAX_TEXT_SIZE))
+            drop(w, "did not answer");
+        else if (type == FAILED)
+            drop(w, "failed to load the scene (" + std::string(data.begin(), data.end()) + ")");
+        else if (type != READY || data.size() != 2*sizeof(uint32_t))
+            drop(w, "sent an invalid answer");
+        else
+        {
+            uint32_t size[2];
+            std::memcpy(size, data.data(), sizeof(size));
+            if (width == 0) { width = size[0]; height = size[1]; }
+            else if (width != size[0] || height != size[1])
+                drop(w, "loaded a different scene");
+        }
+    }
+    if (width == 0)
+        throw std::runtime_error("No worker could load the scene");
+
+    // distribute tiles
+    const std::vector<Tile> tiles = make_tiles(width, height, settings_.tile_size);
+    std::deque<int>         pending;
+    std::vector<bool>       done(tiles.size(), false);
+    std::vector<Clock::time_point> dispatched(tiles.size());
+    size_t remaining = tiles.size(), redispatched = 0;
+    for (size_t i=0; i<tiles.size(); ++i) pending.push_back(int(i));
+
+    Image img(width, height, settings_.framebuffer);
+    const auto timeout = std::chrono::duration<double>(settings_.tile_timeout);
+
+    std::cout << " " << tiles.size() << " tiles on " << workers_.size() << " workers." << std::flush;
+
+    while (remaining > 0)
+    {
+        // hand out tiles to idle workers. If nothing is pending, speculatively
+        // re-dispatch a tile that takes suspiciously long.
+        for (Worker& w: workers_)
+        {
+            if (w.fd < 0 || w.tile >= 0) continue;
+
+            while (!pending.empty() && done[pending.front()]) pending.pop_front();
+
+            int tile = -1;
+            if (!pending.empty())
+            {
+                tile = pending.front();
+                pending.pop_front();
+            }
+            else
+            {
+                for (const Worker& other: workers_)
+                {
+                    if (other.fd >= 0 && other.tile >= 0 && !done[other.tile] &&
+                        Clock::now() - dispatched[other.tile] > timeout)
+                    {
+                        tile = other.tile;
+                        ++redispatched;
+                        break;
+                    }
+                }
+            }
+            if (tile < 0) continue;
+
+            const Tile& t = tiles[tile];
+            const uint32_t msg[5] = { uint32_t(tile), t.x0, t.y0, t.width, t.height };
+            if (!send_message(w.fd, TILE, msg, sizeof(msg)))
+            {
+                pending.push_front(tile);
+                drop(w, "is not reachable");
+                continue;
+            }
+            w.tile = tile;
+            dispatched[tile] = Clock::now();
+        }
+
+        // wait for results
+        std::vector<pollfd> fds;
+        std::vector<Worker*> polled;
+        for (Worker& w: workers_)
+        {
+            if (w.fd >= 0 && w.tile >= 0)
+            {
+                fds.push_back(pollfd{w.fd, POLLIN, 0});
+                polled.push_back(&w);
+            }
+        }
+        if (fds.empty())
+            throw std::runtime_error("All workers are gone, " + std::to_string(remaining) + " tiles left");
+
+        if (poll(fds.data(), fds.size(), 100) < 0 && errno != EINTR)
+            throw std::runtime_error("poll() failed: " + std::string(strerror(errno)));
+
+        for (size_t i=0; i<fds.size(); ++i)
+        {
+            if (!fds[i].revents) continue;
+            Worker& w = *polled[i];
+
+            uint32_t type;
+            std::vector<char> data;
+            const int tile = w.tile;
+            const size_t expected = sizeof(uint32_t) + tiles[tile].size() * sizeof(vec3);
+            if (!recv_message(w.fd, type, data, max_result_size(settings_.tile_size)) || type != RESULT || data.size() != expected)
+            {
+                // give the tile to somebody else
+                if (!done[tile]) pending.push_front(tile);
+                drop(w, "failed");
+                continue;
+            }
+
+            w.tile = -1;
+            if (done[tile]) continue; // a re-dispatched copy was faster
+
+            const Tile& t = tiles[tile];
+            const vec3* pixels = reinterpret_cast<const vec3*>(data.data() + sizeof(uint32_t));
+            for (unsigned int y=0; y<t.height; ++y)
+                for (unsigned int x=0; x<t.width; ++x)
+                    img.set(t.x0 + x, t.y0 + y, pixels[size_t(y) * t.width + x]);
+
+            done[tile] = true;
+            ++w.num_tiles;
+            --remaining;
+        }
+    }
+
+    std::cout << " Tiles per worker:";
+    for (const Worker& w: workers_) std::cout << " " << w.num_tiles;
+    if (redispatched) std::cout << " (" << redispatched << " re-dispatched)";
+    std::cout << std::flush;
+
+    return img;
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+TileWorker::TileWorker(const RenderSettings& _settings)
+    : settings_(_settings)
+{
+    signal(SIGPIPE, SIG_IGN);
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+TileWorker::~TileWorker() = default;
+
+
+//-----------------------------------------------------------------------------
+
+
+void TileWorker::serve(int _fd)
+{
+    uint32_t type;
+    std::vector<char> data;
+    std::vector<vec3> pixels;
+
+    while (recv_message(_fd, type, data, MAX_TEXT_SIZE))
+    {
+        if (type == HELLO)
+        {
+            // scene path and options, separated by '\0'
+            std::vector<std::string> args(1);
+            for (char c: data)
+            {
+                if (c == '\0') args.emplace_back();
+                else args.back() += c;
+            }
+
+            RenderSettings settings = settings_;
+            for (size_t i=1; i<args.size(); ++i)
+                settings.parse_option(args, i);
+
+            // keep the scene resident if the coordinator asks for the same one again
+            const std::string key(data.begin(), data.end());
+            try
+            {
+                if (!scene_ || key != sceneKey_)
+                {
+                    scene_.reset();
+                    scene_ = std::make_unique<Scene>(args[0], settings);
+                    sceneKey_ = key;
+                }
+            }
+            catch (const std::exception& e)
+            {
+                const std::string msg = e.what();
+                send_message(_fd, FAILED, msg.data(), msg.size());
+                continue;
+            }
+
+            const uint32_t size[2] = { scene_->getCamera().width, scene_->getCamera().height };
+            if (!send_message(_fd, READY, size, sizeof(size))) return;
+        }
+        else if (type == TILE && scene_ && data.size() == 5*sizeof(uint32_t))
+        {
+            uint32_t msg[5];
+            std::memcpy(msg, data.data(), sizeof(msg));
+            Tile tile;
+            tile.x0     = msg[1];
+            tile.y0     = msg[2];
+            tile.width  = msg[3];
+            tile.height = msg[4];
+
+            scene_->renderTile(tile, pixels);
+
+            std::vector<char> result(sizeof(uint32_t) + pixels.size() * sizeof(vec3));
+            std::memcpy(result.data(), &msg[0], sizeof(uint32_t));
+            std::memcpy(result.data() + sizeof(uint32_t), pixels.data(), pixels.size() * sizeof(vec3));
+            if (!send_message(_fd, RESULT, result.data(), result.size())) return;
+        }
+        else
+        {
+            // BYE or protocol error
+            return;
+        }
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void TileWorker::listen(const std::string& _address, int _port)
+{
+    // an empty address makes getaddrinfo() return the loopback addresses
+    std::string host = _address;
+    if (host.size() > 1 && host.front() == '[' && host.back() == ']')
+        host = host.substr(1, host.size() - 2);
+    const std::string name = (host.empty() ? "localhost" : host) + ":" + std::to_string(_port);
+
+    addrinfo hints{};
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result  = nullptr;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), std::to_string(_port).c_str(), &hints, &result) != 0)
+        throw std::runtime_error("Cannot resolve listen address " + name);
+
+    // listen on all addresses, e.g. both ::1 and 127.0.0.1 for the loopback
+    std::vector<pollfd> servers;
+    for (addrinfo* a = result; a; a = a->ai_next)
+    {
+        int server = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+        if (server < 0) continue;
+
+        int yes = 1, no = 0;
+        setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        if (a->ai_family == AF_INET6) // "::" accepts IPv4, too
+            setsockopt(server, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof(no));
+        if (bind(server, a->ai_addr, a->ai_addrlen) != 0 || ::listen(server, 4) != 0)
+            close(server);
+        else
+            servers.push_back(pollfd{server, POLLIN, 0});
+    }
+    freeaddrinfo(result);
+    if (servers.empty())
+        throw std::runtime_error("Cannot listen on " + name + ": " + strerror(errno));
+
+    std::cout << "Worker listening on " << name << std::endl;
+    for (;;)
+    {
+        if (poll(servers.data(), servers.size(), -1) <= 0) continue;
+        for (const pollfd& server: servers)
+        {
+            if (!server.revents) continue;
+            int fd = accept(server.fd, nullptr, nullptr);
+            if (fd < 0) continue;
+            std::cout << "Coordinator connected" << std::endl;
+            serve(fd);
+            close(fd);
+            std::cout << "\nCoordinator disconnected" << std::endl;
+        }
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+
+#else // _WIN32
+
+TileCoordinator::TileCoordinator(const std::string&, const RenderSettings&)
+{
+    throw std::runtime_error("Distributed rendering is not supported on Windows");
+}
+
+TileCoordinator::~TileCoordinator() {}
+
+Image TileCoordinator::render(const std::filesystem::path&) { return Image(); }
+
+void TileCoordinator::spawn_local_worker(int) {}
+void TileCoordinator::connect_remote_worker(const std::string&) {}
+void TileCoordinator::drop(Worker&, const std::string&) {}
+
+TileWorker::TileWorker(const RenderSettings&)
+{
+    throw std::runtime_error("Distributed rendering is not supported on Windows");
+}
+
+TileWorker::~TileWorker() = default;
+
+void TileWorker::serve(int) {}
+void TileWorker::listen(const std::string&, int) {}
+
+#endif
+
+//=============================================================================
@@ -0,0 +1,100 @@
+#pragma once
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+#include "Image.h"
+#include "RenderSettings.h"
+#include "Tile.h"
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Scene;
+
+
+/// \class TileCoordinator Distributed.h
+/// Renders an image by distributing its tiles to worker processes.
+/// Local workers are started as child processes of `raytrace` and talk to the
+/// coordinator over Unix domain sockets; remote workers (`raytrace
+/// --worker-listen [ADDR:]PORT`) are reached over TCP. Every worker loads the scene
+/// itself. Tiles of workers that die are handed to other workers, and tiles
+/// that take longer than RenderSettings::tile_timeout are additionally given
+/// to an idle worker; the first result wins.
+/// Only available on POSIX systems.
+class TileCoordinator
+{
+public:
+
+    /// Prepare distributed rendering with the workers given in \c _settings.
+    /// \c _program is the path of the `raytrace` executable used for local workers.
+    TileCoordinator(const std::string& _program, const RenderSettings& _settings);
+
+    /// Tell all workers to quit and wait for local workers to exit.
+    ~TileCoordinator();
+
+    /// Render the scene \c _scene on the workers and assemble the image.
+    Image render(const std::filesystem::path& _scene);
+
+private:
+
+    /// connection to one worker
+    struct Worker
+    {
+        /// socket descriptor (-1 once the worker is gone)
+        int fd = -1;
+        /// process id of local workers (0 for remote workers)
+        int pid = 0;
+        /// name used in messages
+        std::string name;
+        /// tile the worker is currently rendering (-1 if idle)
+        int tile = -1;
+        /// number of tiles rendered by this worker
+        size_t num_tiles = 0;
+    };
+
+    void spawn_local_worker(int _index);
+    void connect_remote_worker(const std::string& _address);
+    void drop(Worker& _worker, const std::string& _reason);
+
+private:
+
+    std::string              program_;
+    RenderSettings           settings_;
+    std::vector<Worker>      workers_;
+};
+
+
+/// \class TileWorker Distributed.h
+/// The worker side of distributed rendering: loads the scene requested by a
+/// coordinator and renders the tiles it receives.
+class TileWorker
+{
+public:
+
+    /// Construct a worker. Options sent by the coordinator are applied on top
+    /// of \c _settings.
+    explicit TileWorker(const RenderSettings& _settings);
+    ~TileWorker();
+
+    /// Serve one coordinator on the connected socket \c _fd until it disconnects.
+    void serve(int _fd);
+
+    /// Accept coordinators on TCP port \c _port of the local address \c _address
+    /// (empty: loopback only) and serve them one after another.
+    void listen(const std::string& _address, int _port);
+
+private:
+
+    RenderSettings         settings_;
+    std::unique_ptr<Scene> scene_;
+    std::string            sceneKey_;
+};
@@ -0,0 +1,69 @@
+#pragma once
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+#include "Camera.h"
+#include "Tile.h"
+#include "vec3.h"
+
+
+/// \class Frustum Frustum.h
+/// The pyramid from the eye that contains the primary rays of a block of
+/// pixels. Since primary ray directions are affine in the pixel coordinates,
+/// the rays of all pixels of a tile lie between the rays of its corners.
+struct Frustum
+{
+    /// apex (the eye)
+    vec3 apex;
+    /// inward normals of the four side planes and the near plane, all through the apex
+    vec3 normal[5];
+
+    /// Construct the frustum of the primary rays of the pixels of \c _tile
+    Frustum(const Camera& _camera, const Tile& _tile)
+        : apex(_camera.eye)
+    {
+        const unsigned int x1 = _tile.x0 + _tile.width  - 1;
+        const unsigned int y1 = _tile.y0 + _tile.height - 1;
+        const vec3 corner[4] = {
+            _camera.primary_ray(_tile.x0, _tile.y0).direction,
+            _camera.primary_ray(x1,       _tile.y0).direction,
+            _camera.primary_ray(x1,       y1      ).direction,
+            _camera.primary_ray(_tile.x0, y1      ).direction
+        };
+        const vec3 middle = corner[0] + corner[1] + corner[2] + corner[3];
+
+        // (tiles of a single row or column have degenerate planes with zero
+        // normals, which cull nothing)
+        for (int i = 0; i < 4; ++i)
+        {
+            normal[i] = cross(corner[i], corner[(i + 1) % 4]);
+            if (dot(normal[i], middle) < 0) normal[i] = -normal[i];
+        }
+
+        // rays start at the eye: nothing behind it can be hit
+        normal[4] = middle;
+    }
+
+    /// Can a ray inside the frustum hit the box [\c _bb_min, \c _bb_max]?
+    /// Conservative: boxes touching the frustum within rounding errors are kept.
+    bool intersects(const vec3& _bb_min, const vec3& _bb_max) const
+    {
+        for (const vec3& n: normal)
+        {
+            // corner of the box farthest inside the plane
+            const vec3 p(n[0] >= 0 ? _bb_max[0] : _bb_min[0],
+                         n[1] >= 0 ? _bb_max[1] : _bb_min[1],
+                         n[2] >= 0 ? _bb_max[2] : _bb_min[2]);
+            const vec3 d = p - apex;
+            if (dot(n, d) < -1e-9 * norm(d)) return false;
+        }
+        return true;
+    }
+};
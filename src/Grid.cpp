@@ -0,0 +1,122 @@
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+//== INCLUDES =================================================================
+
+#include "Grid.h"
+#include "StopWatch.h"
+
+
+//== IMPLEMENTATION ===========================================================
+
+
+namespace {
+
+/// grids need enough primitives to beat a hierarchy
+constexpr size_t MIN_GRID_PRIMITIVES = 128;
+
+/// largest ratio of the largest box diagonal to the median one that is "similar size"
+constexpr double MAX_SIZE_RATIO = 4.0;
+
+/// upper limit of the cells per axis
+constexpr int MAX_RESOLUTION = 512;
+
+} // namespace
+
+
+//-----------------------------------------------------------------------------
+
+
+bool Grid::suitable(const std::vector<Aabb>& _boxes)
+{
+    if (_boxes.size() < MIN_GRID_PRIMITIVES) return false;
+
+    std::vector<double> diagonals;
+    diagonals.reserve(_boxes.size());
+    for (const Aabb& b: _boxes)
+    {
+        const double d = norm(b.max - b.min);
+        if (!std::isfinite(d)) return false;
+        diagonals.push_back(d);
+    }
+
+    auto median = diagonals.begin() + long(diagonals.size() / 2);
+    std::nth_element(diagonals.begin(), median, diagonals.end());
+    const double largest = *std::max_element(diagonals.begin(), diagonals.end());
+    return largest <= MAX_SIZE_RATIO * *median;
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void Grid::build(const std::vector<Aabb>& _boxes, GridStats& _stats)
+{
+    StopWatch timer;
+    timer.start();
+
+    bounds_ = Aabb();
+    for (const Aabb& b: _boxes) bounds_.grow(b);
+    cell_begin_.clear();
+    items_.clear();
+    std::fill(resolution_, resolution_ + 3, 0);
+    _stats = GridStats();
+    if (_boxes.empty()) return;
+
+    // Cubic cells such that there are about CELLS_PER_PRIMITIVE cells per
+    // primitive. Flat extents are widened, so that the volume is not zero.
+    const vec3   extent  = bounds_.max - bounds_.min;
+    const double longest = std::max({extent[0], extent[1], extent[2], 1e-9});
+    double volume = 1;
+    for (int i = 0; i < 3; ++i) volume *= std::max(extent[i], 1e-3 * longest);
+    const double cells_per_length = std::cbrt(CELLS_PER_PRIMITIVE * double(_boxes.size()) / volume);
+    for (int i = 0; i < 3; ++i)
+    {
+        resolution_[i]     = std::clamp(int(std::lround(extent[i] * cells_per_length)), 1, MAX_RESOLUTION);
+        cell_size_[i]      = std::max(extent[i], 1e-3 * longest) / resolution_[i];
+        inv_cell_size_[i]  = 1.0 / cell_size_[i];
+    }
+    const size_t num_cells = size_t(resolution_[0]) * size_t(resolution_[1]) * size_t(resolution_[2]);
+
+    // range of cells overlapped by each box, then counting sort by cell
+    auto for_cells = [&](const Aabb& _box, auto _f) {
+        int lo[3], hi[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            lo[i] = cell(_box.min[i], i);
+            hi[i] = cell(_box.max[i], i);
+        }
+        for (int z = lo[2]; z <= hi[2]; ++z)
+            for (int y = lo[1]; y <= hi[1]; ++y)
+                for (int x = lo[0]; x <= hi[0]; ++x)
+                    _f((size_t(z) * size_t(resolution_[1]) + size_t(y)) * size_t(resolution_[0]) + size_t(x));
+    };
+
+    cell_begin_.assign(num_cells + 1, 0);
+    for (const Aabb& b: _boxes)
+        for_cells(b, [&](size_t _c) { ++cell_begin_[_c + 1]; });
+    for (size_t c = 0; c < num_cells; ++c)
+        cell_begin_[c + 1] += cell_begin_[c];
+
+    // primitives are listed in ascending order in each cell
+    items_.resize(size_t(cell_begin_[num_cells]));
+    std::vector<int> fill(cell_begin_.begin(), cell_begin_.end() - 1);
+    for (size_t j = 0; j < _boxes.size(); ++j)
+        for_cells(_boxes[j], [&](size_t _c) { items_[size_t(fill[_c]++)] = int(j); });
+
+    for (int i = 0; i < 3; ++i) _stats.resolution[i] = resolution_[i];
+    _stats.cells      = num_cells;
+    _stats.primitives = _boxes.size();
+    _stats.references = items_.size();
+    for (size_t c = 0; c < num_cells; ++c)
+        _stats.empty += cell_begin_[c] == cell_begin_[c + 1];
+    _stats.bytes      = (cell_begin_.size() + items_.size()) * sizeof(int);
+    _stats.build_ms   = timer.stop();
+}
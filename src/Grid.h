@@ -0,0 +1,211 @@
+#pragma once
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+#include "Bvh.h"
+#include "Ray.h"
+#include "vec3.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+
+/// \file Grid.h Uniform grids over arbitrary primitives, an alternative to
+/// the object hierarchy of CompiledScene for many primitives of similar size.
+
+
+/// Acceleration structure over the objects of a scene
+enum class Accelerator
+{
+    /// bounding volume hierarchy (see Bvh.h)
+    BVH,
+    /// uniform grid (see Grid)
+    GRID,
+    /// a grid if the primitives have similar sizes (see Grid::suitable()), otherwise a BVH
+    AUTO
+};
+
+/// read an accelerator name: "bvh", "grid" or "auto"
+inline std::istream& operator>>(std::istream& _is, Accelerator& _accelerator)
+{
+    std::string name;
+    _is >> name;
+    if      (name == "bvh")  _accelerator = Accelerator::BVH;
+    else if (name == "grid") _accelerator = Accelerator::GRID;
+    else if (name == "auto") _accelerator = Accelerator::AUTO;
+    else _is.setstate(std::ios::failbit);
+    return _is;
+}
+
+
+/// \class GridStats Grid.h
+/// Build time, memory and occupancy of a grid
+struct GridStats
+{
+    /// cells per axis
+    int resolution[3] = {0, 0, 0};
+    /// number of cells, and of those without primitives
+    size_t cells = 0, empty = 0;
+    /// number of primitives, and of their references from cells
+    size_t primitives = 0, references = 0;
+    /// memory of the cell table and the references in bytes
+    size_t bytes = 0;
+    /// build time in milliseconds
+    double build_ms = 0;
+};
+
+/// print statistics
+inline std::ostream& operator<<(std::ostream& _os, const GridStats& _s)
+{
+    _os << _s.resolution[0] << "x" << _s.resolution[1] << "x" << _s.resolution[2] << " cells ("
+        << (_s.cells ? 100.0 * double(_s.empty) / double(_s.cells) : 0.0) << "% empty), "
+        << _s.primitives << " primitives, "
+        << (_s.primitives ? double(_s.references) / double(_s.primitives) : 0.0) << " references each, "
+        << double(_s.bytes) / 1024.0 << " KB, built in " << _s.build_ms << " ms";
+    return _os;
+}
+
+
+/// \class Grid Grid.h
+/// Uniform grid over primitives given by their bounding boxes. Each cell
+/// lists the primitives whose boxes overlap it; rays walk through the cells
+/// in order with a 3D-DDA (Amanatides and Woo, A Fast Voxel Traversal
+/// Algorithm for Ray Tracing, 1987). Compared to a hierarchy, it is built in
+/// linear time and traversed without a stack, but only pays off if the
+/// primitives have similar sizes and fill the scene's box evenly.
+class Grid
+{
+public:
+
+    /// Construct an empty grid whose arrays are allocated from \c _resource
+    explicit Grid(std::pmr::memory_resource* _resource = std::pmr::get_default_resource())
+        : cell_begin_(_resource), items_(_resource) {}
+
+    /// Build the grid over the primitives with bounding boxes \c _boxes,
+    /// about CELLS_PER_PRIMITIVE cells per primitive, roughly cubic.
+    void build(const std::vector<Aabb>& _boxes, GridStats& _stats);
+
+    /// Does the grid contain no primitives?
+    bool empty() const { return items_.empty(); }
+
+    /// Are the primitives with boxes \c _boxes worth a grid, i.e. many and of similar size?
+    static bool suitable(const std::vector<Aabb>& _boxes);
+
+    /// Visit the primitives in the cells that \c _ray passes, front to back, until a hit
+    /// closer than \c _t_max() lies in the cells visited so far. \c _visit(j)
+    /// is called at most once per primitive \c j that spans several cells,
+    /// except for rare collisions in the mailbox.
+    template <class TMax, class Visit>
+    void traverse(const Ray& _ray, TMax _t_max, Visit _visit) const;
+
+    /// average number of cells per primitive
+    static constexpr double CELLS_PER_PRIMITIVE = 4.0;
+
+private:
+
+    /// cell index of \c _p along axis \c _axis, clamped to the grid
+    int cell(double _p, int _axis) const
+    {
+        const double c = (_p - bounds_.min[_axis]) * inv_cell_size_[_axis];
+        return int(std::min(std::max(c, 0.0), double(resolution_[_axis] - 1)));
+    }
+
+    /// number of slots of the mailbox of a traversal (a power of two)
+    static constexpr int MAILBOX_SIZE = 64;
+
+    /// bounds of all primitives, size of the cells and their number per axis
+    Aabb bounds_;
+    vec3 cell_size_, inv_cell_size_;
+    int  resolution_[3] = {0, 0, 0};
+
+    /// primitives of cell c (x fastest) are items_[cell_begin_[c] .. cell_begin_[c+1])
+    std::pmr::vector<int> cell_begin_;
+    std::pmr::vector<int> items_;
+};
+
+
+//-----------------------------------------------------------------------------
+
+
+template <class TMax, class Visit>
+void Grid::traverse(const Ray& _ray, TMax _t_max, Visit _visit) const
+{
+    if (items_.empty()) return;
+
+    // clip the ray to the grid like intersect_node()
+    constexpr double gamma3 = 3 * std::numeric_limits<double>::epsilon() / (1 - 3 * std::numeric_limits<double>::epsilon());
+    const vec3* sides[2] = { &bounds_.min, &bounds_.max };
+    double t0 = 0, t1 = _t_max();
+    for (int i = 0; i < 3; ++i)
+    {
+        const double t_near = ((*sides[    _ray.sign[i]])[i] - _ray.origin[i]) * _ray.inv_direction[i];
+        const double t_far  = ((*sides[1 - _ray.sign[i]])[i] - _ray.origin[i]) * _ray.inv_direction[i] * (1 + 2 * gamma3);
+        t0 = t_near > t0 ? t_near : t0;
+        t1 = t_far  < t1 ? t_far  : t1;
+        if (t0 > t1) return;
+    }
+
+    // start in the cell of the entry point; per axis, the direction of the
+    // next cell, the index past the last cell, and the distance to its boundary
+    int    c[3], step[3], stop[3];
+    double t_next[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        c[i] = cell(_ray.origin[i] + t0 * _ray.direction[i], i);
+        if (_ray.direction[i] > 0)      { step[i] =  1; stop[i] = resolution_[i]; }
+        else if (_ray.direction[i] < 0) { step[i] = -1; stop[i] = -1; }
+        else                            { step[i] =  0; stop[i] = -1; }
+    }
+    auto boundary = [&](int _i) {
+        if (!step[_i]) return std::numeric_limits<double>::infinity();
+        // (computed from the cell index rather than accumulated, so that errors do not add up)
+        const double x = bounds_.min[_i] + double(c[_i] + (step[_i] > 0)) * cell_size_[_i];
+        return (x - _ray.origin[_i]) * _ray.inv_direction[_i];
+    };
+    for (int i = 0; i < 3; ++i) t_next[i] = boundary(i);
+
+    // Primitives spanning several cells are only tested in the first one:
+    // the mailbox remembers recently tested primitives (direct mapped).
+    int mailbox[MAILBOX_SIZE];
+    std::fill(mailbox, mailbox + MAILBOX_SIZE, -1);
+
+    // Hits exactly at the current closest distance are decided by primitive
+    // order, so the walk only stops if the hit is clearly inside the cells
+    // visited so far (all of which contain the ray up to the exit distance).
+    constexpr double slack = 1 + 1e-9;
+
+    for (;;)
+    {
+        const size_t index = (size_t(c[2]) * size_t(resolution_[1]) + size_t(c[1])) * size_t(resolution_[0]) + size_t(c[0]);
+        for (int k = cell_begin_[index], end = cell_begin_[index + 1]; k < end; ++k)
+        {
+            const int j = items_[k];
+            int& slot = mailbox[j & (MAILBOX_SIZE - 1)];
+            if (slot == j) continue;
+            slot = j;
+            _visit(j);
+        }
+
+        // leave the cell through its closest boundary
+        const int axis = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2)
+                                               : (t_next[1] < t_next[2] ? 1 : 2);
+        const double t_exit = t_next[axis];
+        if (t_exit > t1 || _t_max() * slack < t_exit) break;
+
+        c[axis] += step[axis];
+        if (c[axis] == stop[axis]) break;
+        t_next[axis] = boundary(axis);
+    }
+}
@@ -27,11 +27,15 @@ bool Image::write_tga(const std::filesystem::path &_filename)
     file.put(24); //bits per pixel
     file.put(0); //image descriptor
 
-    for (vec3 color: pixels_)
+    for (unsigned int y = 0; y < height_; ++y)
     {
-        file.put(static_cast<unsigned char>(255.0 * color[2]));
-        file.put(static_cast<unsigned char>(255.0 * color[1]));
-        file.put(static_cast<unsigned char>(255.0 * color[0]));
+        for (unsigned int x = 0; x < width_; ++x)
+        {
+            const vec3 color = (*this)(x, y);
+            file.put(static_cast<unsigned char>(255.0 * color[2]));
+            file.put(static_cast<unsigned char>(255.0 * color[1]));
+            file.put(static_cast<unsigned char>(255.0 * color[0]));
+        }
     }
 
     file.close();
@@ -44,7 +48,22 @@ bool Image::write_bmp(const std::filesystem::path& _filename)
         std::cerr << "ERROR: Failed to open " << _filename.string() << " for writing." << std::endl;
         return false;
     }
+    const bool written = write_bmp(file);
+    file.close();
+    if (!written || !file) {
+        std::cerr << "ERROR: Failed to write " << _filename.string() << "." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Image::write_bmp(std::ostream& file) const
+{
+    return write_bmp_header(file, width_, height_) && write_bmp_rows(file);
+}
 
+bool Image::write_bmp_header(std::ostream& file, unsigned int _width, unsigned int _height)
+{
     // Helper lambdas for little-endian writing
     auto write16le = [&file](uint16_t v) {
         file.put(static_cast<char>(v & 0xFF));
@@ -58,36 +77,44 @@ bool Image::write_bmp(const std::filesystem::path& _filename)
     };
 
     // BMP file header (14 bytes)
-    unsigned int row_stride = width_ * 3;
-    unsigned int padding = (4 - (row_stride % 4)) % 4;
-    unsigned int row_size_padded = row_stride + padding;
-    unsigned int pixel_data_size = row_size_padded * height_;
-    unsigned int file_size = 14 + 40 + pixel_data_size;
+    uint64_t row_stride = uint64_t(_width) * 3;
+    uint64_t padding = (4 - (row_stride % 4)) % 4;
+    uint64_t row_size_padded = row_stride + padding;
+    uint64_t pixel_data_size = row_size_padded * _height;
+    uint64_t file_size = 14 + 40 + pixel_data_size;
+
+    // the size fields have 32 bits, 0 is allowed for uncompressed images
+    if (file_size > UINT32_MAX) pixel_data_size = file_size = 0;
 
     // BITMAPFILEHEADER
     file.put('B');
     file.put('M');
-    write32le(file_size); // file size
+    write32le(uint32_t(file_size)); // file size
     write32le(0); // reserved
     write32le(14 + 40); // offset to pixel data
 
     // BITMAPINFOHEADER (40 bytes)
     write32le(40); // header size
-    write32le(static_cast<unsigned int>(width_)); // width
-    write32le(static_cast<unsigned int>(height_)); // height
+    write32le(static_cast<unsigned int>(_width)); // width
+    write32le(static_cast<unsigned int>(_height)); // height
     write16le(1); // planes
     write16le(24); // bits per pixel
     write32le(0); // compression
-    write32le(pixel_data_size); // image size
+    write32le(uint32_t(pixel_data_size)); // image size
     write32le(2835); // x pixels per meter
     write32le(2835); // y pixels per meter
     write32le(0); // colors used
     write32le(0); // important colors
 
-    /// map double in range [0..1] to byte in range [0..255]
-    auto double_to_byte = [](double v){
-        return static_cast<unsigned char>(255.0 * std::clamp(v, 0.0, 1.0));
-    };
+    return bool(file);
+}
+
+bool Image::write_bmp_rows(std::ostream& file) const
+{
+    size_t row_stride = size_t(width_) * 3;
+    size_t padding = (4 - (row_stride % 4)) % 4;
+    size_t row_size_padded = row_stride + padding;
+
     // Write pixel data (bottom-up, BGR, padded)
     std::vector<unsigned char> row(row_size_padded);
     // BMPs are written bottom-row first, but that's exactly how
@@ -95,15 +122,14 @@ bool Image::write_bmp(const std::filesystem::path& _filename)
     // so we can iterate starting at y=0 (bottom).
     for (unsigned int y = 0; y < height_; ++y) {
         for (unsigned int x = 0; x < width_; ++x) {
-            const vec3& color = (*this)(x, y);
-            row[x * 3 + 0] = double_to_byte(color[2]); // Blue
-            row[x * 3 + 1] = double_to_byte(color[1]); // Green
-            row[x * 3 + 2] = double_to_byte(color[0]); // Red
+            const vec3 color = (*this)(x, y);
+            row[size_t(x) * 3 + 0] = to_byte(color[2]); // Blue
+            row[size_t(x) * 3 + 1] = to_byte(color[1]); // Green
+            row[size_t(x) * 3 + 2] = to_byte(color[0]); // Red
         }
         // Zero padding
-        for (unsigned int p = 0; p < padding; ++p) row[row_stride + p] = 0;
-        file.write(reinterpret_cast<const char*>(row.data()), row_size_padded);
+        for (size_t p = 0; p < padding; ++p) row[row_stride + p] = 0;
+        file.write(reinterpret_cast<const char*>(row.data()), std::streamsize(row_size_padded));
     }
-    file.close();
-    return true;
+    return bool(file);
 }
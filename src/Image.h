@@ -12,23 +12,46 @@
 
 #include "vec3.h"
 #include <vector>
+#include <algorithm>
 #include <assert.h>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <filesystem>
 
 
+/// Storage precision of the pixels of an Image
+enum class PixelFormat
+{
+    /// three doubles (24 bytes per pixel)
+    Double,
+    /// three floats (12 bytes per pixel)
+    Float,
+    /// three IEEE half floats (6 bytes per pixel)
+    Half
+};
+
 
 /// \class Image Image.h
 /// This class stores an image as a big array of colors, which are represented
-/// as vec3 values for RGB.
+/// as vec3 values for RGB. The pixels are stored in square tiles of
+/// TILE_SIZE x TILE_SIZE pixels (block-linear), each aligned to cache lines,
+/// so that threads rendering different tiles never write to the same cache
+/// line. The colors are kept in double, float or half precision; they are
+/// converted to row-major order when the image is written.
 class Image
 {
 public:
 
+    /// edge length of the tiles in pixels
+    static constexpr unsigned int TILE_SIZE = 8;
+
     /// Construct an image of size _width times _height
     /// \param _width Width of the image in pixels
     /// \param _height Height of the image in pixels
-    Image(unsigned int _width=0, unsigned int _height=0)
+    /// \param _format precision of the stored colors
+    Image(unsigned int _width=0, unsigned int _height=0, PixelFormat _format=PixelFormat::Float)
+    : format_(_format)
     {
         resize(_width, _height);
     }
@@ -38,9 +61,17 @@ public:
     /// \param _height New height of the image in pixels
     void resize(unsigned int _width, unsigned int _height)
     {
-        width_  = _width;
-        height_ = _height;
-        pixels_.resize(width_ * height_);
+        width_   = _width;
+        height_  = _height;
+        columns_ = (width_ + TILE_SIZE - 1) / TILE_SIZE;
+        const size_t tiles = size_t(columns_) * ((height_ + TILE_SIZE - 1) / TILE_SIZE);
+        double_.clear(); float_.clear(); half_.clear();
+        switch (format_)
+        {
+            case PixelFormat::Double: double_.resize(tiles); break;
+            case PixelFormat::Float:  float_.resize(tiles);  break;
+            case PixelFormat::Half:   half_.resize(tiles);   break;
+        }
     }
 
     /// Returns image width in pixels.
@@ -55,21 +86,49 @@ public:
         return height_;
     }
 
-    /// Read/write access to pixel (_x,_y). Use this to set the color by
-    /// image(x,y) = color;
-    vec3& operator()(unsigned int _x, unsigned int _y)
+    /// Returns the precision of the stored colors.
+    PixelFormat format() const
+    {
+        return format_;
+    }
+
+    /// Returns the memory used by the pixels in bytes.
+    size_t bytes() const
+    {
+        return double_.size() * sizeof(Block<double>) + float_.size() * sizeof(Block<float>)
+             + half_.size() * sizeof(Block<uint16_t>);
+    }
+
+    /// Read access to pixel (_x,_y).
+    vec3 operator()(unsigned int _x, unsigned int _y) const
     {
         assert(_x < width_);
         assert(_y < height_);
-        return pixels_[_y*static_cast<unsigned int>(width_) + _x];
+        size_t i;
+        const size_t t = block(_x, _y, i);
+        switch (format_)
+        {
+            case PixelFormat::Double: { const double*   c = double_[t].c + i; return vec3(c[0], c[1], c[2]); }
+            case PixelFormat::Float:  { const float*    c = float_[t].c + i;  return vec3(c[0], c[1], c[2]); }
+            case PixelFormat::Half:   { const uint16_t* c = half_[t].c + i;
+                                        return vec3(from_half(c[0]), from_half(c[1]), from_half(c[2])); }
+        }
+        return vec3(0, 0, 0);
     }
 
-    /// Read access to pixel (_x,_y).
-    const vec3& operator()(unsigned int _x, unsigned int _y) const
+    /// Set the color of pixel (_x,_y), rounded to the precision of the image.
+    void set(unsigned int _x, unsigned int _y, const vec3& _color)
     {
         assert(_x < width_);
         assert(_y < height_);
-        return pixels_[_y*static_cast<unsigned int>(width_) + _x];
+        size_t i;
+        const size_t t = block(_x, _y, i);
+        switch (format_)
+        {
+            case PixelFormat::Double: { double*   c = double_[t].c + i; for (int k = 0; k < 3; ++k) c[k] = _color[k];                  break; }
+            case PixelFormat::Float:  { float*    c = float_[t].c + i;  for (int k = 0; k < 3; ++k) c[k] = float(_color[k]);           break; }
+            case PixelFormat::Half:   { uint16_t* c = half_[t].c + i;   for (int k = 0; k < 3; ++k) c[k] = to_half(float(_color[k])); break; }
+        }
     }
 
     /// Writes the image in TGA format to a file.
@@ -77,18 +136,106 @@ public:
     bool write_tga(const std::filesystem::path& _filename);
     /// Writes the image in BMP format to a file.
     /// \param[in] _filename Filename to save the image to.
+    /// \return false if the file could not be opened or written completely.
     bool write_bmp(const std::filesystem::path& _filename);
+    /// Writes the image in BMP format to a stream.
+    /// \param[in] file Binary output stream.
+    bool write_bmp(std::ostream& file) const;
+
+    /// Writes the header of a BMP file of _width x _height pixels, whose
+    /// rows can then be appended by write_bmp_rows(). Files beyond 4 GB
+    /// store 0 as their size, readers compute it from the dimensions.
+    static bool write_bmp_header(std::ostream& _file, unsigned int _width, unsigned int _height);
+    /// Appends the rows of the image to a BMP file, bottom row first.
+    bool write_bmp_rows(std::ostream& _file) const;
+    /// Map a color channel in [0, 1] (clamped) to the byte stored in BMP
+    /// files; all images of 8-bit pixels use it to match write_bmp().
+    static unsigned char to_byte(double _v)
+    {
+        return static_cast<unsigned char>(255.0 * std::clamp(_v, 0.0, 1.0));
+    }
+
+    /// Round \c _f to the nearest IEEE half float (ties to even).
+    static uint16_t to_half(float _f)
+    {
+        uint32_t f;
+        std::memcpy(&f, &_f, sizeof(f));
+        const uint16_t sign = uint16_t((f >> 16) & 0x8000);
+        f &= 0x7fffffff;
+
+        // infinity and NaN, and values that round to infinity
+        if (f >= 0x7f800000) return sign | (f > 0x7f800000 ? 0x7e00 : 0x7c00);
+        if (f >= 0x477ff000) return sign | 0x7c00;
+
+        // subnormal halfs (and zero): units of 2^-24
+        if (f < 0x38800000)
+        {
+            if (f < 0x33000000) return sign;
+            const uint32_t m     = (f & 0x7fffff) | 0x800000;
+            const uint32_t shift = 126 - (f >> 23);
+            const uint32_t rest  = m & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+            uint32_t h = m >> shift;
+            if (rest > halfway || (rest == halfway && (h & 1))) ++h;
+            return uint16_t(sign | h);
+        }
+
+        // normal halfs: rebias the exponent, round the mantissa (a carry
+        // correctly increments the exponent)
+        uint32_t h = (f - 0x38000000) >> 13;
+        const uint32_t rest = f & 0x1fff;
+        if (rest > 0x1000 || (rest == 0x1000 && (h & 1))) ++h;
+        return uint16_t(sign | h);
+    }
+
+    /// Convert the IEEE half float \c _h to float (exact).
+    static float from_half(uint16_t _h)
+    {
+        const uint32_t sign = uint32_t(_h & 0x8000) << 16;
+        const uint32_t e = (_h >> 10) & 0x1f, m = _h & 0x3ff;
+        uint32_t f;
+        if (e == 0)
+        {
+            const float r = float(m) * (1.0f / 16777216.0f);
+            return sign ? -r : r;
+        }
+        else if (e == 31) f = sign | 0x7f800000 | (m << 13);
+        else              f = sign | ((e + 112) << 23) | (m << 13);
+        float r;
+        std::memcpy(&r, &f, sizeof(r));
+        return r;
+    }
 
 
 private:
 
-    /// vector with all pixels in the image
-    std::vector<vec3> pixels_;
+    /// the pixels of a tile, row by row; aligned to and filling whole cache lines.
+    /// Left uninitialized, so that the memory is first touched (and placed on
+    /// its NUMA node) by the thread that renders the tile.
+    template <class T> struct alignas(64) Block
+    {
+        Block() {}
+        T c[TILE_SIZE * TILE_SIZE * 3];
+    };
+
+    /// index of the block containing pixel (_x,_y), and of its first color component in the block
+    size_t block(unsigned int _x, unsigned int _y, size_t& _i) const
+    {
+        _i = 3 * (size_t(_y % TILE_SIZE) * TILE_SIZE + _x % TILE_SIZE);
+        return size_t(_y / TILE_SIZE) * columns_ + _x / TILE_SIZE;
+    }
+
+    /// precision of the pixels, only the blocks of this format are used
+    PixelFormat format_;
+    std::vector<Block<double>>   double_;
+    std::vector<Block<float>>    float_;
+    std::vector<Block<uint16_t>> half_;
 
     /// image width in pixels
     unsigned int width_;
 
     /// image height in pixels
     unsigned int height_;
-};
 
+    /// number of tiles per row
+    unsigned int columns_;
+};
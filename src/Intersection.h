@@ -0,0 +1,81 @@
+#pragma once
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+#include "Ray.h"
+#include "vec3.h"
+
+#include <cmath>
+#include <limits>
+#include <utility>
+
+/// \file Intersection.h Ray/triangle and ray/box tests shared by the
+/// different mesh representations. They evaluate exactly the same
+/// arithmetic as Mesh::intersect_triangle() and Mesh::intersect_bounding_box(),
+/// so all representations produce identical images.
+
+
+/// Determinant of the 3x3 matrix with columns \c v1, \c v2, \c v3
+/// (same evaluation order as Mesh::determinant()).
+inline double det3(const vec3& v1, const vec3& v2, const vec3& v3)
+{
+    double sum1 = v1[0]*v2[1]*v3[2] + v2[0]*v3[1]*v1[2] + v3[0]*v1[1]*v2[2];
+    double sum2 = v3[0]*v2[1]*v1[2] + v2[0]*v1[1]*v3[2] + v1[0]*v3[1]*v2[2];
+    return sum1 - sum2;
+}
+
+
+/// Intersect \c _ray with the triangle (p0, p0-e1, p0-e2) using Cramer's rule.
+/// \param[in] _p0 first vertex
+/// \param[in] _e1 edge p0-p1
+/// \param[in] _e2 edge p0-p2
+/// \param[out] _t ray parameter at the intersection point
+/// \param[out] _beta, _gamma barycentric coordinates of p1 and p2
+inline bool intersect_triangle(const Ray& _ray, const vec3& _p0, const vec3& _e1, const vec3& _e2,
+                               double& _t, double& _beta, double& _gamma)
+{
+    const vec3& d = _ray.direction;
+    const vec3  c = _p0 - _ray.origin;
+
+    const double detA = det3(d, _e1, _e2);
+    _t     = det3(c, _e1, _e2) / detA;
+    _beta  = det3(d, c,   _e2) / detA;
+    _gamma = det3(d, _e1, c  ) / detA;
+
+    return !(_t <= 0 || _beta < 0 || _gamma < 0 || _beta + _gamma > 1);
+}
+
+
+/// Slab test of \c _ray against the axis-aligned box [bb_min, bb_max].
+inline bool intersect_box(const Ray& _ray, const vec3& _bb_min, const vec3& _bb_max)
+{
+    double t_min = -std::numeric_limits<double>::infinity();
+    double t_max =  std::numeric_limits<double>::infinity();
+
+    for (int i = 0; i < 3; ++i)
+    {
+        // ray parallel to slab
+        if (std::abs(_ray.direction[i]) < 1e-6)
+        {
+            if (_ray.origin[i] < _bb_min[i] || _ray.origin[i] > _bb_max[i]) return false;
+        }
+
+        // entry and exit distance: the sign of the direction tells which side is hit first
+        const double t1 = ((_ray.sign[i] ? _bb_max : _bb_min)[i] - _ray.origin[i]) * _ray.inv_direction[i];
+        const double t2 = ((_ray.sign[i] ? _bb_min : _bb_max)[i] - _ray.origin[i]) * _ray.inv_direction[i];
+
+        t_min = std::max(t1, t_min);
+        t_max = std::min(t2, t_max);
+
+        if (t_min > t_max) return false;
+        if (t_max < 0)     return false;
+    }
+    return true;
+}
@@ -35,6 +35,54 @@ struct Material
 //-----------------------------------------------------------------------------
 
 
+/// \class MaterialClass Material.h
+/// The terms of the shading that a material needs, and constants derived
+/// from its parameters. Materials are classified once when they are compiled
+/// (see CompiledScene::add_material()), so that each hit is shaded by a
+/// kernel specialized for its class (see Scene::shade()).
+struct MaterialClass
+{
+    /// specular highlights (specular color not black)
+    bool specular = false;
+
+    /// reflection (mirror > 0)
+    bool mirror = false;
+
+    /// weight of the local color next to the reflected one (1 - mirror)
+    double local = 1;
+
+    MaterialClass() = default;
+
+    /// classify material \c _m
+    explicit MaterialClass(const Material& _m)
+        : specular(_m.specular[0] != 0 || _m.specular[1] != 0 || _m.specular[2] != 0),
+          mirror(_m.mirror > 0),
+          local(1 - _m.mirror)
+    {}
+};
+
+
+//-----------------------------------------------------------------------------
+
+
+/// compare all material parameters
+inline bool operator==(const Material& a, const Material& b)
+{
+    for (int i=0; i<3; ++i)
+        if (a.ambient[i] != b.ambient[i] || a.diffuse[i] != b.diffuse[i] || a.specular[i] != b.specular[i])
+            return false;
+    return a.shininess == b.shininess && a.mirror == b.mirror;
+}
+
+inline bool operator!=(const Material& a, const Material& b)
+{
+    return !(a == b);
+}
+
+
+//-----------------------------------------------------------------------------
+
+
 /// read material from stream
 inline std::istream& operator>>(std::istream& is, Material& m)
 {
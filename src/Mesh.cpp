@@ -18,20 +18,41 @@
 #include <cmath>
 #include <filesystem>
 #include <array>
+#include <numeric>
+#include <algorithm>
+#include "StopWatch.h"
 #include "vec3.h"
 
+#if HAVE_OPENMP
+#  include <omp.h>
+#endif
+
 
 //== IMPLEMENTATION ===========================================================
 
 
-Mesh::Mesh(std::istream &is, const std::filesystem::path &_scene_path)
+Mesh::Mesh(std::istream &is, const std::filesystem::path &_scene_path,
+           std::pmr::memory_resource *_resource, Storage _storage, PageCache *_cache,
+           std::ostream &_log)
+    // uncompressed arrays of a compressed or paged mesh are only temporary,
+    // so don't let them occupy (monotonic) arena memory
+    : vertices_ (_storage != RESIDENT ? std::pmr::new_delete_resource() : _resource)
+    , triangles_(_storage != RESIDENT ? std::pmr::new_delete_resource() : _resource)
 {
     std::string meshFilename, mode;
     is >> meshFilename;
     auto offFilename = _scene_path.parent_path() / meshFilename;
 
     // load mesh from file
-    read(offFilename);
+    if (_storage == PAGED)
+    {
+        if (!_cache) throw std::logic_error("Paged mesh requires a page cache");
+        load_paged(offFilename, *_cache, _resource, _log);
+    }
+    else
+    {
+        read(offFilename, _log);
+    }
 
     is >> mode;
     if      (mode ==  "FLAT") draw_mode_ = FLAT;
@@ -39,13 +60,125 @@ Mesh::Mesh(std::istream &is, const std::filesystem::path &_scene_path)
     else throw std::runtime_error("Invalid draw mode " + mode);
 
     is >> material;
+
+    if (_storage == COMPRESSED)
+    {
+        const size_t uncompressed = memory_bytes();
+        compress(_resource);
+        _log << ", compressed to " << double(memory_bytes()) / num_triangles()
+                  << " bytes/triangle (was " << double(uncompressed) / num_triangles() << ")";
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void Mesh::export_geometry(std::vector<vec3> &_positions, std::vector<vec3> &_normals,
+                           std::vector<std::array<int, 3>> &_triangles) const
+{
+    _positions.clear();
+    _normals.clear();
+    _positions.reserve(vertices_.size());
+    _normals.reserve(vertices_.size());
+    for (const Vertex& v: vertices_)
+    {
+        _positions.push_back(v.position);
+        _normals.push_back(v.normal);
+    }
+
+    _triangles.clear();
+    _triangles.reserve(triangles_.size());
+    for (const Triangle& t: triangles_)
+        _triangles.push_back({t.i0, t.i1, t.i2});
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void Mesh::compress(std::pmr::memory_resource *_resource)
+{
+    std::vector<vec3> positions, normals;
+    std::vector<std::array<int, 3>> triangles;
+    export_geometry(positions, normals, triangles);
+
+    void *p = _resource->allocate(sizeof(CompressedMesh), alignof(CompressedMesh));
+    compressed_ = new (p) CompressedMesh(positions, normals, triangles, _resource);
+
+    // free uncompressed data
+    vertices_  = std::pmr::vector<Vertex>(vertices_.get_allocator());
+    triangles_ = std::pmr::vector<Triangle>(triangles_.get_allocator());
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void Mesh::load_paged(const std::filesystem::path &_filename, PageCache &_cache,
+                      std::pmr::memory_resource *_resource, std::ostream &_log)
+{
+    auto pageFilename = _filename;
+    pageFilename += ".pages";
+
+    // (re-)create the page file if the OFF file is newer
+    std::error_code ec;
+    const bool upToDate = std::filesystem::exists(pageFilename, ec) &&
+        std::filesystem::last_write_time(pageFilename, ec) >= std::filesystem::last_write_time(_filename, ec);
+
+    if (!upToDate || !(paged_ = PagedMesh::open(pageFilename, _cache, _resource)))
+    {
+        if (!read(_filename, _log))
+            throw std::runtime_error("Cannot read mesh " + _filename.string());
+
+        std::vector<vec3> positions, normals;
+        std::vector<std::array<int, 3>> triangles;
+        export_geometry(positions, normals, triangles);
+        vertices_  = std::pmr::vector<Vertex>(vertices_.get_allocator());
+        triangles_ = std::pmr::vector<Triangle>(triangles_.get_allocator());
+
+        if (!PagedMesh::write(pageFilename, positions, normals, triangles) ||
+            !(paged_ = PagedMesh::open(pageFilename, _cache, _resource)))
+            throw std::runtime_error("Cannot create page file " + pageFilename.string());
+    }
+    else
+    {
+        _log << "\n  reuse " << pageFilename << ": " << paged_->num_triangles() << " triangles";
+    }
+
+    bb_min_ = paged_->bb_min();
+    bb_max_ = paged_->bb_max();
+    _log << ", paged in " << paged_->num_clusters() << " clusters ("
+              << double(memory_bytes()) / num_triangles() << " resident bytes/triangle)";
 }
 
 
 //-----------------------------------------------------------------------------
 
 
-bool Mesh::read(const std::filesystem::path &_filename)
+size_t Mesh::num_triangles() const
+{
+    if (compressed_) return compressed_->num_triangles();
+    if (paged_)      return paged_->num_triangles();
+    return triangles_.size();
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+size_t Mesh::memory_bytes() const
+{
+    if (compressed_) return compressed_->memory_bytes();
+    if (paged_)      return paged_->memory_bytes();
+    return vertices_.size() * sizeof(Vertex) + triangles_.size() * sizeof(Triangle);
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+bool Mesh::read(const std::filesystem::path &_filename, std::ostream &_log)
 {
     // read a mesh in OFF format
 
@@ -69,7 +202,7 @@ bool Mesh::read(const std::filesystem::path &_filename)
         return false;
     }
     ifs >> nV >> nF >> dummy;
-    std::cout << "\n  read " << _filename << ": " << nV << " vertices, " << nF << " triangles";
+    _log << "\n  read " << _filename << ": " << nV << " vertices, " << nF << " triangles";
 
 
     // read vertices
@@ -111,70 +244,171 @@ bool Mesh::read(const std::filesystem::path &_filename)
 
 //-----------------------------------------------------------------------------
 
-// Determine the weights by which to scale triangle (p0, p1, p2)'s normal when
-// accumulating the vertex normals for vertices 0, 1, and 2.
+namespace {
+
+// number of triangles (or vertices) processed together
+constexpr int BLOCK_SIZE = 256;
+
+// Determine the weights by which to scale the normals of a block of triangles
+// (p0, p1, p2) when accumulating the vertex normals for vertices 0, 1, and 2.
 // (Recall, vertex normals are a weighted average of their incident triangles'
 // normals, and in our raytracer we'll use the incident angles as weights.)
-// \param[in] p0, p1, p2    triangle vertex positions
-// \param[out] w0, w1, w2    weights to be used for vertices 0, 1, and 2
-void angleWeights(const vec3 &p0, const vec3 &p1, const vec3 &p2,
-                  double &w0, double &w1, double &w2) {
-    // compute angle weights
-    const vec3 e01 = normalize(p1-p0);
-    const vec3 e12 = normalize(p2-p1);
-    const vec3 e20 = normalize(p0-p2);
-    w0 = acos( std::max(-1.0, std::min(1.0, dot(e01, -e20) )));
-    w1 = acos( std::max(-1.0, std::min(1.0, dot(e12, -e01) )));
-    w2 = acos( std::max(-1.0, std::min(1.0, dot(e20, -e12) )));
-}
+// Works on coordinate arrays, so that everything but acos() vectorizes.
+// \param[in] _n number of triangles (at most BLOCK_SIZE)
+// \param[in,out] _e edges p1-p0, p2-p1, p0-p2 as _e[edge][coordinate][triangle], normalized on return
+// \param[out] _w weights as _w[vertex][triangle]
+void angleWeights(int _n, double (&_e)[3][3][BLOCK_SIZE], double (&_w)[3][BLOCK_SIZE])
+{
+    for (int k = 0; k < 3; ++k)
+    {
+        double *x = _e[k][0], *y = _e[k][1], *z = _e[k][2];
+#if HAVE_OPENMP
+#  pragma omp simd
+#endif
+        for (int i = 0; i < _n; ++i)
+        {
+            // like normalize(): zero vectors stay unchanged
+            const double n = sqrt(x[i]*x[i] + y[i]*y[i] + z[i]*z[i]);
+            const double s = (n != 0.0) ? n : 1.0;
+            x[i] /= s;
+            y[i] /= s;
+            z[i] /= s;
+        }
+    }
 
+    // cosine of the angle at vertex k between edge k and the reversed previous edge
+    for (int k = 0; k < 3; ++k)
+    {
+        const int j = (k + 2) % 3;
+        const double *ax = _e[k][0], *ay = _e[k][1], *az = _e[k][2];
+        const double *bx = _e[j][0], *by = _e[j][1], *bz = _e[j][2];
+        double *w = _w[k];
+#if HAVE_OPENMP
+#  pragma omp simd
+#endif
+        for (int i = 0; i < _n; ++i)
+        {
+            const double c = ax[i]*(-bx[i]) + ay[i]*(-by[i]) + az[i]*(-bz[i]);
+            w[i] = std::max(-1.0, std::min(1.0, c));
+        }
+        for (int i = 0; i < _n; ++i)
+            w[i] = acos(w[i]);
+    }
+}
 
-//-----------------------------------------------------------------------------
 
-void Mesh::compute_normals()
+// Call _body(b) for the blocks b = 0.._n-1: as tasks of the current team if
+// called inside a parallel region (e.g. while the scene loads its meshes
+// concurrently), otherwise in a parallel loop.
+template <class Body>
+void forEachBlock(int _n, Body _body)
 {
-
-    /** \todo
-     * In some scenes (e.g the office scene) some objects should be flat
-     * shaded (e.g. the desk) while other objects should be Phong shaded to appear
-     * realistic (e.g. chairs). You have to implement the following:
-     * - Compute vertex normals by averaging the normals of their incident triangles.
-     * - Store the vertex normals in the Vertex::normal member variable.
-     * - Weigh the normals by their triangles' angles.
-     */
-
-    // initialize vertex normals to zero
-    for (Vertex& v: vertices_)
+#if HAVE_OPENMP
+    if (_n > 1 && omp_in_parallel())
     {
-        v.normal = vec3(0,0,0);
+#  pragma omp taskloop grainsize(1) default(shared)
+        for (int b = 0; b < _n; ++b) _body(b);
     }
-
-    // compute triangle normals and weights, compute vertices normals
-    for (Triangle& t: triangles_)
+    else
     {
-        const vec3& p0 = vertices_[t.i0].position;
-        const vec3& p1 = vertices_[t.i1].position;
-        const vec3& p2 = vertices_[t.i2].position;
-        t.normal = normalize(cross(p1-p0, p2-p0));
+#  pragma omp parallel for schedule(dynamic, 1) if(_n > 1)
+        for (int b = 0; b < _n; ++b) _body(b);
+    }
+#else
+    for (int b = 0; b < _n; ++b) _body(b);
+#endif
+}
 
-        std::array<double, 3> weights;
-        angleWeights(p0, p1, p2, weights[0], weights[1], weights[2]);
+/// determinant() of the columns (a, b, c), on scalars for SIMD loops
+inline double determinant3(double a0, double a1, double a2,
+                           double b0, double b1, double b2,
+                           double c0, double c1, double c2)
+{
+    const double sum1 = a0*b1*c2 + b0*c1*a2 + c0*a1*b2;
+    const double sum2 = c0*b1*a2 + b0*a1*c2 + a0*c1*b2;
+    return sum1 - sum2;
+}
 
-        vertices_[t.i0].normal += t.normal*weights[0];
-        vertices_[t.i1].normal += t.normal*weights[1];
-        vertices_[t.i2].normal += t.normal*weights[2];
+} // namespace
 
-    }
 
-    // normalize normals
-    for (Vertex& v: vertices_)
-    {
-        v.normal = normalize(v.normal);
-    }
+//-----------------------------------------------------------------------------
 
+void Mesh::compute_normals()
+{
+    // Vertex normals are the angle-weighted sums of the normals of their
+    // incident triangles. Instead of scattering each triangle's contribution
+    // to its vertices, every vertex gathers them in triangle order: that
+    // parallelizes without write conflicts and sums in the same order as a
+    // sequential loop, so the normals do not depend on the number of threads.
+
+    StopWatch timer;
+    timer.start();
+
+    const int nV = int(vertices_.size());
+    const int nT = int(triangles_.size());
+
+    // triangle normals and angle weights
+    std::vector<std::array<double, 3>> weights(nT);
+    forEachBlock((nT + BLOCK_SIZE - 1) / BLOCK_SIZE, [&](int _block) {
+        const int first = _block * BLOCK_SIZE;
+        const int n     = std::min(BLOCK_SIZE, nT - first);
+
+        double e[3][3][BLOCK_SIZE], w[3][BLOCK_SIZE];
+        for (int i = 0; i < n; ++i)
+        {
+            Triangle& t = triangles_[first + i];
+            const vec3& p0 = vertices_[t.i0].position;
+            const vec3& p1 = vertices_[t.i1].position;
+            const vec3& p2 = vertices_[t.i2].position;
+            t.normal = normalize(cross(p1-p0, p2-p0));
+
+            const vec3 edges[3] = { p1-p0, p2-p1, p0-p2 };
+            for (int k = 0; k < 3; ++k)
+                for (int j = 0; j < 3; ++j)
+                    e[k][j][i] = edges[k][j];
+        }
 
+        angleWeights(n, e, w);
+        for (int i = 0; i < n; ++i)
+            weights[first + i] = { w[0][i], w[1][i], w[2][i] };
+    });
 
+    // incident triangle corners (3*triangle + corner) of each vertex, in triangle order
+    std::vector<int> offset(nV + 1, 0), corners(3 * size_t(nT));
+    for (const Triangle& t: triangles_)
+    {
+        ++offset[t.i0 + 1];
+        ++offset[t.i1 + 1];
+        ++offset[t.i2 + 1];
+    }
+    std::partial_sum(offset.begin(), offset.end(), offset.begin());
+    {
+        std::vector<int> next(offset.begin(), offset.end() - 1);
+        for (int f = 0; f < nT; ++f)
+        {
+            const Triangle& t = triangles_[f];
+            corners[next[t.i0]++] = 3*f;
+            corners[next[t.i1]++] = 3*f + 1;
+            corners[next[t.i2]++] = 3*f + 2;
+        }
+    }
+
+    // gather and normalize vertex normals
+    forEachBlock((nV + BLOCK_SIZE - 1) / BLOCK_SIZE, [&](int _block) {
+        for (int v = _block * BLOCK_SIZE, end = std::min(nV, v + BLOCK_SIZE); v < end; ++v)
+        {
+            vec3 normal(0,0,0);
+            for (int k = offset[v]; k < offset[v + 1]; ++k)
+            {
+                const int f = corners[k] / 3;
+                normal += triangles_[f].normal * weights[f][corners[k] % 3];
+            }
+            vertices_[v].normal = normalize(normal);
+        }
+    });
 
+    normals_ms_ = timer.stop();
 }
 
 
@@ -221,12 +455,9 @@ bool Mesh::intersect_bounding_box(const Ray& _ray) const
             if(_ray.origin[i] < bb_min_[i] || _ray.origin[i] > bb_max_[i]) return false;
 
         }
-        double t1, t2;
-
-        t1 = (bb_min_[i] - _ray.origin[i]) / _ray.direction[i];
-        t2 = (bb_max_[i] - _ray.origin[i]) / _ray.direction[i];
-
-        if (t1 > t2) std::swap(t1, t2);
+        // entry and exit distance: the sign of the direction tells which side is hit first
+        const double t1 = ((_ray.sign[i] ? bb_max_ : bb_min_)[i] - _ray.origin[i]) * _ray.inv_direction[i];
+        const double t2 = ((_ray.sign[i] ? bb_min_ : bb_max_)[i] - _ray.origin[i]) * _ray.inv_direction[i];
 
         t_min = std::max(t1, t_min);
         t_max = std::min(t2, t_max);
@@ -246,40 +477,129 @@ bool Mesh::intersect_bounding_box(const Ray& _ray) const
 //-----------------------------------------------------------------------------
 
 
-bool Mesh::intersect(const Ray& _ray,
-                     vec3&      _intersection_point,
-                     vec3&      _intersection_normal,
-                     double&    _intersection_t ) const
+void Mesh::intersect(const RayBatch& _batch, int _id) const
 {
-    // check bounding box intersection
-    if (!intersect_bounding_box(_ray))
+    // rays are processed in chunks, so that the bounding box tests fit on the stack
+    constexpr int CHUNK = 64;
+
+    for (int first = 0; first < _batch.size; first += CHUNK)
     {
-        return false;
-    }
+        const int n = std::min(CHUNK, _batch.size - first);
 
-    vec3   p, n;
-    double t;
+        // check bounding box intersection
+        int  inside[CHUNK];
+        bool any = false;
+        for (int i = 0; i < n; ++i)
+            any |= inside[i] = intersect_bounding_box(_batch.ray(first + i));
+        if (!any) continue;
 
-    _intersection_t = NO_INTERSECTION;
+        if (compressed_ || paged_)
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                if (!inside[i]) continue;
+                const Ray ray = _batch.ray(first + i);
+                double   t, beta, gamma;
+                uint32_t triangle;
+                const bool found = compressed_ ? compressed_->intersect(ray, t, triangle, beta, gamma)
+                                               : paged_->intersect(ray, t, triangle, beta, gamma);
+                if (found && t < _batch.t[first + i])
+                {
+                    _batch.t[first + i]      = t;
+                    _batch.object[first + i] = _id;
+                    _batch.prim[first + i]   = int(triangle);
+                    _batch.beta[first + i]   = beta;
+                    _batch.gamma[first + i]  = gamma;
+                }
+            }
+            continue;
+        }
 
-    // for each triangle
-    for (const Triangle& triangle : triangles_)
-    {
-        // does ray intersect triangle?
-        if (intersect_triangle(triangle, _ray, p, n, t))
+        const double *ox = _batch.ox + first, *oy = _batch.oy + first, *oz = _batch.oz + first;
+        const double *dx = _batch.dx + first, *dy = _batch.dy + first, *dz = _batch.dz + first;
+        double *tmin   = _batch.t + first;
+        int    *object = _batch.object + first;
+        int    *prim   = _batch.prim + first;
+        double *bary_b = _batch.beta + first, *bary_g = _batch.gamma + first;
+
+        // for each triangle
+        for (size_t f = 0; f < triangles_.size(); ++f)
         {
-            // is intersection closer than previous intersections?
-            if (t < _intersection_t)
+            const Triangle& triangle = triangles_[f];
+            const vec3& p0 = vertices_[triangle.i0].position;
+            const vec3  e1 = p0 - vertices_[triangle.i1].position;
+            const vec3  e2 = p0 - vertices_[triangle.i2].position;
+            const double px = p0[0], py = p0[1], pz = p0[2];
+            const double ax = e1[0], ay = e1[1], az = e1[2];
+            const double bx = e2[0], by = e2[1], bz = e2[2];
+
+#if HAVE_OPENMP
+#  pragma omp simd
+#endif
+            for (int i = 0; i < n; ++i)
             {
-                // store data of this intersection
-                _intersection_t      = t;
-                _intersection_point  = p;
-                _intersection_normal = n;
+                // p0 - origin, solved like intersect_triangle() by Cramer's rule
+                const double cx = px - ox[i], cy = py - oy[i], cz = pz - oz[i];
+
+                const double detA     = determinant3(dx[i], dy[i], dz[i], ax, ay, az, bx, by, bz);
+                const double detT     = determinant3(cx, cy, cz, ax, ay, az, bx, by, bz);
+                const double detBeta  = determinant3(dx[i], dy[i], dz[i], cx, cy, cz, bx, by, bz);
+                const double detGamma = determinant3(dx[i], dy[i], dz[i], ax, ay, az, cx, cy, cz);
+
+                const double t     = detT / detA;
+                const double beta  = detBeta / detA;
+                const double gamma = detGamma / detA;
+
+                // is there an intersection closer than previous intersections?
+                // (selections instead of branches, so that the loop vectorizes)
+                const double t_hit = tmin[i], b_hit = bary_b[i], g_hit = bary_g[i];
+                const int    o_hit = object[i], p_hit = prim[i];
+                const bool   closer = (inside[i] != 0) & (t < t_hit) &
+                                      !((t <= 0) | (beta < 0) | (gamma < 0) | (beta + gamma > 1));
+                tmin[i]   = closer ? t      : t_hit;
+                object[i] = closer ? _id    : o_hit;
+                prim[i]   = closer ? int(f) : p_hit;
+                bary_b[i] = closer ? beta   : b_hit;
+                bary_g[i] = closer ? gamma  : g_hit;
             }
         }
     }
+}
+
 
-    return (_intersection_t != NO_INTERSECTION);
+//-----------------------------------------------------------------------------
+
+
+void Mesh::hit_attributes(const Ray& _ray, const HitRecord& _hit,
+                          vec3& _point, vec3& _normal) const
+{
+    if (compressed_)
+    {
+        compressed_->hit_attributes(_ray, _hit.t, uint32_t(_hit.prim), _hit.beta, _hit.gamma,
+                                    draw_mode_ == PHONG, _point, _normal);
+        return;
+    }
+
+    if (paged_)
+    {
+        paged_->hit_attributes(_ray, _hit.t, uint32_t(_hit.prim), _hit.beta, _hit.gamma,
+                               draw_mode_ == PHONG, _point, _normal);
+        return;
+    }
+
+    // like intersect_triangle(), but with the barycentric coordinates found by intersect()
+    const Triangle& triangle = triangles_[size_t(_hit.prim)];
+    _point = _hit.t * _ray.direction + _ray.origin;
+
+    if (draw_mode_ == FLAT) {
+        _normal = triangle.normal;
+    }
+    else if (draw_mode_ == PHONG) { //interpolate vertex normals
+        const double alpha = 1 - _hit.beta - _hit.gamma;
+        _normal = normalize(alpha * vertices_[triangle.i0].normal
+                          + _hit.beta * vertices_[triangle.i1].normal
+                          + _hit.gamma * vertices_[triangle.i2].normal);
+    }
 }
 
 
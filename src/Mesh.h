@@ -11,7 +11,12 @@
 
 
 #include "Object.h"
+#include "CompressedMesh.h"
+#include "PagedMesh.h"
+#include <array>
 #include <filesystem>
+#include <iostream>
+#include <memory_resource>
 #include <vector>
 
 
@@ -25,21 +30,37 @@ public:
     /// This type is used to choose between flat shading and Phong shading
     enum Draw_mode {FLAT, PHONG};
 
+    /// How the geometry is stored: as plain arrays, as CompressedMesh,
+    /// or out-of-core as PagedMesh
+    enum Storage {RESIDENT, COMPRESSED, PAGED};
+
     /// Construct a mesh by parsing its path and properties from an input
     /// stream. The mesh path read from the file is relative to the 
-    /// scene file's path "scenePath".
-    Mesh(std::istream &is, const std::filesystem::path &scenePath);
-
-    /// Intersect mesh with ray (calls ray-triangle intersection)
-    /// If \c _ray intersects a face of the mesh, it provides the following results:
-    /// \param[in] _ray the ray to intersect the mesh with
-    /// \param[out] _intersection_point the point of intersection
-    /// \param[out] _intersection_normal the surface normal at intersection point
-    /// \param[out] _intersection_t ray parameter at the intersection point
-    virtual bool intersect(const Ray& _ray,
-                           vec3&      _intersection_point,
-                           vec3&      _intersection_normal,
-                           double&    _intersection_t) const override;
+    /// scene file's path "scenePath". Vertex and triangle arrays are
+    /// allocated from the memory resource \c resource (e.g. a SceneArena).
+    /// With \c storage COMPRESSED the mesh is converted into a CompressedMesh
+    /// after loading; with PAGED it is stored in a page file and streamed in
+    /// through \c cache. In both cases the plain arrays are freed.
+    /// Progress messages are written to \c log.
+    Mesh(std::istream &is, const std::filesystem::path &scenePath,
+         std::pmr::memory_resource *resource = std::pmr::get_default_resource(),
+         Storage storage = RESIDENT, PageCache *cache = nullptr,
+         std::ostream &log = std::cout);
+
+    /// Intersect the mesh with all rays of \c _batch: rays that hit the
+    /// bounding box are tested against one triangle at a time, vectorized over
+    /// the rays. The primitive of a hit is the index of its triangle.
+    /// This function overrides Object::intersect(const RayBatch&, int).
+    virtual void intersect(const RayBatch& _batch, int _id) const override;
+
+    /// Compute the point and normal (see Draw_mode) of \c _hit, the closest
+    /// hit of \c _ray, from its triangle and barycentric coordinates.
+    /// This function overrides Object::hit_attributes().
+    virtual void hit_attributes(const Ray& _ray, const HitRecord& _hit,
+                                vec3& _point, vec3& _normal) const override;
+
+    /// single-ray intersection, see Object::intersect(const Ray&, vec3&, vec3&, double&)
+    using Object::intersect;
 
 private:
     /// a vertex consists of a position and a normal
@@ -65,15 +86,42 @@ private:
     };
 
 public:
-    /// Read mesh from an OFF file
-    bool read(const std::filesystem::path &_filename);
+    /// Read mesh from an OFF file, writing progress messages to \c _log
+    bool read(const std::filesystem::path &_filename, std::ostream &_log = std::cout);
 
-    /// Compute normal vectors for triangles and vertices
+    /// Compute normal vectors for triangles and vertices (in parallel for
+    /// large meshes; the result does not depend on the number of threads)
     void compute_normals();
 
+    /// Time spent in the last compute_normals() in milliseconds
+    double normals_time() const { return normals_ms_; }
+
     /// Compute the axis-aligned bounding box, store minimum and maximum point in bb_min_ and bb_max_
     void compute_bounding_box();
 
+    /// Replace vertex and triangle arrays by a CompressedMesh allocated from \c _resource
+    void compress(std::pmr::memory_resource *_resource);
+
+    /// Is the mesh stored in compressed form?
+    bool is_compressed() const { return compressed_ != nullptr; }
+
+    /// Load the mesh through a page file next to \c _filename (see PagedMesh)
+    void load_paged(const std::filesystem::path &_filename, PageCache &_cache,
+                    std::pmr::memory_resource *_resource, std::ostream &_log = std::cout);
+
+    /// Is the mesh stored out-of-core?
+    bool is_paged() const { return paged_ != nullptr; }
+
+    /// Copy vertex positions, vertex normals and triangle indices into plain arrays
+    void export_geometry(std::vector<vec3> &_positions, std::vector<vec3> &_normals,
+                         std::vector<std::array<int, 3>> &_triangles) const;
+
+    /// Number of triangles
+    size_t num_triangles() const;
+
+    /// Bytes used to store the mesh geometry
+    size_t memory_bytes() const;
+
     /// Does \c _ray intersect the bounding box of the mesh?
     bool intersect_bounding_box(const Ray& _ray) const;
 
@@ -97,18 +145,30 @@ public:
                        vec3 v3) const;
 
 private:
+    /// the compiled scene flattens the object's geometry
+    friend class CompiledScene;
+
     /// Does this mesh use flat or Phong shading?
     Draw_mode draw_mode_;
 
     /// Array of vertices
-    std::vector<Vertex> vertices_;
+    std::pmr::vector<Vertex> vertices_;
 
     /// Array of triangles
-    std::vector<Triangle> triangles_;
+    std::pmr::vector<Triangle> triangles_;
+
+    /// Compressed geometry (replaces vertices_ and triangles_), or nullptr
+    CompressedMesh *compressed_ = nullptr;
+
+    /// Out-of-core geometry (replaces vertices_ and triangles_), or nullptr
+    PagedMesh *paged_ = nullptr;
 
     /// Minimum point of the bounding box
     vec3 bb_min_;
     /// Maximum point of the bounding box
     vec3 bb_max_;
+
+    /// time spent in the last compute_normals() in milliseconds
+    double normals_ms_ = 0;
 };
 
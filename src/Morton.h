@@ -0,0 +1,32 @@
+#pragma once
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+#include <cstdint>
+
+/// \file Morton.h Morton codes (Z-order curve) for sorting primitives spatially.
+
+
+/// Spread the lower 10 bits of \c _v so that there are two zero bits between each.
+inline uint32_t expand_bits(uint32_t _v)
+{
+    _v = (_v * 0x00010001u) & 0xFF0000FFu;
+    _v = (_v * 0x00000101u) & 0x0F00F00Fu;
+    _v = (_v * 0x00000011u) & 0xC30C30C3u;
+    _v = (_v * 0x00000005u) & 0x49249249u;
+    return _v;
+}
+
+
+/// 30-bit Morton code of a point given by three 10-bit grid coordinates.
+inline uint32_t morton3(uint32_t _x, uint32_t _y, uint32_t _z)
+{
+    return (expand_bits(_x) << 2) | (expand_bits(_y) << 1) | expand_bits(_z);
+}
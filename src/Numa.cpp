@@ -0,0 +1,156 @@
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+#include "Numa.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#  include <sched.h>
+#endif
+
+
+namespace {
+
+/// parse a Linux CPU list like "0-3,8-11"
+std::vector<int> parse_cpu_list(const std::string& _list)
+{
+    std::vector<int> cpus;
+    std::istringstream is(_list);
+    std::string item;
+    while (std::getline(is, item, ','))
+    {
+        const size_t dash = item.find('-');
+        try
+        {
+            const int first = std::stoi(item.substr(0, dash));
+            const int last  = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+            for (int c = first; c <= last; ++c) cpus.push_back(c);
+        }
+        catch (const std::logic_error&)
+        {
+            // skip malformed entries (e.g. the empty list of a memory-only node)
+        }
+    }
+    return cpus;
+}
+
+} // namespace
+
+
+//-----------------------------------------------------------------------------
+
+
+NumaTopology::NumaTopology()
+{
+#ifdef __linux__
+    std::error_code ec;
+    for (int node = 0; ; ++node)
+    {
+        const std::filesystem::path dir = "/sys/devices/system/node/node" + std::to_string(node);
+        if (!std::filesystem::exists(dir, ec)) break;
+
+        std::ifstream file(dir / "cpulist");
+        std::string list;
+        std::getline(file, list);
+        cpus_.push_back(parse_cpu_list(list));
+        ids_.push_back(node);
+    }
+
+    // only CPUs this process is allowed to run on (e.g. by taskset or cgroups)
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+    {
+        for (auto& c: cpus_)
+            c.erase(std::remove_if(c.begin(), c.end(), [&](int _cpu) {
+                        return _cpu < 0 || _cpu >= CPU_SETSIZE || !CPU_ISSET(_cpu, &allowed);
+                    }), c.end());
+    }
+
+    // nodes without CPUs get no threads
+    for (size_t n = cpus_.size(); n-- > 0; )
+    {
+        if (!cpus_[n].empty()) continue;
+        cpus_.erase(cpus_.begin() + long(n));
+        ids_.erase(ids_.begin() + long(n));
+    }
+#endif
+
+    if (cpus_.empty())
+    {
+        ids_.assign(1, 0);
+        cpus_.emplace_back();
+        const int n = int(std::max(1u, std::thread::hardware_concurrency()));
+        for (int c = 0; c < n; ++c) cpus_[0].push_back(c);
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+const NumaTopology& NumaTopology::system()
+{
+    static const NumaTopology topology;
+    return topology;
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+int NumaTopology::cpu_of_thread(int _thread, int _threads, int& _node) const
+{
+    size_t total = 0;
+    for (const auto& c: cpus_) total += c.size();
+
+    // spread the threads evenly over the CPUs in node order, so that
+    // neighbouring threads share a node
+    size_t i = size_t(_thread) * total / size_t(std::max(_threads, 1)) % total;
+    for (_node = 0; i >= cpus_[_node].size(); ++_node) i -= cpus_[_node].size();
+    return cpus_[_node][i];
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+int NumaTopology::node_of_thread(int _thread, int _threads) const
+{
+    int node;
+    cpu_of_thread(_thread, _threads, node);
+    return node;
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+int NumaTopology::pin(int _thread, int _threads) const
+{
+    int node;
+    const int cpu = cpu_of_thread(_thread, _threads, node);
+
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+#else
+    (void)cpu;
+#endif
+
+    return node;
+}
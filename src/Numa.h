@@ -0,0 +1,82 @@
+#pragma once
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+/// \class NumaTopology Numa.h
+/// The NUMA nodes of the machine and the CPUs of each that this process may
+/// run on. On Linux they are read from /sys/devices/system/node; elsewhere
+/// (or if that fails) the machine is treated as a single node.
+class NumaTopology
+{
+public:
+
+    /// the topology of this machine (detected once)
+    static const NumaTopology& system();
+
+    /// number of nodes
+    int nodes() const { return int(cpus_.size()); }
+
+    /// the CPUs of node \c _node
+    const std::vector<int>& cpus(int _node) const { return cpus_[_node]; }
+
+    /// the number of node \c _node in the operating system
+    int id(int _node) const { return ids_[_node]; }
+
+    /// Node of the CPU that thread \c _thread of \c _threads is placed on by
+    /// pin(): the threads are spread evenly over the CPUs of all nodes.
+    int node_of_thread(int _thread, int _threads) const;
+
+    /// Pin the calling thread, number \c _thread of \c _threads, to its CPU
+    /// (see node_of_thread()). Returns its node. Only has an effect on Linux.
+    int pin(int _thread, int _threads) const;
+
+private:
+
+    NumaTopology();
+
+    /// CPU of thread \c _thread of \c _threads, and its node
+    int cpu_of_thread(int _thread, int _threads, int& _node) const;
+
+    /// CPUs per node, and the node numbers of the operating system
+    std::vector<std::vector<int>> cpus_;
+    std::vector<int> ids_;
+};
+
+
+/// \class NumaStats Numa.h
+/// Work done per NUMA node during a render with RenderSettings::numa
+struct NumaStats
+{
+    /// per node: its number, threads, pixels rendered and the summed busy time of its threads
+    std::vector<int> ids;
+    std::vector<size_t> threads, pixels;
+    std::vector<double> busy_ms;
+    /// number of nodes with a replica of the geometry (0: not replicated)
+    size_t replicas = 0;
+};
+
+/// print the throughput of each node
+inline std::ostream& operator<<(std::ostream& _os, const NumaStats& _s)
+{
+    for (size_t n = 0; n < _s.threads.size(); ++n)
+    {
+        if (!_s.threads[n]) continue;
+        _os << "\n  node " << _s.ids[n] << ": " << _s.threads[n] << (_s.threads[n] == 1 ? " thread, " : " threads, ")
+            << _s.pixels[n] << " pixels, "
+            << (_s.busy_ms[n] > 0 ? double(_s.pixels[n]) / _s.busy_ms[n] : 0.0) << " pixels/ms per thread";
+    }
+    _os << "\n  geometry " << (_s.replicas ? "replicated on " + std::to_string(_s.replicas) + " nodes" : std::string("shared"));
+    return _os;
+}
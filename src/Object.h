@@ -17,10 +17,93 @@
 #include <limits>
 
 
+/// \class HitRecord Object.h
+/// Compact record of the closest hit of a ray, as kept while searching. The
+/// point and normal are only computed from it for the final closest hit
+/// (see Object::hit_attributes()).
+struct HitRecord
+{
+    /// ray parameter of the hit
+    double t = std::numeric_limits<double>::max();
+    /// id of the object and its primitive (e.g. triangle), -1 if there is no hit
+    int object = -1, prim = -1;
+    /// barycentric coordinates of vertices 1 and 2 of a hit triangle
+    double beta = 0, gamma = 0;
+};
+
+
+/// \class RayBatch Object.h
+/// A batch of rays that is intersected with an object at once (see
+/// Object::intersect(const RayBatch&, int)). The rays are stored as one array
+/// per coordinate, so that implementations can test several rays with one
+/// SIMD instruction. For every ray, \c t, \c object, \c prim, \c beta and
+/// \c gamma hold its closest hit so far (see HitRecord).
+struct RayBatch
+{
+    /// number of rays
+    int size;
+    /// ray origins
+    const double *ox, *oy, *oz;
+    /// ray directions (normalized)
+    const double *dx, *dy, *dz;
+    /// ray parameter of the closest hit
+    double *t;
+    /// id of the object of the closest hit
+    int *object;
+    /// primitive of that object (e.g. triangle) of the closest hit
+    int *prim;
+    /// barycentric coordinates of the closest hit on a triangle
+    double *beta, *gamma;
+
+    /// ray \c _i of the batch
+    Ray ray(int _i) const
+    {
+        Ray r;
+        r.origin    = vec3(ox[_i], oy[_i], oz[_i]);
+        r.direction = vec3(dx[_i], dy[_i], dz[_i]);
+        r.precompute();
+        return r;
+    }
+
+    /// closest hit of ray \c _i
+    HitRecord hit(int _i) const { return HitRecord{t[_i], object[_i], prim[_i], beta[_i], gamma[_i]}; }
+};
+
+
+/// \class RayPacket Object.h
+/// Storage for a RayBatch of up to \c N rays
+template <int N>
+struct RayPacket
+{
+    double ox[N], oy[N], oz[N];
+    double dx[N], dy[N], dz[N];
+    double t[N];
+    int    object[N], prim[N];
+    double beta[N], gamma[N];
+    int    size = 0;
+
+    /// Append \c _ray (without a hit). The packet must not be full.
+    void add(const Ray& _ray)
+    {
+        ox[size] = _ray.origin[0];    oy[size] = _ray.origin[1];    oz[size] = _ray.origin[2];
+        dx[size] = _ray.direction[0]; dy[size] = _ray.direction[1]; dz[size] = _ray.direction[2];
+        t[size]      = std::numeric_limits<double>::max();
+        object[size] = -1;
+        prim[size]   = -1;
+        beta[size]   = gamma[size] = 0;
+        ++size;
+    }
+
+    /// the rays of the packet
+    RayBatch batch() { return RayBatch{size, ox, oy, oz, dx, dy, dz, t, object, prim, beta, gamma}; }
+};
+
+
 /// \class Object Object.h
 /// This class implements an abstract class for an object.
 /// Every derived object type will inherit the material property, and it
-/// will have to override the virtual function Object::intersect().
+/// will have to override the virtual functions
+/// Object::intersect(const RayBatch&, int) and Object::hit_attributes().
 struct Object
 {
 public:
@@ -31,16 +114,37 @@ public:
     /// has to be virtual as well).
     virtual ~Object() {}
 
+    /// Intersect the object, whose id is \c _id, with all rays of \c _batch.
+    /// Rays whose first intersection with the object (t > 0) is closer than
+    /// their closest hit so far get it as their new closest hit.
+    virtual void intersect(const RayBatch& _batch, int _id) const = 0;
+
+    /// Compute the point and normal of \c _hit, the closest hit of \c _ray
+    /// as found by intersect(const RayBatch&, int).
+    virtual void hit_attributes(const Ray& _ray, const HitRecord& _hit,
+                                vec3& _point, vec3& _normal) const = 0;
+
     /// Intersect the object with \c _ray, return whether there is an intersection.
     /// If \c _ray intersects the object, provide the following results:
     /// \param[in] _ray the ray to intersect the object with
     /// \param[out] _intersection_point the point of intersection
     /// \param[out] _intersection_normal the surface normal at intersection point
     /// \param[out] _intersection_t ray parameter at intersection point
-    virtual bool intersect(const Ray&  _ray,
-                           vec3&       _intersection_point,
-                           vec3&       _intersection_normal,
-                           double&     _intersection_t) const = 0;
+    bool intersect(const Ray&  _ray,
+                   vec3&       _intersection_point,
+                   vec3&       _intersection_normal,
+                   double&     _intersection_t) const
+    {
+        RayPacket<1> packet;
+        packet.add(_ray);
+        const RayBatch batch = packet.batch();
+        intersect(batch, 0);
+        if (packet.object[0] < 0) return false;
+
+        _intersection_t = packet.t[0];
+        hit_attributes(_ray, batch.hit(0), _intersection_point, _intersection_normal);
+        return true;
+    }
 
     /// parse object properties from an input stream
     virtual void parse(std::istream &) { throw std::logic_error("Unimplemented"); }
@@ -0,0 +1,399 @@
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+//== INCLUDES =================================================================
+
+#include "PagedMesh.h"
+#include "Intersection.h"
+#include "Object.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+#  include <process.h>
+#  define getpid _getpid
+#else
+#  include <unistd.h>
+#endif
+
+
+//== IMPLEMENTATION ===========================================================
+
+
+/// identifies page files (and their version)
+static const char PAGE_FILE_MAGIC[8] = {'R','T','P','A','G','E','0','2'};
+
+
+//-----------------------------------------------------------------------------
+
+
+PageCache::File* PageCache::open(const std::filesystem::path& _filename, uint32_t _num_pages)
+{
+    auto file = std::make_unique<File>();
+    file->stream.open(_filename, std::ios::binary);
+    if (!file->stream)
+        return nullptr;
+    file->slots = std::make_unique<Slot[]>(_num_pages);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    files_.push_back(std::move(file));
+    return files_.back().get();
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+std::shared_ptr<const PageCache::Page>
+PageCache::fetch(File& _file, uint32_t _page, uint64_t _offset,
+                 uint32_t _num_vertices, uint32_t _num_triangles, uint32_t _num_nodes)
+{
+    Slot& slot = _file.slots[_page];
+    std::shared_ptr<const Page> page;
+
+    {
+        std::lock_guard<std::mutex> lock(slot.mutex);
+        if (slot.page)
+        {
+            ++hits_;
+            slot.referenced.store(true, std::memory_order_relaxed);
+            return slot.page;
+        }
+
+        // page fault: read holding only the slot's lock, other threads that
+        // need this page wait for it instead of reading it again
+        page = load(_file, _offset, _num_vertices, _num_triangles, _num_nodes);
+        slot.page = page;
+        slot.referenced.store(true, std::memory_order_relaxed);
+    }
+
+    // the slot's lock is released, since eviction locks slots while holding the cache lock
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++faults_;
+    slot.bytes = page->bytes();
+    bytes_ += slot.bytes;
+    clock_.push_back(&slot);
+
+    // evict pages that were not used since the hand passed them last,
+    // but never the new one. Pages still used by other threads stay alive
+    // until they are released.
+    while (bytes_ > budget_ && clock_.size() > 1)
+    {
+        if (hand_ >= clock_.size()) hand_ = 0;
+        Slot* victim = clock_[hand_];
+        if (victim == &slot || victim->referenced.exchange(false, std::memory_order_relaxed))
+        {
+            ++hand_;
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> victim_lock(victim->mutex);
+            victim->page.reset();
+        }
+        bytes_ -= victim->bytes;
+        clock_.erase(clock_.begin() + long(hand_));
+        ++evictions_;
+    }
+    peak_bytes_ = std::max(peak_bytes_, bytes_);
+
+    return page;
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+std::shared_ptr<const PageCache::Page>
+PageCache::load(File& _file, uint64_t _offset, uint32_t _num_vertices,
+                uint32_t _num_triangles, uint32_t _num_nodes)
+{
+    auto page = std::make_shared<Page>();
+    page->positions.resize(_num_vertices);
+    page->normals.resize(_num_vertices);
+    page->indices.resize(3 * size_t(_num_triangles));
+    page->nodes.resize(_num_nodes);
+
+    std::lock_guard<std::mutex> lock(_file.mutex);
+    _file.stream.seekg(std::streamoff(_offset));
+    _file.stream.read(reinterpret_cast<char*>(page->positions.data()), _num_vertices * sizeof(vec3));
+    _file.stream.read(reinterpret_cast<char*>(page->normals.data()),   _num_vertices * sizeof(vec3));
+    _file.stream.read(reinterpret_cast<char*>(page->indices.data()),   page->indices.size() * sizeof(uint16_t));
+    _file.stream.read(reinterpret_cast<char*>(page->nodes.data()),     _num_nodes * sizeof(BvhNode));
+    if (!_file.stream)
+        throw std::runtime_error("Failed to read page from page file");
+
+    return page;
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+bool PagedMesh::write(const std::filesystem::path& _filename,
+                      const std::vector<vec3>& _positions,
+                      const std::vector<vec3>& _normals,
+                      const std::vector<std::array<int, 3>>& _triangles)
+{
+    vec3 bb_min(std::numeric_limits<double>::max());
+    vec3 bb_max(std::numeric_limits<double>::lowest());
+    for (const vec3& p: _positions)
+    {
+        bb_min = min(bb_min, p);
+        bb_max = max(bb_max, p);
+    }
+
+    // spatially compact clusters with their own hierarchies and local vertex ranges
+    std::vector<Aabb> boxes(_triangles.size());
+    for (size_t t=0; t<_triangles.size(); ++t)
+        for (int k=0; k<3; ++k)
+            boxes[t].grow(_positions[_triangles[t][k]]);
+
+    TriangleClusters clustered;
+    cluster_triangles(_triangles, boxes, _positions.size(), CLUSTER_SIZE, MAX_CLUSTER_LEAF, clustered);
+
+    // build the pages, triangles in the leaf order of their hierarchy
+    const size_t num_clusters = clustered.triangles.size();
+    std::vector<Cluster> clusters(num_clusters);
+    std::vector<PageCache::Page> pages(num_clusters);
+    for (size_t c=0; c<num_clusters; ++c)
+    {
+        PageCache::Page& page = pages[c];
+        vec3 cb_min(std::numeric_limits<double>::max());
+        vec3 cb_max(std::numeric_limits<double>::lowest());
+        for (int v: clustered.vertices[c])
+        {
+            page.positions.push_back(_positions[v]);
+            page.normals.push_back(_normals[v]);
+            cb_min = min(cb_min, _positions[v]);
+            cb_max = max(cb_max, _positions[v]);
+        }
+        page.indices.swap(clustered.indices[c]);
+        page.nodes.swap(clustered.nodes[c]);
+
+        for (int i=0; i<3; ++i)
+        {
+            clusters[c].bb_min[i] = cb_min[i];
+            clusters[c].bb_max[i] = cb_max[i];
+        }
+        clusters[c].num_vertices  = uint32_t(page.positions.size());
+        clusters[c].num_triangles = uint32_t(clustered.triangles[c].size());
+        clusters[c].num_nodes     = uint32_t(page.nodes.size());
+    }
+
+    // hierarchy over the cluster boxes. Directory and pages are stored in its
+    // leaf order, so that its leaves refer to ranges of the directory.
+    std::vector<BvhNode> nodes;
+    if (num_clusters > 0)
+    {
+        boxes.assign(num_clusters, Aabb());
+        for (size_t c=0; c<num_clusters; ++c)
+        {
+            boxes[c].min = vec3(clusters[c].bb_min[0], clusters[c].bb_min[1], clusters[c].bb_min[2]);
+            boxes[c].max = vec3(clusters[c].bb_max[0], clusters[c].bb_max[1], clusters[c].bb_max[2]);
+        }
+        std::vector<int> order;
+        BvhStats stats;
+        build_bvh(boxes, BvhMethod::SAH, nodes, order, stats);
+
+        std::vector<Cluster> sorted_clusters(num_clusters);
+        std::vector<PageCache::Page> sorted_pages(num_clusters);
+        for (size_t c=0; c<num_clusters; ++c)
+        {
+            sorted_clusters[c] = clusters[order[c]];
+            sorted_pages[c]    = std::move(pages[order[c]]);
+        }
+        clusters.swap(sorted_clusters);
+        pages.swap(sorted_pages);
+    }
+
+    // header, directory, hierarchy, pages
+    const uint32_t n = uint32_t(num_clusters);
+    const uint64_t num_triangles = _triangles.size();
+    const uint32_t num_nodes = uint32_t(nodes.size());
+    uint64_t offset = sizeof(PAGE_FILE_MAGIC) + sizeof(n) + sizeof(num_triangles)
+                    + 2*sizeof(vec3) + sizeof(num_nodes)
+                    + num_clusters * sizeof(Cluster) + num_nodes * sizeof(BvhNode);
+    for (size_t c=0; c<num_clusters; ++c)
+    {
+        clusters[c].offset = offset;
+        offset += 2 * pages[c].positions.size() * sizeof(vec3) + pages[c].indices.size() * sizeof(uint16_t)
+                + pages[c].nodes.size() * sizeof(BvhNode);
+    }
+
+    // write a file of our own and rename it into place, so that other
+    // processes (e.g. local workers loading the same scene) never open a
+    // partially written page file, and readers keep the file they opened
+    std::ostringstream suffix;
+    suffix << ".tmp." << getpid() << '.' << std::this_thread::get_id();
+    std::filesystem::path temporary = _filename;
+    temporary += suffix.str();
+
+    std::ofstream ofs(temporary, std::ios::binary);
+    if (!ofs)
+    {
+        std::cerr << "ERROR: Failed to open " << temporary.string() << " for writing." << std::endl;
+        return false;
+    }
+    ofs.write(PAGE_FILE_MAGIC, sizeof(PAGE_FILE_MAGIC));
+    ofs.write(reinterpret_cast<const char*>(&n), sizeof(n));
+    ofs.write(reinterpret_cast<const char*>(&num_triangles), sizeof(num_triangles));
+    ofs.write(reinterpret_cast<const char*>(&bb_min), sizeof(vec3));
+    ofs.write(reinterpret_cast<const char*>(&bb_max), sizeof(vec3));
+    ofs.write(reinterpret_cast<const char*>(&num_nodes), sizeof(num_nodes));
+    ofs.write(reinterpret_cast<const char*>(clusters.data()), num_clusters * sizeof(Cluster));
+    ofs.write(reinterpret_cast<const char*>(nodes.data()), num_nodes * sizeof(BvhNode));
+    for (const PageCache::Page& page: pages)
+    {
+        ofs.write(reinterpret_cast<const char*>(page.positions.data()), page.positions.size() * sizeof(vec3));
+        ofs.write(reinterpret_cast<const char*>(page.normals.data()),   page.normals.size() * sizeof(vec3));
+        ofs.write(reinterpret_cast<const char*>(page.indices.data()),   page.indices.size() * sizeof(uint16_t));
+        ofs.write(reinterpret_cast<const char*>(page.nodes.data()),     page.nodes.size() * sizeof(BvhNode));
+    }
+    ofs.close();
+
+    std::error_code ec;
+    if (ofs) std::filesystem::rename(temporary, _filename, ec);
+    if (!ofs || ec)
+    {
+        std::filesystem::remove(temporary, ec);
+        return false;
+    }
+    return true;
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+PagedMesh* PagedMesh::open(const std::filesystem::path& _filename, PageCache& _cache,
+                           std::pmr::memory_resource* _resource)
+{
+    std::ifstream ifs(_filename, std::ios::binary);
+    if (!ifs) return nullptr;
+
+    char magic[sizeof(PAGE_FILE_MAGIC)];
+    uint32_t n, num_nodes;
+    uint64_t num_triangles;
+    vec3 bb_min, bb_max;
+    ifs.read(magic, sizeof(magic));
+    ifs.read(reinterpret_cast<char*>(&n), sizeof(n));
+    ifs.read(reinterpret_cast<char*>(&num_triangles), sizeof(num_triangles));
+    ifs.read(reinterpret_cast<char*>(&bb_min), sizeof(vec3));
+    ifs.read(reinterpret_cast<char*>(&bb_max), sizeof(vec3));
+    ifs.read(reinterpret_cast<char*>(&num_nodes), sizeof(num_nodes));
+    if (!ifs || std::memcmp(magic, PAGE_FILE_MAGIC, sizeof(magic)) != 0)
+        return nullptr;
+
+    PageCache::File* file = _cache.open(_filename, n);
+    if (!file) return nullptr;
+
+    void* p = _resource->allocate(sizeof(PagedMesh), alignof(PagedMesh));
+    PagedMesh* mesh = new (p) PagedMesh(_cache, file, _resource);
+    mesh->clusters_.resize(n);
+    ifs.read(reinterpret_cast<char*>(mesh->clusters_.data()), n * sizeof(Cluster));
+    mesh->nodes_.resize(num_nodes);
+    ifs.read(reinterpret_cast<char*>(mesh->nodes_.data()), num_nodes * sizeof(BvhNode));
+    if (!ifs) return nullptr;
+
+    mesh->num_triangles_ = num_triangles;
+    mesh->bb_min_ = bb_min;
+    mesh->bb_max_ = bb_max;
+    return mesh;
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+bool PagedMesh::intersect(const Ray& _ray, double& _t, uint32_t& _triangle,
+                          double& _beta, double& _gamma) const
+{
+    _t = Object::NO_INTERSECTION;
+    if (nodes_.empty()) return false;
+
+    // clusters front to back, only those whose boxes are closer than the
+    // closest hit (with the slack of traverse_bvh())
+    constexpr double slack = 1 + 1e-9;
+    traverse_bvh(nodes_.data(), _ray, [&]() { return _t; }, [&](int _first, int _count)
+    {
+        for (uint32_t c=uint32_t(_first); c<uint32_t(_first+_count); ++c)
+        {
+            const Cluster& cluster = clusters_[c];
+            BvhNode box;
+            box.bb_min = vec3(cluster.bb_min[0], cluster.bb_min[1], cluster.bb_min[2]);
+            box.bb_max = vec3(cluster.bb_max[0], cluster.bb_max[1], cluster.bb_max[2]);
+            if (!intersect_node(_ray, box, _t * slack)) continue;
+
+            // the ray reaches this cluster: make sure its page is resident
+            const auto pg = page(c);
+            const std::vector<vec3>&     positions = pg->positions;
+            const std::vector<uint16_t>& indices   = pg->indices;
+
+            traverse_bvh(pg->nodes.data(), _ray, [&]() { return _t; }, [&](int _first_triangle, int _num_triangles)
+            {
+                for (int t=_first_triangle; t<_first_triangle+_num_triangles; ++t)
+                {
+                    const vec3& p0 = positions[indices[3*t  ]];
+                    const vec3& p1 = positions[indices[3*t+1]];
+                    const vec3& p2 = positions[indices[3*t+2]];
+
+                    double tt, beta, gamma;
+                    if (intersect_triangle(_ray, p0, p0-p1, p0-p2, tt, beta, gamma) && tt < _t)
+                    {
+                        _t        = tt;
+                        _triangle = c * CLUSTER_SIZE + uint32_t(t);
+                        _beta     = beta;
+                        _gamma    = gamma;
+                    }
+                }
+            });
+        }
+    });
+
+    return _t != Object::NO_INTERSECTION;
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void PagedMesh::hit_attributes(const Ray& _ray, double _t, uint32_t _triangle,
+                               double _beta, double _gamma, bool _phong,
+                               vec3& _point, vec3& _normal) const
+{
+    const auto pg = page(_triangle / CLUSTER_SIZE);
+    const uint32_t t = _triangle % CLUSTER_SIZE;
+    const int i0 = pg->indices[3*t], i1 = pg->indices[3*t+1], i2 = pg->indices[3*t+2];
+    const vec3& p0 = pg->positions[i0];
+    const vec3& p1 = pg->positions[i1];
+    const vec3& p2 = pg->positions[i2];
+
+    _point = _t * _ray.direction + _ray.origin;
+
+    if (!_phong)
+    {
+        // same computation as Mesh::compute_normals()
+        _normal = normalize(cross(p1-p0, p2-p0));
+    }
+    else
+    {
+        const double alpha = 1 - _beta - _gamma;
+
+        _normal = normalize(alpha * pg->normals[i0] + _beta * pg->normals[i1] + _gamma * pg->normals[i2]);
+    }
+}
+
+
+//=============================================================================
@@ -0,0 +1,256 @@
+#pragma once
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+#include "Bvh.h"
+#include "Ray.h"
+#include "vec3.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <vector>
+
+
+/// \class PageCache PagedMesh.h
+/// Cache for the clusters ("pages") of out-of-core meshes. Pages are read
+/// from their page file when a ray first reaches them and evicted by the
+/// CLOCK (second chance) algorithm when the resident pages exceed the memory
+/// budget: a page that was used since the clock hand passed it last is
+/// spared once. Every page has its own slot with its own lock, so requests
+/// for resident pages do not contend for the cache; only page faults do.
+/// All functions are thread-safe.
+class PageCache
+{
+public:
+
+    /// geometry of one cluster
+    struct Page
+    {
+        /// vertex positions
+        std::vector<vec3> positions;
+        /// vertex normals
+        std::vector<vec3> normals;
+        /// cluster-local vertex indices, three per triangle
+        std::vector<uint16_t> indices;
+        /// hierarchy over the triangles; its leaves refer to ranges of triangles
+        std::vector<BvhNode> nodes;
+
+        /// bytes occupied by this page
+        size_t bytes() const
+        {
+            return sizeof(Page) + (positions.size() + normals.size()) * sizeof(vec3)
+                                + indices.size() * sizeof(uint16_t)
+                                + nodes.size() * sizeof(BvhNode);
+        }
+    };
+
+    /// place of one page in the cache
+    struct Slot
+    {
+        /// guards \c page
+        std::mutex mutex;
+        /// the page while it is resident
+        std::shared_ptr<const Page> page;
+        /// used since the clock hand passed the slot last
+        std::atomic<bool> referenced{false};
+        /// bytes of the resident page (guarded by the cache's lock)
+        size_t bytes = 0;
+    };
+
+    /// an open page file with a slot for each of its pages; reads are serialized per file
+    struct File
+    {
+        std::ifstream           stream;
+        std::mutex              mutex;
+        std::unique_ptr<Slot[]> slots;
+    };
+
+    /// Construct a cache that keeps at most \c _budget bytes of pages resident
+    explicit PageCache(size_t _budget) : budget_(_budget) {}
+
+    /// Register a page file with \c _num_pages pages. Returns the file to be
+    /// used in fetch(), which stays valid as long as the cache, or nullptr if
+    /// it cannot be opened.
+    File* open(const std::filesystem::path& _filename, uint32_t _num_pages);
+
+    /// Return page \c _page of \c _file that is stored at byte \c _offset
+    /// with \c _num_vertices vertices, \c _num_triangles triangles and
+    /// \c _num_nodes nodes. Reads the page from disk if it is not resident.
+    std::shared_ptr<const Page> fetch(File& _file, uint32_t _page, uint64_t _offset,
+                                      uint32_t _num_vertices, uint32_t _num_triangles,
+                                      uint32_t _num_nodes);
+
+    /// memory budget in bytes
+    size_t budget() const { return budget_; }
+
+    /// number of pages read from disk
+    size_t num_faults() const { return faults_; }
+
+    /// number of requests served from memory
+    size_t num_hits() const { return hits_; }
+
+    /// number of evicted pages
+    size_t num_evictions() const { return evictions_; }
+
+    /// maximum number of bytes resident at the same time
+    size_t peak_bytes() const { return peak_bytes_; }
+
+private:
+
+    /// read a page from disk
+    std::shared_ptr<const Page> load(File& _file, uint64_t _offset, uint32_t _num_vertices,
+                                     uint32_t _num_triangles, uint32_t _num_nodes);
+
+private:
+
+    size_t budget_;
+
+    /// guards the files, the clock and the statistics except \c hits_.
+    /// Lock order: this lock before the lock of a slot.
+    std::mutex                         mutex_;
+    std::vector<std::unique_ptr<File>> files_;
+    /// slots of the resident pages in the order they were loaded, and the clock hand
+    std::vector<Slot*>                 clock_;
+    size_t                             hand_ = 0;
+
+    size_t bytes_      = 0;
+    size_t peak_bytes_ = 0;
+    size_t faults_     = 0;
+    size_t evictions_  = 0;
+    std::atomic<size_t> hits_{0};
+};
+
+
+/// print statistics of a page cache
+inline std::ostream& operator<<(std::ostream& _os, const PageCache& _cache)
+{
+    const size_t requests = _cache.num_faults() + _cache.num_hits();
+    _os << _cache.num_faults() << " page faults, "
+        << _cache.num_hits() << " hits ("
+        << (requests ? 100.0 * _cache.num_hits() / requests : 0.0) << "% hit rate), "
+        << _cache.num_evictions() << " evictions, peak "
+        << _cache.peak_bytes() / (1024.0*1024.0) << " of "
+        << _cache.budget() / (1024.0*1024.0) << " MB";
+    return _os;
+}
+
+
+//== CLASS DEFINITION =========================================================
+
+
+/// \class PagedMesh PagedMesh.h
+/// Out-of-core storage of a triangle mesh. The triangles are ordered like the
+/// leaves of a hierarchy over all of them and split into spatial clusters of
+/// at most `CLUSTER_SIZE` triangles, which are stored in a page file next to
+/// the OFF file, together with a small hierarchy over the triangles of each
+/// cluster. Only the cluster directory (bounding box and file location of
+/// every cluster) and a hierarchy over the cluster boxes stay in memory. Rays
+/// traverse it front to back, and the geometry of a cluster is faulted in
+/// through a PageCache only when a ray reaches the cluster's box before the
+/// closest hit so far. Page files are reused as long as they are newer than
+/// their OFF file, so the OFF file does not even have to be parsed again.
+class PagedMesh
+{
+public:
+
+    /// maximum number of triangles per cluster
+    static constexpr int CLUSTER_SIZE = 1024;
+
+    /// maximum number of triangles per leaf of a cluster's hierarchy
+    static constexpr int MAX_CLUSTER_LEAF = 4;
+
+    /// Open the existing page file \c _filename. Returns nullptr if it
+    /// does not exist or is invalid.
+    static PagedMesh* open(const std::filesystem::path& _filename, PageCache& _cache,
+                           std::pmr::memory_resource* _resource);
+
+    /// Write a page file for an indexed face set. \c _triangles holds three vertex
+    /// indices per triangle; \c _normals holds one normal per vertex.
+    /// The file is written under a temporary name and renamed into place, so
+    /// that concurrent readers only ever see a complete page file.
+    static bool write(const std::filesystem::path& _filename,
+                      const std::vector<vec3>& _positions,
+                      const std::vector<vec3>& _normals,
+                      const std::vector<std::array<int, 3>>& _triangles);
+
+    /// Find the closest intersection of \c _ray with the mesh.
+    /// \param[in] _ray the ray to intersect the mesh with
+    /// \param[out] _t ray parameter at the intersection point
+    /// \param[out] _triangle id of the intersected triangle
+    /// \param[out] _beta, _gamma barycentric coordinates of the hit (see intersect_triangle())
+    bool intersect(const Ray& _ray, double& _t, uint32_t& _triangle, double& _beta, double& _gamma) const;
+
+    /// Compute intersection point and normal for a hit returned by intersect().
+    /// \param[in] _phong interpolate vertex normals (true) or use the face normal (false)
+    void hit_attributes(const Ray& _ray, double _t, uint32_t _triangle, double _beta, double _gamma,
+                        bool _phong, vec3& _point, vec3& _normal) const;
+
+    /// number of triangles
+    size_t num_triangles() const { return num_triangles_; }
+
+    /// number of clusters
+    size_t num_clusters() const { return clusters_.size(); }
+
+    /// bytes that stay resident (the cluster directory and its hierarchy)
+    size_t memory_bytes() const
+    {
+        return sizeof(*this) + clusters_.size() * sizeof(Cluster) + nodes_.size() * sizeof(BvhNode);
+    }
+
+    /// bounding box of the mesh
+    const vec3& bb_min() const { return bb_min_; }
+    const vec3& bb_max() const { return bb_max_; }
+
+private:
+
+    /// directory entry of one cluster, as stored in the page file
+    struct Cluster
+    {
+        /// bounding box of the cluster
+        double bb_min[3], bb_max[3];
+        /// location of the cluster's page in the file
+        uint64_t offset;
+        /// number of vertices in the page
+        uint32_t num_vertices;
+        /// number of triangles in the page
+        uint32_t num_triangles;
+        /// number of nodes of the page's hierarchy
+        uint32_t num_nodes;
+    };
+
+    PagedMesh(PageCache& _cache, PageCache::File* _file, std::pmr::memory_resource* _resource)
+        : cache_(_cache), file_(_file), clusters_(_resource), nodes_(_resource) {}
+
+    /// fetch the page of cluster \c _c
+    std::shared_ptr<const PageCache::Page> page(uint32_t _c) const
+    {
+        const Cluster& c = clusters_[_c];
+        return cache_.fetch(*file_, _c, c.offset, c.num_vertices, c.num_triangles, c.num_nodes);
+    }
+
+private:
+
+    PageCache&       cache_;
+    PageCache::File* file_;
+
+    /// directory, in the leaf order of the hierarchy over the cluster boxes
+    std::pmr::vector<Cluster> clusters_;
+    /// hierarchy over the cluster boxes; its leaves refer to ranges of clusters_
+    std::pmr::vector<BvhNode> nodes_;
+    size_t num_triangles_ = 0;
+    vec3   bb_min_, bb_max_;
+};
@@ -0,0 +1,338 @@
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+#include "PartialImage.h"
+#include "Image.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+
+namespace {
+
+/// magic and version of partial image files
+const char MAGIC[4] = {'R', 'T', 'P', 'I'};
+constexpr uint32_t VERSION = 1;
+
+void write32le(std::ostream& _os, uint32_t _v)
+{
+    for (int i = 0; i < 4; ++i) _os.put(char((_v >> (8 * i)) & 0xFF));
+}
+
+void write32be(std::ostream& _os, uint32_t _v)
+{
+    for (int i = 3; i >= 0; --i) _os.put(char((_v >> (8 * i)) & 0xFF));
+}
+
+uint32_t read32le(std::istream& _is)
+{
+    unsigned char b[4] = {0, 0, 0, 0};
+    _is.read(reinterpret_cast<char*>(b), 4);
+    return uint32_t(b[0]) | uint32_t(b[1]) << 8 | uint32_t(b[2]) << 16 | uint32_t(b[3]) << 24;
+}
+
+/// CRC-32 as used by PNG chunks
+uint32_t crc32(const unsigned char* _data, size_t _n, uint32_t _crc = 0)
+{
+    static const auto table = []() {
+        std::vector<uint32_t> t(256);
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[n] = c;
+        }
+        return t;
+    }();
+
+    uint32_t c = ~_crc;
+    for (size_t i = 0; i < _n; ++i) c = table[(c ^ _data[i]) & 0xFF] ^ (c >> 8);
+    return ~c;
+}
+
+/// write a PNG chunk
+void write_chunk(std::ostream& _os, const char _type[4], const unsigned char* _data, size_t _n)
+{
+    write32be(_os, uint32_t(_n));
+    _os.write(_type, 4);
+    _os.write(reinterpret_cast<const char*>(_data), std::streamsize(_n));
+    uint32_t crc = crc32(reinterpret_cast<const unsigned char*>(_type), 4);
+    crc = crc32(_data, _n, crc);
+    write32be(_os, crc);
+}
+
+/// BMP rows are padded to multiples of 4 bytes
+size_t bmp_padding(unsigned int _width)
+{
+    return (4 - (size_t(_width) * 3) % 4) % 4;
+}
+
+} // namespace
+
+
+//-----------------------------------------------------------------------------
+
+
+void Canvas::read_bmp(const std::filesystem::path& _filename)
+{
+    std::ifstream file(_filename, std::fstream::binary);
+    if (!file) throw std::runtime_error("cannot open " + _filename.string());
+
+    unsigned char header[54];
+    file.read(reinterpret_cast<char*>(header), sizeof(header));
+    auto u32 = [&header](int _i) {
+        return uint32_t(header[_i]) | uint32_t(header[_i + 1]) << 8 | uint32_t(header[_i + 2]) << 16 | uint32_t(header[_i + 3]) << 24;
+    };
+    const uint32_t offset = u32(10);
+    const int32_t  h      = int32_t(u32(22));
+    if (!file || header[0] != 'B' || header[1] != 'M' || header[28] != 24 || header[29] != 0 || u32(30) != 0 || h <= 0)
+        throw std::runtime_error(_filename.string() + " is no uncompressed 24-bit BMP file");
+
+    *this = Canvas(u32(18), uint32_t(h));
+    file.seekg(offset);
+    const size_t row = size_t(width) * 3;
+    char padding[4];
+    for (unsigned int y = 0; y < height; ++y) {
+        file.read(reinterpret_cast<char*>(bgr.data() + y * row), std::streamsize(row));
+        file.read(padding, std::streamsize(bmp_padding(width)));
+    }
+    if (!file) throw std::runtime_error(_filename.string() + " is truncated");
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+bool Canvas::write_bmp(const std::filesystem::path& _filename) const
+{
+    std::ofstream file(_filename, std::fstream::binary);
+    if (!file || !Image::write_bmp_header(file, width, height)) {
+        std::cerr << "ERROR: Failed to open " << _filename.string() << " for writing." << std::endl;
+        return false;
+    }
+
+    const size_t row = size_t(width) * 3;
+    const char padding[4] = {0, 0, 0, 0};
+    for (unsigned int y = 0; y < height; ++y) {
+        file.write(reinterpret_cast<const char*>(bgr.data() + y * row), std::streamsize(row));
+        file.write(padding, std::streamsize(bmp_padding(width)));
+    }
+    file.close();
+    return bool(file);
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+bool Canvas::write_png(const std::filesystem::path& _filename) const
+{
+    std::ofstream file(_filename, std::fstream::binary);
+    if (!file) {
+        std::cerr << "ERROR: Failed to open " << _filename.string() << " for writing." << std::endl;
+        return false;
+    }
+
+    file.write("\x89PNG\r\n\x1a\n", 8);
+
+    // IHDR: 8-bit RGB, no interlacing
+    std::ostringstream ihdr(std::ios::binary);
+    write32be(ihdr, width);
+    write32be(ihdr, height);
+    ihdr.put(8); ihdr.put(2); ihdr.put(0); ihdr.put(0); ihdr.put(0);
+    const std::string h = ihdr.str();
+    write_chunk(file, "IHDR", reinterpret_cast<const unsigned char*>(h.data()), h.size());
+
+    // zlib stream of stored deflate blocks over the scanlines (top row
+    // first, each with filter type 0), split into IDAT chunks
+    constexpr size_t IDAT_SIZE = size_t(1) << 20, BLOCK_SIZE = 65535;
+    std::vector<unsigned char> idat = {0x78, 0x01}, block;
+    uint32_t a = 1, b = 0; // Adler-32 of the scanlines
+
+    auto emit = [&](bool _final) {
+        const uint16_t len = uint16_t(block.size());
+        idat.push_back(_final ? 1 : 0);
+        idat.push_back(uint8_t(len & 0xFF));  idat.push_back(uint8_t(len >> 8));
+        idat.push_back(uint8_t(~len & 0xFF)); idat.push_back(uint8_t((~len >> 8) & 0xFF));
+        idat.insert(idat.end(), block.begin(), block.end());
+        block.clear();
+        if (idat.size() >= IDAT_SIZE) {
+            write_chunk(file, "IDAT", idat.data(), idat.size());
+            idat.clear();
+        }
+    };
+
+    std::vector<unsigned char> line(size_t(width) * 3 + 1, 0);
+    for (unsigned int y = height; y-- > 0; ) {
+        const unsigned char* src = bgr.data() + size_t(y) * width * 3;
+        for (size_t x = 0; x < width; ++x) {
+            line[1 + 3 * x + 0] = src[3 * x + 2];
+            line[1 + 3 * x + 1] = src[3 * x + 1];
+            line[1 + 3 * x + 2] = src[3 * x + 0];
+        }
+        for (unsigned char c: line) {
+            a = (a + c) % 65521;
+            b = (b + a) % 65521;
+            block.push_back(c);
+            if (block.size() == BLOCK_SIZE) emit(false);
+        }
+    }
+    emit(true);
+
+    const uint32_t adler = (b << 16) | a;
+    for (int i = 3; i >= 0; --i) idat.push_back(uint8_t((adler >> (8 * i)) & 0xFF));
+    write_chunk(file, "IDAT", idat.data(), idat.size());
+
+    write_chunk(file, "IEND", nullptr, 0);
+    return bool(file);
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void PartialImage::add(const Tile& _tile, const std::vector<vec3>& _pixels)
+{
+    tiles_.push_back(_tile);
+    bgr_.reserve(bgr_.size() + _tile.size() * 3);
+    for (const vec3& color: _pixels) {
+        bgr_.push_back(Image::to_byte(color[2]));
+        bgr_.push_back(Image::to_byte(color[1]));
+        bgr_.push_back(Image::to_byte(color[0]));
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void PartialImage::paste(Canvas& _canvas) const
+{
+    const unsigned char* src = bgr_.data();
+    for (const Tile& t: tiles_) {
+        const size_t row = size_t(t.width) * 3;
+        for (unsigned int y = 0; y < t.height; ++y, src += row)
+            std::copy(src, src + row, _canvas.bgr.begin() + (size_t(t.y0 + y) * _canvas.width + t.x0) * 3);
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+bool PartialImage::write(const std::filesystem::path& _filename) const
+{
+    std::ofstream file(_filename, std::fstream::binary);
+    if (!file) {
+        std::cerr << "ERROR: Failed to open " << _filename.string() << " for writing." << std::endl;
+        return false;
+    }
+
+    file.write(MAGIC, 4);
+    write32le(file, VERSION);
+    write32le(file, width_);
+    write32le(file, height_);
+    write32le(file, uint32_t(tiles_.size()));
+
+    const unsigned char* src = bgr_.data();
+    for (const Tile& t: tiles_) {
+        write32le(file, t.x0);
+        write32le(file, t.y0);
+        write32le(file, t.width);
+        write32le(file, t.height);
+        file.write(reinterpret_cast<const char*>(src), std::streamsize(t.size() * 3));
+        src += t.size() * 3;
+    }
+    return bool(file);
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void PartialImage::read(const std::filesystem::path& _filename)
+{
+    std::ifstream file(_filename, std::fstream::binary);
+    if (!file) throw std::runtime_error("cannot open " + _filename.string());
+
+    char magic[4] = {0, 0, 0, 0};
+    file.read(magic, 4);
+    if (!std::equal(magic, magic + 4, MAGIC) || read32le(file) != VERSION)
+        throw std::runtime_error(_filename.string() + " is no partial image");
+
+    width_  = read32le(file);
+    height_ = read32le(file);
+    const uint32_t count = read32le(file);
+    tiles_.clear();
+    bgr_.clear();
+    for (uint32_t i = 0; i < count && file; ++i) {
+        Tile t;
+        t.x0     = read32le(file);
+        t.y0     = read32le(file);
+        t.width  = read32le(file);
+        t.height = read32le(file);
+        if (t.x0 > width_ || t.width > width_ - t.x0 || t.y0 > height_ || t.height > height_ - t.y0)
+            throw std::runtime_error(_filename.string() + ": tile outside of the image");
+
+        const size_t offset = bgr_.size();
+        bgr_.resize(offset + t.size() * 3);
+        file.read(reinterpret_cast<char*>(bgr_.data() + offset), std::streamsize(t.size() * 3));
+        tiles_.push_back(t);
+    }
+    if (!file) throw std::runtime_error(_filename.string() + " is truncated");
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+bool parse_region(const std::string& _spec, Tile& _tile)
+{
+    std::istringstream is(_spec);
+    char c1 = 0, c2 = 0, c3 = 0;
+    long long v[4] = {-1, -1, -1, -1};
+    if (!(is >> v[0] >> c1 >> v[1] >> c2 >> v[2] >> c3 >> v[3]) || c1 != ',' || c2 != ',' || c3 != ',')
+        return false;
+    if (!(is >> std::ws).eof()) return false;
+    for (long long x: v) if (x < 0 || x > 0xFFFFFFFFll) return false;
+    _tile = Tile{unsigned(v[0]), unsigned(v[1]), unsigned(v[2]), unsigned(v[3])};
+    return _tile.width > 0 && _tile.height > 0;
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+bool parse_tile_list(const std::string& _spec, std::vector<unsigned int>& _indices)
+{
+    std::istringstream is(_spec);
+    std::string item;
+    while (std::getline(is, item, ',')) {
+        const size_t dash = item.find('-');
+        try {
+            size_t end;
+            const unsigned long first = std::stoul(item.substr(0, dash), &end);
+            if (end != item.substr(0, dash).size()) return false;
+            unsigned long last = first;
+            if (dash != std::string::npos) {
+                last = std::stoul(item.substr(dash + 1), &end);
+                if (end != item.size() - dash - 1) return false;
+            }
+            if (last < first || last > 0xFFFFFFFFul) return false;
+            for (unsigned long i = first; i <= last; ++i) _indices.push_back(unsigned(i));
+        }
+        catch (const std::logic_error&) {
+            return false;
+        }
+    }
+    return !_indices.empty();
+}
@@ -0,0 +1,97 @@
+#pragma once
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+#include "Tile.h"
+#include "vec3.h"
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+
+/// \class Canvas PartialImage.h
+/// An image of 8-bit colors, stored like the pixel data of a BMP file
+/// (BGR, bottom row first, rows without padding). Used to assemble
+/// partial images without converting their colors again.
+struct Canvas
+{
+    unsigned int width = 0, height = 0;
+    std::vector<unsigned char> bgr;
+
+    /// Construct a black canvas of \c _width x \c _height pixels
+    Canvas(unsigned int _width = 0, unsigned int _height = 0)
+        : width(_width), height(_height), bgr(size_t(_width) * _height * 3, 0) {}
+
+    /// Read an uncompressed 24-bit BMP file (as written by Image::write_bmp()).
+    /// Throws std::runtime_error if the file cannot be read.
+    void read_bmp(const std::filesystem::path& _filename);
+
+    /// Write the canvas as BMP file
+    bool write_bmp(const std::filesystem::path& _filename) const;
+
+    /// Write the canvas as PNG file (with uncompressed deflate blocks)
+    bool write_png(const std::filesystem::path& _filename) const;
+};
+
+
+/// \class PartialImage PartialImage.h
+/// Some tiles of an image together with their placement in it, as rendered by
+/// `raytrace --region` or `raytrace --tiles` and assembled by `merge_tiles`.
+/// The colors are quantized to 8 bits like in Image::write_bmp(), so a merged
+/// image is identical to one rendered at once.
+///
+/// File format (little endian): the magic "RTPI", the version (1), the width
+/// and height of the whole image and the number of tiles as 32-bit integers,
+/// then per tile x0, y0, width and height (32 bits each) followed by its
+/// pixels as BGR bytes, bottom row first.
+class PartialImage
+{
+public:
+
+    /// Construct an empty part of an image of \c _width x \c _height pixels
+    PartialImage(unsigned int _width = 0, unsigned int _height = 0)
+        : width_(_width), height_(_height) {}
+
+    /// width of the whole image
+    unsigned int width() const { return width_; }
+
+    /// height of the whole image
+    unsigned int height() const { return height_; }
+
+    /// the tiles of the image that are stored
+    const std::vector<Tile>& tiles() const { return tiles_; }
+
+    /// Add tile \c _tile with the colors \c _pixels, row by row (see Scene::renderTile())
+    void add(const Tile& _tile, const std::vector<vec3>& _pixels);
+
+    /// Copy the stored tiles into \c _canvas, which must have the size of the whole image
+    void paste(Canvas& _canvas) const;
+
+    /// Write the tiles to \c _filename
+    bool write(const std::filesystem::path& _filename) const;
+
+    /// Read tiles from \c _filename. Throws std::runtime_error if the file is invalid.
+    void read(const std::filesystem::path& _filename);
+
+private:
+
+    unsigned int width_, height_;
+    std::vector<Tile> tiles_;
+    /// BGR bytes of all tiles, one after another
+    std::vector<unsigned char> bgr_;
+};
+
+
+/// Parse a pixel rectangle "X0,Y0,WIDTH,HEIGHT" into \c _tile. Returns false if it is malformed.
+bool parse_region(const std::string& _spec, Tile& _tile);
+
+/// Parse a list of tile indices and ranges like "0-3,7,12-15". Returns false if it is malformed.
+bool parse_tile_list(const std::string& _spec, std::vector<unsigned int>& _indices);
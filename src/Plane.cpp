@@ -28,35 +28,52 @@ Plane::Plane(const vec3& _center, const vec3& _normal)
 //-----------------------------------------------------------------------------
 
 
-bool
+void
 Plane::
-intersect(const Ray& _ray,
-          vec3&      _intersection_point,
-          vec3&      _intersection_normal,
-          double&    _intersection_t ) const
+intersect(const RayBatch& _batch, int _id) const
 {
+    const double nx = normal[0], ny = normal[1], nz = normal[2];
+    const double cx = center[0], cy = center[1], cz = center[2];
+
+    const double *ox = _batch.ox, *oy = _batch.oy, *oz = _batch.oz;
+    const double *dx = _batch.dx, *dy = _batch.dy, *dz = _batch.dz;
+    double *tmin   = _batch.t;
+    int    *object = _batch.object;
+    int    *prim   = _batch.prim;
+    const int n    = _batch.size;
+
+#if HAVE_OPENMP
+#  pragma omp simd
+#endif
+    for (int i = 0; i < n; ++i)
+    {
+        //compute the intersection of the plane with the ray
+        const double denom = nx*dx[i] + ny*dy[i] + nz*dz[i];
+        const double t = -(nx*(ox[i] - cx) + ny*(oy[i] - cy) + nz*(oz[i] - cz)) / denom;
+
+        //skip rays parallel to the plane and intersections behind the origin,
+        //replace the closest hit by selections (not branches), so that the loop vectorizes
+        const double t_hit = tmin[i];
+        const int    o_hit = object[i], p_hit = prim[i];
+        const bool   closer = (fabs(denom) >= 0.000000001) & (t > 0) & (t < t_hit);
+        tmin[i]   = closer ? t   : t_hit;
+        object[i] = closer ? _id : o_hit;
+        prim[i]   = closer ? 0   : p_hit;
+    }
+}
 
-        const vec3 &dir = _ray.direction;
-        const vec3   oc = _ray.origin - center;
-
-        //compute the intersection of the plane with `_ray`
-        double denom = dot(normal, dir);
-
-        //check if ray is parallel to plane
-        if (fabs(denom) < 0.000000001) return false;
-
-        double t = -dot(normal,oc) / denom;
 
-        //check if ray intersects plane behind origin
-        if (t <= 0) return false;
+//-----------------------------------------------------------------------------
 
-        _intersection_t      = t;
-        _intersection_point  = _ray.origin + t * dir;
 
-        //normal at intersection point is simply plane's normal
-        _intersection_normal = normal;
+void
+Plane::
+hit_attributes(const Ray& _ray, const HitRecord& _hit, vec3& _point, vec3& _normal) const
+{
+    _point  = _ray.origin + _hit.t * _ray.direction;
 
-        return true;
+    //normal at intersection point is simply plane's normal
+    _normal = normal;
 }
 
 
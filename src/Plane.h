@@ -25,17 +25,17 @@ public:
     /// Construct a plane with parameters parsed from an input stream.
     Plane(std::istream &is) { parse(is); }
 
-    /// Compute the intersection of the plane with \c _ray. Return whether
-    /// there is an intersection. If there is one, return the intersection data.
-    /// This function overrides Object::intersect().
-    /// \param[in] _ray the ray to intersect the plane with
-    /// \param[out] _intersection_point position of the intersection
-    /// \param[out] _intersection_normal normal vector at the intersection point
-    /// \param[out] _intersection_t ray parameter at the intesection point
-    virtual bool intersect(const Ray&  _ray,
-                           vec3&       _intersection_point,
-                           vec3&       _intersection_normal,
-                           double&     _intersection_t) const override;
+    /// Intersect the plane with all rays of \c _batch (vectorized over the
+    /// rays). This function overrides Object::intersect(const RayBatch&, int).
+    virtual void intersect(const RayBatch& _batch, int _id) const override;
+
+    /// Compute the point and normal of \c _hit, the closest hit of \c _ray.
+    /// This function overrides Object::hit_attributes().
+    virtual void hit_attributes(const Ray& _ray, const HitRecord& _hit,
+                                vec3& _point, vec3& _normal) const override;
+
+    /// single-ray intersection, see Object::intersect(const Ray&, vec3&, vec3&, double&)
+    using Object::intersect;
 
     /// parse plane from an input stream
     virtual void parse(std::istream &is) override {
@@ -43,6 +43,9 @@ public:
     }
 
 private:
+    /// the compiled scene flattens the object's geometry
+    friend class CompiledScene;
+
     /// one (arbitrary) point on the plane
     vec3 center;
     /// normal vector of the plane
@@ -14,7 +14,8 @@
 /// \class Ray Ray.h
 /// This class implements a ray, specified by its origin and direction.
 /// It provides a convenient function to compute the point ray(t) at a specific
-/// ray paramter t.
+/// ray paramter t. The reciprocal direction and its signs are precomputed
+/// for the slab tests against bounding boxes.
 class Ray
 {
 public:
@@ -25,6 +26,17 @@ public:
     {
         origin    = _origin;
         direction = normalize(_direction); // normalize direction
+        precompute();
+    }
+
+    /// Update \c inv_direction and \c sign after \c direction was assigned directly.
+    void precompute()
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            inv_direction[i] = 1.0 / direction[i];
+            sign[i]          = inv_direction[i] < 0;
+        }
     }
 
     /// Compute the point on the ray at the parameter \c _t, which is
@@ -41,6 +53,11 @@ public:
     vec3 origin;
     /// direction of the ray (should be normalized)
     vec3 direction;
+    /// component-wise reciprocal of the direction (infinite for zero components)
+    vec3 inv_direction;
+    /// per axis 1 if the direction is negative (including -0), else 0: the
+    /// index of the box side (0: min, 1: max) at which the ray enters the slab
+    int sign[3];
 };
 
 
@@ -48,5 +65,6 @@ public:
 inline std::istream& operator>>(std::istream& is, Ray& r)
 {
     is >> r.origin >> r.direction;
+    r.precompute();
     return is;
 }
@@ -0,0 +1,547 @@
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+//== INCLUDES =================================================================
+
+#include "RenderServer.h"
+#include "Scene.h"
+#include "StopWatch.h"
+
+#include <atomic>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#ifndef _WIN32
+#  include <poll.h>
+#  include <signal.h>
+#  include <sys/socket.h>
+#  include <sys/un.h>
+#  include <unistd.h>
+#endif
+
+
+//== IMPLEMENTATION ===========================================================
+
+#ifndef _WIN32
+
+namespace {
+
+/// read one '\n'-terminated line, false on end of stream
+bool read_line(int _fd, std::string& _line)
+{
+    _line.clear();
+    char c;
+    for (;;)
+    {
+        ssize_t n = ::recv(_fd, &c, 1, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return !_line.empty();
+        if (c == '\n') return true;
+        if (c != '\r') _line += c;
+    }
+}
+
+bool write_all(int _fd, const std::string& _data)
+{
+    const char* p = _data.data();
+    size_t size = _data.size();
+    while (size > 0)
+    {
+        ssize_t n = ::send(_fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p    += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+/// parse "x,y,z"
+vec3 parse_vec3(const std::string& _value)
+{
+    vec3 v;
+    char comma1, comma2;
+    std::istringstream is(_value);
+    if (!(is >> v[0] >> comma1 >> v[1] >> comma2 >> v[2]) || comma1 != ',' || comma2 != ',')
+        throw std::runtime_error("invalid vector " + _value);
+    return v;
+}
+
+sockaddr_un socket_address(const std::filesystem::path& _socket)
+{
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    const std::string path = _socket.string();
+    if (path.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error("Socket path too long: " + path);
+    std::strcpy(addr.sun_path, path.c_str());
+    return addr;
+}
+
+} // namespace
+
+
+//-----------------------------------------------------------------------------
+
+
+RenderServer::RenderServer(const RenderSettings& _settings)
+    : settings_(_settings)
+{
+    signal(SIGPIPE, SIG_IGN);
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+RenderServer::~RenderServer() = default;
+
+
+//-----------------------------------------------------------------------------
+
+
+void RenderServer::serve(const std::filesystem::path& _socket)
+{
+    const sockaddr_un addr = socket_address(_socket);
+    int server = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server < 0)
+        throw std::runtime_error("socket() failed: " + std::string(strerror(errno)));
+
+    // remove a stale socket of a previous server, but nothing else
+    std::error_code ec;
+    if (std::filesystem::is_socket(_socket, ec))
+        std::filesystem::remove(_socket, ec);
+    else if (std::filesystem::exists(_socket, ec))
+    {
+        close(server);
+        throw std::runtime_error("Cannot listen on " + _socket.string() + ": file exists and is not a socket");
+    }
+    if (bind(server, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 || listen(server, 16) != 0)
+    {
+        close(server);
+        throw std::runtime_error("Cannot listen on " + _socket.string() + ": " + strerror(errno));
+    }
+    std::cout << "Render server listening on " << _socket.string() << std::endl;
+
+    // a thread per client, with a flag it sets when the client is gone.
+    // Sockets are closed here after the join, so that the descriptor of a
+    // client is never reused while shutdown() below may still refer to it.
+    struct Client
+    {
+        int               fd = -1;
+        std::thread       thread;
+        std::atomic<bool> done{false};
+    };
+    std::thread renderer(&RenderServer::render_loop, this);
+    std::list<Client> clients;
+
+    for (;;)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (shutdown_) break;
+        }
+
+        // join the threads of clients that disconnected
+        for (auto it = clients.begin(); it != clients.end(); )
+        {
+            if (it->done) { it->thread.join(); close(it->fd); it = clients.erase(it); }
+            else ++it;
+        }
+
+        // wake up regularly to notice a shutdown request
+        pollfd pfd{server, POLLIN, 0};
+        if (poll(&pfd, 1, 200) <= 0) continue;
+
+        int fd = accept4(server, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) continue;
+        Client& client = clients.emplace_back();
+        client.fd = fd;
+        client.thread = std::thread([this, fd, &client]() {
+            handle_client(fd);
+            client.done = true;
+        });
+    }
+
+    // wake up clients waiting for their next request; answers still go out
+    renderer.join();
+    for (Client& client: clients)
+    {
+        ::shutdown(client.fd, SHUT_RD);
+        client.thread.join();
+        close(client.fd);
+    }
+    close(server);
+    if (std::filesystem::is_socket(_socket, ec))
+        std::filesystem::remove(_socket, ec);
+    std::cout << "Render server stopped" << std::endl;
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void RenderServer::handle_client(int _fd)
+{
+    std::string line;
+    while (read_line(_fd, line))
+    {
+        std::vector<std::string> words;
+        // words may be quoted (see std::quoted()), e.g. paths with spaces
+        std::istringstream is(line);
+        for (std::string word; is >> std::quoted(word); ) words.push_back(word);
+        if (words.empty()) continue;
+
+        Response response;
+        if (words[0] == "shutdown")
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            shutdown_ = true;
+            queued_.notify_all();
+            response.line = "ok";
+        }
+        else
+        {
+            auto request = std::make_unique<Request>();
+            request->words = words;
+            try
+            {
+                for (const std::string& word: words)
+                    if (word.compare(0, 9, "priority=") == 0)
+                        request->priority = std::stoi(word.substr(9));
+            }
+            catch (const std::logic_error&)
+            {
+                write_all(_fd, "error invalid priority\n");
+                continue;
+            }
+
+            std::future<Response> answer = request->response.get_future();
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (shutdown_)
+                {
+                    write_all(_fd, "error server is shutting down\n");
+                    break;
+                }
+                request->sequence = next_sequence_++;
+                queue_.push(std::move(request));
+            }
+            queued_.notify_one();
+            response = answer.get();
+        }
+
+        if (!write_all(_fd, response.line + "\n") || !write_all(_fd, response.payload))
+            break;
+        if (words[0] == "shutdown")
+            break;
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void RenderServer::render_loop()
+{
+    for (;;)
+    {
+        std::unique_ptr<Request> request;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            queued_.wait(lock, [this]{ return shutdown_ || !queue_.empty(); });
+            // finish the queued requests before shutting down
+            if (queue_.empty()) return;
+            // std::priority_queue::top() is const, but we own the element
+            request = std::move(const_cast<std::unique_ptr<Request>&>(queue_.top()));
+            queue_.pop();
+        }
+
+        Response response;
+        try
+        {
+            response = execute(request->words);
+        }
+        catch (const std::exception& e)
+        {
+            response.line = std::string("error ") + e.what();
+            response.payload.clear();
+        }
+        request->response.set_value(std::move(response));
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+RenderServer::Response RenderServer::execute(const std::vector<std::string>& _words)
+{
+    Response response;
+    const std::string& command = _words[0];
+
+    if (command == "stats")
+    {
+        size_t total = 0;
+        std::ostringstream os;
+        for (const auto& [path, resident]: scenes_) total += resident.bytes;
+        os << "ok " << scenes_.size() << " scenes, " << total / (1024.0*1024.0) << " MB";
+        for (const auto& [path, resident]: scenes_)
+            os << "; " << path << " " << resident.bytes / (1024.0*1024.0) << " MB";
+        response.line = os.str();
+        return response;
+    }
+
+    if ((command != "render" && command != "load") || _words.size() < 2)
+        throw std::runtime_error("unknown request " + command);
+
+    double load_ms = 0;
+    Resident& resident = acquire(_words[1], load_ms);
+
+    if (command == "load")
+    {
+        std::ostringstream os;
+        os << "ok loaded in " << load_ms << " ms";
+        response.line = os.str();
+        return response;
+    }
+
+    // camera overrides
+    Camera camera = resident.camera;
+    std::filesystem::path output;
+    for (size_t i=2; i<_words.size(); ++i)
+    {
+        const std::string& word = _words[i];
+        const size_t eq = word.find('=');
+        if (eq == std::string::npos) throw std::runtime_error("invalid argument " + word);
+        const std::string key = word.substr(0, eq), value = word.substr(eq + 1);
+        try
+        {
+            if      (key == "output")   output        = value;
+            else if (key == "width")    camera.width  = unsigned(std::stoul(value));
+            else if (key == "height")   camera.height = unsigned(std::stoul(value));
+            else if (key == "eye")      camera.eye    = parse_vec3(value);
+            else if (key == "center")   camera.center = parse_vec3(value);
+            else if (key == "up")       camera.up     = parse_vec3(value);
+            else if (key == "fovy")     camera.fovy   = std::stod(value);
+            else if (key != "priority") throw std::runtime_error("unknown argument " + key);
+        }
+        catch (const std::logic_error&)
+        {
+            throw std::runtime_error("invalid value " + word);
+        }
+    }
+    if (camera.width == 0 || camera.height == 0)
+        throw std::runtime_error("invalid resolution");
+    camera.init();
+
+    StopWatch timer;
+    timer.start();
+    resident.scene->setCamera(camera);
+    Image image = resident.scene->render();
+    timer.stop();
+    std::cout << std::endl;
+
+    std::ostringstream os;
+    if (output.empty())
+    {
+        std::ostringstream bmp(std::ios::binary);
+        image.write_bmp(bmp);
+        response.payload = bmp.str();
+        os << "ok image " << response.payload.size();
+    }
+    else
+    {
+        if (!image.write_bmp(output))
+            throw std::runtime_error("cannot write " + output.string());
+        os << "ok " << output.string();
+    }
+    os << " (load " << load_ms << " ms, render " << timer.elapsed() << " ms)";
+    response.line = os.str();
+    return response;
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+RenderServer::Resident& RenderServer::acquire(const std::string& _scene, double& _load_ms)
+{
+    const std::string key = std::filesystem::weakly_canonical(_scene).string();
+
+    Resident& resident = scenes_[key];
+    resident.last_use = ++use_counter_;
+
+    // apply changes of the scene file incrementally, if possible
+    if (resident.scene && resident.scene->outdated())
+    {
+        StopWatch timer;
+        timer.start();
+        SceneUpdate update;
+        bool updated = false;
+        try
+        {
+            updated = resident.scene->update(update);
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << "Cannot update scene " << key << ": " << e.what() << std::endl;
+        }
+        timer.stop();
+
+        if (updated)
+        {
+            _load_ms = timer.elapsed();
+            if (update.settings) resident.camera = resident.scene->getCamera();
+            resident.bytes = resident.scene->memory_bytes();
+            std::cout << "Updated scene " << key << " (" << update << ") in " << timer << std::endl;
+            evict(key);
+        }
+        else
+        {
+            resident.scene.reset();
+        }
+    }
+
+    if (!resident.scene)
+    {
+        std::cout << "Read scene " << key << "..." << std::flush;
+        StopWatch timer;
+        timer.start();
+        try
+        {
+            resident.scene = std::make_unique<Scene>(key, settings_);
+        }
+        catch (...)
+        {
+            scenes_.erase(key);
+            throw;
+        }
+        timer.stop();
+        _load_ms = timer.elapsed();
+
+        resident.camera = resident.scene->getCamera();
+        resident.bytes  = resident.scene->memory_bytes();
+        std::cout << "\ndone (" << resident.bytes / (1024.0*1024.0) << " MB)" << std::endl;
+
+        evict(key);
+    }
+
+    return resident;
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void RenderServer::evict(const std::string& _keep)
+{
+    const size_t budget = size_t(settings_.server_memory_mb * 1024.0 * 1024.0);
+    if (budget == 0) return;
+
+    for (;;)
+    {
+        size_t total = 0;
+        auto coldest = scenes_.end();
+        for (auto it = scenes_.begin(); it != scenes_.end(); ++it)
+        {
+            total += it->second.bytes;
+            if (it->first != _keep && (coldest == scenes_.end() || it->second.last_use < coldest->second.last_use))
+                coldest = it;
+        }
+        if (total <= budget || coldest == scenes_.end()) return;
+
+        std::cout << "Evict scene " << coldest->first << std::endl;
+        scenes_.erase(coldest);
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+std::string RenderServer::request(const std::filesystem::path& _socket,
+                                  const std::string& _request,
+                                  std::string& _payload)
+{
+    signal(SIGPIPE, SIG_IGN);
+
+    // requests are lines, quoting does not help here
+    if (_request.find_first_of("\r\n") != std::string::npos)
+        throw std::runtime_error("Render server requests cannot contain line breaks");
+
+    const sockaddr_un addr = socket_address(_socket);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0)
+    {
+        if (fd >= 0) close(fd);
+        throw std::runtime_error("Cannot connect to render server " + _socket.string());
+    }
+
+    std::string answer;
+    if (!write_all(fd, _request + "\n") || !read_line(fd, answer))
+    {
+        close(fd);
+        throw std::runtime_error("Render server closed the connection");
+    }
+
+    _payload.clear();
+    if (answer.compare(0, 9, "ok image ") == 0)
+    {
+        _payload.resize(std::stoul(answer.substr(9)));
+        size_t received = 0;
+        while (received < _payload.size())
+        {
+            ssize_t n = ::recv(fd, &_payload[received], _payload.size() - received, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            received += size_t(n);
+        }
+        _payload.resize(received);
+    }
+
+    close(fd);
+    return answer;
+}
+
+
+//-----------------------------------------------------------------------------
+
+#else // _WIN32
+
+RenderServer::RenderServer(const RenderSettings& _settings)
+    : settings_(_settings)
+{
+    throw std::runtime_error("The render server is not supported on Windows");
+}
+
+RenderServer::~RenderServer() = default;
+
+void RenderServer::serve(const std::filesystem::path&) {}
+
+std::string RenderServer::request(const std::filesystem::path&, const std::string&, std::string&)
+{
+    throw std::runtime_error("The render server is not supported on Windows");
+}
+
+void RenderServer::handle_client(int) {}
+void RenderServer::render_loop() {}
+RenderServer::Response RenderServer::execute(const std::vector<std::string>&) { return Response(); }
+RenderServer::Resident& RenderServer::acquire(const std::string& _scene, double&) { return scenes_[_scene]; }
+void RenderServer::evict(const std::string&) {}
+
+#endif
+
+//=============================================================================
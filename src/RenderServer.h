@@ -0,0 +1,128 @@
+#pragma once
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+#include "Camera.h"
+#include "RenderSettings.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <vector>
+
+class Scene;
+
+
+/// \class RenderServer RenderServer.h
+/// A render daemon that keeps parsed and compiled scenes resident, so that
+/// repeated renders skip process start-up and scene loading.
+///
+/// Clients connect to a Unix domain socket and send one request per line:
+///
+///     render SCENE [output=PATH] [width=W] [height=H] [eye=X,Y,Z]
+///            [center=X,Y,Z] [up=X,Y,Z] [fovy=DEG] [priority=P]
+///     load SCENE [priority=P]
+///     stats
+///
+/// Words that contain spaces or quotes are quoted like std::quoted() writes
+/// them, e.g. `render "/my scenes/a.sce" "output=/my images/a.bmp"`.
+/// Every request is answered with one line starting with `ok` or `error`.
+/// A render without `output` is answered with `ok image N` followed by the
+/// N bytes of a BMP file. Requests are rendered one after another, highest
+/// priority first. Scenes are updated (see Scene::update()) when their files
+/// changed, and the least recently used scenes are evicted when the resident
+/// scenes exceed RenderSettings::server_memory_mb. Only available on POSIX
+/// systems.
+class RenderServer
+{
+public:
+
+    /// Construct a server that loads scenes with \c _settings.
+    explicit RenderServer(const RenderSettings& _settings);
+    ~RenderServer();
+
+    /// Accept clients on the Unix domain socket \c _socket until a client
+    /// sends `shutdown`.
+    void serve(const std::filesystem::path& _socket);
+
+    /// Send the request line \c _request to the server listening on \c _socket.
+    /// Returns the answer line; the payload of `ok image` answers is
+    /// stored in \c _payload.
+    static std::string request(const std::filesystem::path& _socket,
+                               const std::string& _request,
+                               std::string& _payload);
+
+private:
+
+    /// answer to a request
+    struct Response
+    {
+        std::string line;
+        std::string payload;
+    };
+
+    /// a parsed request waiting in the queue
+    struct Request
+    {
+        int priority = 0;
+        uint64_t sequence = 0;
+        std::vector<std::string> words;
+        std::promise<Response> response;
+    };
+
+    /// order of the queue: highest priority first, then first come first served
+    struct Later
+    {
+        bool operator()(const std::unique_ptr<Request>& _a, const std::unique_ptr<Request>& _b) const
+        {
+            if (_a->priority != _b->priority) return _a->priority < _b->priority;
+            return _a->sequence > _b->sequence;
+        }
+    };
+
+    /// a resident scene
+    struct Resident
+    {
+        std::unique_ptr<Scene> scene;
+        /// camera as given in the scene file
+        Camera camera;
+        /// memory held by the scene
+        size_t bytes = 0;
+        /// value of use_counter_ at the last use
+        uint64_t last_use = 0;
+    };
+
+    /// answer the requests of the client on socket \c _fd, which the caller closes
+    void handle_client(int _fd);
+    void render_loop();
+    Response execute(const std::vector<std::string>& _words);
+    Resident& acquire(const std::string& _scene, double& _load_ms);
+    void evict(const std::string& _keep);
+
+private:
+
+    RenderSettings settings_;
+
+    std::mutex              mutex_;
+    std::condition_variable queued_;
+    std::priority_queue<std::unique_ptr<Request>, std::vector<std::unique_ptr<Request>>, Later> queue_;
+    uint64_t                next_sequence_ = 0;
+    bool                    shutdown_ = false;
+
+    // only touched by the render thread
+    std::map<std::string, Resident> scenes_;
+    uint64_t use_counter_ = 0;
+};
@@ -0,0 +1,223 @@
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+//== INCLUDES =================================================================
+
+#include "RenderSettings.h"
+#include "PartialImage.h"
+
+#include <sstream>
+#include <stdexcept>
+
+
+//== IMPLEMENTATION ===========================================================
+
+
+bool RenderSettings::parse_option(const std::vector<std::string>& _args, size_t& _i)
+{
+    const std::string& arg = _args[_i];
+    const bool hasValue = _i + 1 < _args.size();
+
+    // options that change the image are remembered for the workers
+    auto forward = [&](int _count) {
+        forwarded.insert(forwarded.end(), _args.begin() + _i, _args.begin() + _i + _count);
+    };
+
+    try {
+        if (arg == "--compress-meshes") {
+            forward(1);
+            compress_meshes = true;
+        }
+        else if (arg == "--page-meshes" && hasValue) {
+            forward(2);
+            page_budget_mb = std::stod(_args[++_i]);
+        }
+        else if (arg == "--bvh" && hasValue) {
+            const std::string& method = _args[_i + 1];
+            if      (method == "sah")  bvh = BvhMethod::SAH;
+            else if (method == "lbvh") bvh = BvhMethod::LBVH;
+            else return false;
+            forward(2);
+            ++_i;
+        }
+        else if (arg == "--accel" && hasValue) {
+            std::istringstream is(_args[_i + 1]);
+            if (!(is >> accelerator)) return false;
+            forward(2);
+            ++_i;
+        }
+        else if (arg == "--lazy-bvh") {
+            forward(1);
+            lazy_bvh = true;
+        }
+        else if (arg == "--no-culling") {
+            frustum_culling = false;
+        }
+        else if (arg == "--rasterize") {
+            forward(1);
+            rasterize = true;
+        }
+        else if (arg == "--min-weight" && hasValue) {
+            forward(2);
+            min_weight = std::stod(_args[++_i]);
+        }
+        else if (arg == "--roulette") {
+            forward(1);
+            roulette = true;
+        }
+        else if (arg == "--preview" && hasValue) {
+            preview = unsigned(std::stoul(_args[++_i]));
+        }
+        else if (arg == "--framebuffer" && hasValue) {
+            const std::string& format = _args[_i + 1];
+            if      (format == "double") framebuffer = PixelFormat::Double;
+            else if (format == "float")  framebuffer = PixelFormat::Float;
+            else if (format == "half")   framebuffer = PixelFormat::Half;
+            else return false;
+            ++_i;
+        }
+        else if (arg == "--stream-bands" && hasValue) {
+            band_rows = unsigned(std::stoul(_args[++_i]));
+        }
+        else if (arg == "--balance") {
+            balance = true;
+        }
+        else if (arg == "--numa") {
+            numa = true;
+        }
+        else if (arg == "--numa-replicate") {
+            numa = numa_replicate = true;
+        }
+        else if (arg == "--checkpoint" && hasValue) {
+            checkpoint = _args[++_i];
+        }
+        else if (arg == "--checkpoint-interval" && hasValue) {
+            checkpoint_interval = std::stod(_args[++_i]);
+        }
+        else if (arg == "--region" && hasValue) {
+            if (!parse_region(_args[++_i], region)) return false;
+        }
+        else if (arg == "--tiles" && hasValue) {
+            if (!parse_tile_list(_args[++_i], tile_list)) return false;
+        }
+        else if (arg == "--workers" && hasValue) {
+            num_workers = std::stoi(_args[++_i]);
+        }
+        else if (arg == "--connect" && hasValue) {
+            worker_addresses.push_back(_args[++_i]);
+        }
+        else if (arg == "--worker-listen" && hasValue) {
+            // [ADDR:]PORT, the port follows the last colon (as in [::1]:PORT)
+            const std::string& value = _args[++_i];
+            const size_t colon = value.rfind(':');
+            worker_listen_address = (colon == std::string::npos) ? "" : value.substr(0, colon);
+            worker_port = std::stoi(value.substr(colon == std::string::npos ? 0 : colon + 1));
+        }
+        else if (arg == "--worker-fd" && hasValue) {
+            worker_fd = std::stoi(_args[++_i]);
+        }
+        else if (arg == "--tile-size" && hasValue) {
+            tile_size = unsigned(std::stoul(_args[++_i]));
+        }
+        else if (arg == "--tile-timeout" && hasValue) {
+            tile_timeout = std::stod(_args[++_i]);
+        }
+        else if (arg == "--serve" && hasValue) {
+            server_socket = _args[++_i];
+        }
+        else if (arg == "--server-memory" && hasValue) {
+            server_memory_mb = std::stod(_args[++_i]);
+        }
+        else if (arg == "--request" && hasValue) {
+            request_socket = _args[++_i];
+        }
+        else if (arg == "--priority" && hasValue) {
+            priority = std::stoi(_args[++_i]);
+        }
+        else if (arg == "--watch") {
+            watch = true;
+        }
+        else {
+            return false;
+        }
+    }
+    catch (const std::logic_error&) {
+        // std::stod & co. failed to convert the value
+        return false;
+    }
+
+    return true;
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+std::vector<Tile> RenderSettings::partial_tiles(unsigned int _width, unsigned int _height) const
+{
+    std::vector<Tile> tiles;
+    if (region.width > 0) {
+        if (region.x0 >= _width || region.width > _width - region.x0 ||
+            region.y0 >= _height || region.height > _height - region.y0)
+            throw std::runtime_error("region is not inside the image");
+        tiles.push_back(region);
+    }
+    if (!tile_list.empty()) {
+        const std::vector<Tile> all = make_tiles(_width, _height, tile_size);
+        for (unsigned int i: tile_list) {
+            if (i >= all.size())
+                throw std::runtime_error("tile " + std::to_string(i) + " does not exist, the image has "
+                                         + std::to_string(all.size()) + " tiles");
+            tiles.push_back(all[i]);
+        }
+    }
+    return tiles;
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void RenderSettings::print_options(std::ostream& _os)
+{
+    _os << "Options:\n";
+    _os << "  --compress-meshes      store meshes quantized and clustered to save memory\n";
+    _os << "  --page-meshes MB       stream meshes from page files through a cache of MB megabytes\n";
+    _os << "  --bvh sah|lbvh         build hierarchies with binned SAH (default) or from Morton codes\n";
+    _os << "  --accel bvh|grid|auto  find objects through a hierarchy or a uniform grid (default: auto)\n";
+    _os << "  --lazy-bvh             build mesh hierarchies when the first ray reaches a mesh\n";
+    _os << "  --no-culling           intersect primary rays with all objects, not per-tile candidates\n";
+    _os << "  --rasterize            start primary rays from a rasterized visibility buffer\n";
+    _os << "  --min-weight W         stop reflections that contribute less than W to their pixel\n";
+    _os << "  --roulette             end reflections below --min-weight at random, unbiased\n";
+    _os << "  --preview N            trace every N-th pixel per row and column, interpolate flat regions\n";
+    _os << "  --framebuffer F        store the image as double (default), float or half\n";
+    _os << "  --stream-bands ROWS    render bands of ROWS rows and append each to the output file\n";
+    _os << "  --balance              render tiles of similar cost (from a sparse pre-pass), expensive first\n";
+    _os << "  --numa                 pin render threads to the NUMA nodes, report throughput per node\n";
+    _os << "  --numa-replicate       like --numa, and copy the geometry into the memory of each node\n";
+    _os << "  --checkpoint FILE      save finished tiles to FILE and resume from it after a restart\n";
+    _os << "  --checkpoint-interval SEC  save the checkpoint every SEC seconds (default 60)\n";
+    _os << "  --region X,Y,W,H       render only this pixel rectangle into a partial image\n";
+    _os << "  --tiles LIST           render only these tiles (e.g. 0-3,7) into a partial image\n";
+    _os << "  --workers N            render tiles in N local worker processes\n";
+    _os << "  --connect HOST:PORT    render tiles on a remote worker (may be repeated)\n";
+    _os << "  --worker-listen [ADDR:]PORT  run as worker on TCP port PORT of ADDR (default: loopback only)\n";
+    _os << "  --tile-size N          edge length of distributed tiles in pixels (default 64)\n";
+    _os << "  --tile-timeout SEC     re-dispatch tiles not finished after SEC seconds (default 60)\n";
+    _os << "  --serve SOCKET         run as render server with resident scenes on a Unix socket\n";
+    _os << "  --server-memory MB     evict least recently used scenes above MB megabytes\n";
+    _os << "  --request SOCKET       let the render server on SOCKET render the scene\n";
+    _os << "  --priority P           priority of the request (higher is rendered first)\n";
+    _os << "  --watch                re-render whenever the scene or its meshes change\n";
+}
+
+
+//=============================================================================
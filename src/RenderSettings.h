@@ -0,0 +1,156 @@
+#pragma once
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+#include "Bvh.h"
+#include "Grid.h"
+#include "Image.h"
+#include "Tile.h"
+
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+/// \class RenderSettings RenderSettings.h
+/// Options that control how a scene is loaded and rendered. They are set from
+/// the command line of `raytrace`; some of them can also be given as
+/// directives in the scene file (see Scene::read()).
+struct RenderSettings
+{
+    /// store meshes in quantized, clustered form (see CompressedMesh)
+    bool compress_meshes = false;
+
+    /// if non-zero, stream meshes out-of-core (see PagedMesh) through a
+    /// page cache of this many megabytes
+    double page_budget_mb = 0;
+
+    /// algorithm used to build the bounding volume hierarchies
+    BvhMethod bvh = BvhMethod::SAH;
+
+    /// build the hierarchy of a mesh only when the first ray reaches it
+    bool lazy_bvh = false;
+
+    /// structure over the objects; AUTO leaves the choice to the scene's
+    /// `accelerator` directive, or else to CompiledScene::compile()
+    Accelerator accelerator = Accelerator::AUTO;
+
+    /// intersect primary rays only with the objects in the frustum of their screen tile
+    bool frustum_culling = true;
+
+    /// rasterize the primary hits before ray tracing (see VisibilityBuffer)
+    bool rasterize = false;
+
+    /// stop tracing reflections whose contribution to the pixel (the product
+    /// of the mirror coefficients along the path) is below this weight (0: never)
+    double min_weight = 0;
+
+    /// below min_weight, continue reflections at random with probability
+    /// weight / min_weight and scale up the survivors (Russian roulette)
+    bool roulette = false;
+
+    /// if above 1, render() only traces every preview-th pixel of each row
+    /// and column first and interpolates where they agree (see Scene::renderPreview())
+    unsigned int preview = 0;
+
+    /// precision of the rendered image in memory
+    PixelFormat framebuffer = PixelFormat::Double;
+
+    /// if non-zero, render bands of this many rows and append them to the
+    /// output file one by one instead of rendering the whole image first
+    unsigned int band_rows = 0;
+
+    /// cut the image into tiles of similar cost, estimated by a sparse
+    /// pre-pass, and render the expensive ones first (see Scene::balancedTiles())
+    bool balance = false;
+
+    /// pin the render threads to the CPUs of the NUMA nodes (see NumaTopology)
+    bool numa = false;
+
+    /// with numa: give each node its own copy of the compiled scene
+    bool numa_replicate = false;
+
+    /// if not empty, save the finished tiles (of tile_size) to this file and
+    /// resume from it when the same render is started again (see Checkpoint)
+    std::filesystem::path checkpoint;
+
+    /// seconds between saving the finished tiles to the checkpoint
+    double checkpoint_interval = 60;
+
+    /// render only this rectangle of pixels into a partial image (width 0: whole image)
+    Tile region;
+
+    /// render only these tiles (of tile_size, numbered row by row from the
+    /// bottom like make_tiles()) into a partial image
+    std::vector<unsigned int> tile_list;
+
+
+    /// number of local worker processes for distributed rendering (see TileCoordinator)
+    int num_workers = 0;
+
+    /// addresses (host:port) of remote workers for distributed rendering
+    std::vector<std::string> worker_addresses;
+
+    /// serve as a worker on this TCP port (0: no)
+    int worker_port = 0;
+
+    /// local address the worker listens on (empty: loopback only)
+    std::string worker_listen_address;
+
+    /// serve as a worker on this (inherited) socket descriptor (-1: no)
+    int worker_fd = -1;
+
+    /// edge length of the tiles distributed to workers, in pixels
+    unsigned int tile_size = 64;
+
+    /// re-dispatch a tile if its worker did not answer within this many seconds
+    double tile_timeout = 60;
+
+
+    /// run as render server on this Unix domain socket (see RenderServer)
+    std::string server_socket;
+
+    /// evict least recently used scenes of the render server above this many megabytes (0: never)
+    double server_memory_mb = 0;
+
+    /// send the render job to the render server on this Unix domain socket
+    std::string request_socket;
+
+    /// priority of the render job sent to the render server
+    int priority = 0;
+
+    /// keep rendering: update the scene and render again whenever its files change
+    bool watch = false;
+
+
+    /// Options that affect the rendered image, as given on the command line.
+    /// They are forwarded to workers, so that they render the same image.
+    std::vector<std::string> forwarded;
+
+
+    /// Parse the option \c _args[_i] (and its value, advancing \c _i).
+    /// Returns false if the option is unknown or its value is missing.
+    bool parse_option(const std::vector<std::string>& _args, size_t& _i);
+
+    /// Is only a part of the image rendered (see PartialImage)?
+    bool partial() const { return region.width > 0 || !tile_list.empty(); }
+
+    /// The tiles of an image of \c _width x \c _height pixels selected by
+    /// `region` and `tile_list`. Throws std::runtime_error if they are not
+    /// inside the image.
+    std::vector<Tile> partial_tiles(unsigned int _width, unsigned int _height) const;
+
+    /// Is a distributed rendering mode selected?
+    bool distributed() const { return num_workers > 0 || !worker_addresses.empty(); }
+
+    /// Print the list of options accepted by parse_option()
+    static void print_options(std::ostream& _os);
+};
@@ -15,82 +15,617 @@
 #include "Sphere.h"
 #include "Cylinder.h"
 #include "Mesh.h"
+#include "StopWatch.h"
+#include "Numa.h"
 
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <exception>
 #include <limits>
 #include <map>
+#include <sstream>
 #include <functional>
 #include <stdexcept>
 #include <cmath>
+#include <cstdint>
+#include <utility>
 
 #if HAVE_OPENMP
 #  include <omp.h>
 #endif
 
+namespace {
+
+/// edge length of the screen tiles whose primary rays share candidate lists
+constexpr unsigned int SCREEN_TILE_SIZE = 16;
+
+/// longest candidate list; tiles that see more objects use the object hierarchy
+constexpr size_t MAX_CANDIDATES = 16;
+
+/// edge length of the tiles rendered by one thread (a multiple of Image::TILE_SIZE)
+constexpr unsigned int RENDER_TILE_SIZE = 4 * Image::TILE_SIZE;
+
+/// edge length of the blocks whose cost is estimated for RenderSettings::balance
+/// (a multiple of Image::TILE_SIZE), and distance of the pixels timed in each
+constexpr unsigned int BALANCE_BLOCK_SIZE  = 2 * Image::TILE_SIZE;
+constexpr unsigned int BALANCE_SAMPLE_STEP = 8;
+
+/// work units per thread of a balanced render
+constexpr double BALANCE_UNITS_PER_THREAD = 8;
+
+/// largest difference of a color channel between the four samples of a
+/// preview cell that is still interpolated
+constexpr double PREVIEW_TOLERANCE = 0.05;
+
+/// NUMA node of the calling thread while it renders with RenderSettings::numa (-1: unknown)
+thread_local int threadNode = -1;
+
+/// rays traced by the calling thread that are not yet added to Scene::rayCount
+thread_local size_t threadRays = 0;
+
+/// reflections traced, cut by their weight, and ended by Russian roulette by
+/// the calling thread that are not yet added to Scene::reflectionCount etc.
+thread_local size_t threadReflections = 0, threadCuts = 0, threadRoulette = 0;
+
+/// pixel rendered by the calling thread, (y << 32) | x, from which the random
+/// numbers of Russian roulette are derived
+thread_local uint64_t threadPixel = 0;
+
+/// random number in [0, 1) for the reflection at recursion depth \c _depth of
+/// pixel \c _pixel (SplitMix64 of both), so that images depend neither on
+/// which thread renders which pixel nor on what it rendered before
+double random_uniform(uint64_t _pixel, int _depth)
+{
+    uint64_t z = (_pixel * 0x9e3779b97f4a7c15ull) ^ (uint64_t(_depth) + 1) * 0xd1b54a32d192ed03ull;
+    z += 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    z ^= z >> 31;
+    return double(z >> 11) * 0x1.0p-53;
+}
+
+} // namespace
+
 //-----------------------------------------------------------------------------
 
 
 Image Scene::render()
 {
+    prepareTiles();
+
     // allocate new image.
-    Image img(camera.width, camera.height);
+    Image img(camera.width, camera.height, settings.framebuffer);
+
+    numaStats = NumaStats();
+    scheduleStats = ScheduleStats();
+    previewStats = PreviewStats();
+    resetCounts();
+    printThreads();
+    if (settings.preview > 1 && camera.width > 1 && camera.height > 1)
+        renderPreview(img);
+    else
+        renderBand(img, 0);
+
+    // Note: compiler will elide copy.
+    return img;
+}
+
+//-----------------------------------------------------------------------------
+
+bool Scene::renderStreaming(const std::filesystem::path &_filename, unsigned int _rows)
+{
+    prepareTiles();
+
+    std::ofstream file(_filename, std::fstream::binary);
+    if (!file || !Image::write_bmp_header(file, camera.width, camera.height)) {
+        std::cerr << "ERROR: Failed to open " << _filename.string() << " for writing." << std::endl;
+        return false;
+    }
+
+    // BMP rows are stored bottom-up like ours, so bands are appended in order
+    numaStats = NumaStats();
+    scheduleStats = ScheduleStats();
+    resetCounts();
+    printThreads();
+    _rows = std::max(_rows, 1u);
+    Image band;
+    for (unsigned int y0=0; y0<camera.height; y0+=_rows) {
+        const unsigned int rows = std::min(_rows, camera.height - y0);
+        if (band.height() != rows) band = Image(camera.width, rows, settings.framebuffer);
+        renderBand(band, y0);
+        if (!band.write_bmp_rows(file)) {
+            std::cerr << "ERROR: Failed to write " << _filename.string() << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+void Scene::flushThreadCounts()
+{
+    rayCount        += std::exchange(threadRays, 0);
+    reflectionCount += std::exchange(threadReflections, 0);
+    cutCount        += std::exchange(threadCuts, 0);
+    rouletteCount   += std::exchange(threadRoulette, 0);
+}
+
+//-----------------------------------------------------------------------------
+
+void Scene::resetCounts()
+{
+    rayCount = reflectionCount = cutCount = rouletteCount = 0;
+}
+
+//-----------------------------------------------------------------------------
 
-    // Function rendering a full column of the image
-    auto raytraceColumn = [&img, this](int x) {
-        for (int y=0; y<int(camera.height); ++y)
+void Scene::renderBand(Image &_band, unsigned int _y0)
+{
+    // Render tiles that are made of whole image blocks, so that threads
+    // never write to the same cache line.
+    const std::vector<Tile> tiles = settings.balance ? balancedTiles(_band.width(), _band.height(), _y0)
+                                                     : make_tiles(_band.width(), _band.height(), RENDER_TILE_SIZE);
+    auto raytraceTile = [&_band, _y0, this](const Tile &_tile) {
+        for (unsigned int y=_tile.y0; y<_tile.y0+_tile.height; ++y)
         {
-            Ray ray = camera.primary_ray(x,y);
+            for (unsigned int x=_tile.x0; x<_tile.x0+_tile.width; ++x)
+            {
+                _band.set(x, y, renderPixel(x, _y0 + y));
+            }
+        }
+        flushThreadCounts();
+    };
+
+#if HAVE_OPENMP
+    if (settings.numa) {
+        renderTilesNuma(tiles, raytraceTile);
+        return;
+    }
+#endif
+
+    // If possible, raytrace image tiles in parallel. Each thread notes when
+    // it runs out of tiles, to measure how long it waits for the others.
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point start = Clock::now();
+    std::vector<double> finished(1, 0);
+#if HAVE_OPENMP
+#  pragma omp parallel
+#endif
+    {
+#if HAVE_OPENMP
+#  pragma omp single
+        finished.assign(size_t(omp_get_num_threads()), 0);
+        const int thread = omp_get_thread_num();
+#  pragma omp for schedule(dynamic, 1) nowait
+#else
+        const int thread = 0;
+#endif
+        for (int i=0; i<int(tiles.size()); ++i) {
+            raytraceTile(tiles[i]);
+        }
+        finished[size_t(thread)] = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
 
-            // compute color by tracing this ray
-            vec3 color = trace(ray, 0);
+    const double frame = *std::max_element(finished.begin(), finished.end());
+    scheduleStats.threads = finished.size();
+    scheduleStats.units += tiles.size();
+    scheduleStats.frame_ms += frame;
+    for (double f: finished) {
+        scheduleStats.idle_ms += frame - f;
+        scheduleStats.max_idle_ms = std::max(scheduleStats.max_idle_ms, frame - f);
+    }
+}
 
-            // avoid over-saturation
-            color = min(color, vec3(1, 1, 1));
+//-----------------------------------------------------------------------------
 
-            // store pixel color
-            img(x,y) = color;
+std::vector<Tile> Scene::balancedTiles(unsigned int _width, unsigned int _height, unsigned int _y0)
+{
+    using Clock = std::chrono::steady_clock;
+    StopWatch timer;
+    timer.start();
+
+    // time every BALANCE_SAMPLE_STEP-th pixel of each row and column of a
+    // block (at least one), and extrapolate to the whole block
+    const std::vector<Tile> blocks = make_tiles(_width, _height, BALANCE_BLOCK_SIZE);
+    std::vector<double> cost(blocks.size(), 0);
+    size_t samples = 0;
+#if HAVE_OPENMP
+#  pragma omp parallel for schedule(dynamic, 1) reduction(+:samples)
+#endif
+    for (int i=0; i<int(blocks.size()); ++i) {
+        const Tile &b = blocks[i];
+        size_t n = 0;
+        const Clock::time_point begin = Clock::now();
+        for (unsigned int dy=0; dy<b.height; dy+=BALANCE_SAMPLE_STEP) {
+            for (unsigned int dx=0; dx<b.width; dx+=BALANCE_SAMPLE_STEP, ++n) {
+                renderPixel(b.x0 + std::min(dx + BALANCE_SAMPLE_STEP/2, b.width-1),
+                            _y0 + b.y0 + std::min(dy + BALANCE_SAMPLE_STEP/2, b.height-1));
+            }
+        }
+        cost[i] = std::chrono::duration<double>(Clock::now() - begin).count() * double(b.size()) / double(n);
+        samples += n;
+        flushThreadCounts();
+    }
+
+    // merge runs of blocks in a row up to the cost of a work unit
+#if HAVE_OPENMP
+    const int threads = omp_get_max_threads();
+#else
+    const int threads = 1;
+#endif
+    double total = 0;
+    for (double c: cost) total += c;
+    const double target = total / (threads * BALANCE_UNITS_PER_THREAD);
+
+    std::vector<std::pair<double, Tile>> units;
+    for (size_t i=0; i<blocks.size(); ++i) {
+        const bool sameRow = !units.empty() && units.back().second.y0 == blocks[i].y0;
+        if (sameRow && units.back().first + cost[i] <= target) {
+            units.back().first += cost[i];
+            units.back().second.width += blocks[i].width;
         }
+        else {
+            units.emplace_back(cost[i], blocks[i]);
+        }
+    }
+
+    // most expensive first, so that the cheap units fill the gaps at the end
+    std::stable_sort(units.begin(), units.end(), [](const auto &_a, const auto &_b) { return _a.first > _b.first; });
+    std::vector<Tile> tiles;
+    tiles.reserve(units.size());
+    for (const auto &u: units) tiles.push_back(u.second);
+
+    scheduleStats.samples += samples;
+    scheduleStats.prepass_ms += timer.stop();
+    return tiles;
+}
+
+//-----------------------------------------------------------------------------
+
+void Scene::renderPreview(Image &_img)
+{
+    const unsigned int step = settings.preview;
+
+    // sample every step-th row and column, and the last one
+    auto lattice = [step](unsigned int _n) {
+        std::vector<unsigned int> samples;
+        for (unsigned int i=0; i<_n; i+=step) samples.push_back(i);
+        if (samples.back() != _n-1) samples.push_back(_n-1);
+        return samples;
     };
+    const std::vector<unsigned int> xs = lattice(_img.width()), ys = lattice(_img.height());
+    const size_t columns = xs.size(), rows = ys.size();
 
-    // If possible, raytrace image columns in parallel.
+    // trace the samples and remember the objects they see
+    std::vector<vec3> colors(columns * rows);
+    std::vector<int>  objects(columns * rows, -1);
+#if HAVE_OPENMP
+#  pragma omp parallel for schedule(dynamic, 1)
+#endif
+    for (int j=0; j<int(rows); ++j) {
+        for (size_t i=0; i<columns; ++i) {
+            const size_t k = size_t(j) * columns + i;
+            colors[k] = renderPixel(xs[i], ys[j], &objects[k]);
+            _img.set(xs[i], ys[j], colors[k]);
+        }
+        flushThreadCounts();
+    }
+
+    // Fill the cells between the samples. Each cell owns its pixels up to
+    // (excluding) those of the next row and column of samples, so that
+    // every pixel is written once.
+    size_t traced = 0, interpolated = 0;
+#if HAVE_OPENMP
+#  pragma omp parallel for schedule(dynamic, 1) reduction(+:traced, interpolated)
+#endif
+    for (int j=0; j<int(rows)-1; ++j) {
+        for (size_t i=0; i+1<columns; ++i) {
+            const size_t k[4] = { j*columns + i, j*columns + i+1, (j+1)*columns + i, (j+1)*columns + i+1 };
+
+            // same object and similar shading at all corners (no edge, no shadow boundary)
+            vec3 lo = colors[k[0]], hi = colors[k[0]];
+            bool coherent = true;
+            for (int c=1; c<4; ++c) {
+                coherent = coherent && objects[k[c]] == objects[k[0]];
+                lo = min(lo, colors[k[c]]);
+                hi = max(hi, colors[k[c]]);
+            }
+            const vec3 range = hi - lo;
+            coherent = coherent && std::max({range[0], range[1], range[2]}) <= PREVIEW_TOLERANCE;
+            interpolated += coherent;
+
+            const unsigned int x0 = xs[i], x1 = xs[i+1], y0 = ys[j], y1 = ys[j+1];
+            const unsigned int xEnd = i+2 == columns ? x1+1 : x1, yEnd = size_t(j)+2 == rows ? y1+1 : y1;
+            for (unsigned int y=y0; y<yEnd; ++y) {
+                for (unsigned int x=x0; x<xEnd; ++x) {
+                    if ((x == x0 || x == x1) && (y == y0 || y == y1)) continue;
+                    if (coherent) {
+                        const double u = double(x - x0) / double(x1 - x0);
+                        const double v = double(y - y0) / double(y1 - y0);
+                        _img.set(x, y, (1-v) * ((1-u) * colors[k[0]] + u * colors[k[1]])
+                                       +  v  * ((1-u) * colors[k[2]] + u * colors[k[3]]));
+                    }
+                    else {
+                        _img.set(x, y, renderPixel(x, y));
+                        ++traced;
+                    }
+                }
+            }
+        }
+        flushThreadCounts();
+    }
+
+    previewStats.pixels       = size_t(_img.width()) * _img.height();
+    previewStats.traced       = columns * rows + traced;
+    previewStats.cells        = (columns - 1) * (rows - 1);
+    previewStats.interpolated = interpolated;
+}
 
+//-----------------------------------------------------------------------------
+
+void Scene::renderTilesNuma(const std::vector<Tile> &_tiles, const std::function<void(const Tile&)> &_render)
+{
+    const NumaTopology &topology = NumaTopology::system();
+#if HAVE_OPENMP
+    const int threads = omp_get_max_threads();
+#else
+    const int threads = 1;
+#endif
+
+    // replicate the geometry on each node that gets threads (if there are several)
+    const bool replicate = settings.numa_replicate && topology.nodes() > 1;
+    if (replicate) replicas.resize(size_t(topology.nodes()));
+    std::vector<int> firstOnNode(size_t(topology.nodes()), -1);
+    for (int t=threads; t-- > 0; ) firstOnNode[size_t(topology.node_of_thread(t, threads))] = t;
+
+    std::vector<size_t> pixels(size_t(threads), 0);
+    std::vector<double> busy(size_t(threads), 0);
+    std::vector<int>    nodes(size_t(threads), 0);
+
+#if HAVE_OPENMP
+#  pragma omp parallel num_threads(threads)
+#endif
+    {
+#if HAVE_OPENMP
+        const int thread = omp_get_thread_num();
+#else
+        const int thread = 0;
+#endif
+        // pin the thread and let it copy the geometry into the memory of its node
+        const int node = topology.pin(thread, threads);
+        threadNode = node;
+        nodes[size_t(thread)] = node;
+        if (replicate && firstOnNode[size_t(node)] == thread && !replicas[size_t(node)])
+            replicas[size_t(node)] = std::make_unique<CompiledScene>(compiled, std::pmr::new_delete_resource());
+#if HAVE_OPENMP
+#  pragma omp barrier
+#endif
+
+        // the image blocks of a tile are first touched by the thread that renders it
+        StopWatch timer;
+        timer.start();
+#if HAVE_OPENMP
+#  pragma omp for schedule(dynamic, 1) nowait
+#endif
+        for (int i=0; i<int(_tiles.size()); ++i) {
+            _render(_tiles[i]);
+            pixels[size_t(thread)] += _tiles[i].size();
+        }
+        busy[size_t(thread)] = timer.stop();
+    }
+
+    if (numaStats.threads.empty()) {
+        for (int n=0; n<topology.nodes(); ++n) numaStats.ids.push_back(topology.id(n));
+        numaStats.threads.assign(size_t(topology.nodes()), 0);
+        numaStats.pixels.assign(size_t(topology.nodes()), 0);
+        numaStats.busy_ms.assign(size_t(topology.nodes()), 0);
+        for (int t=0; t<threads; ++t) ++numaStats.threads[size_t(nodes[size_t(t)])];
+    }
+    for (int t=0; t<threads; ++t) {
+        numaStats.pixels[size_t(nodes[size_t(t)])] += pixels[size_t(t)];
+        numaStats.busy_ms[size_t(nodes[size_t(t)])] += busy[size_t(t)];
+    }
+    numaStats.replicas = 0;
+    for (const auto &r: replicas) numaStats.replicas += r != nullptr;
+}
+
+//-----------------------------------------------------------------------------
+
+const CompiledScene &Scene::threadGeometry() const
+{
+    if (threadNode >= 0 && size_t(threadNode) < replicas.size() && replicas[size_t(threadNode)])
+        return *replicas[size_t(threadNode)];
+    return compiled;
+}
+
+//-----------------------------------------------------------------------------
+
+void Scene::printThreads()
+{
 #if HAVE_OPENMP
     std::cout << "Rendering with up to " << omp_get_max_threads() << " threads." << std::flush;
-#  pragma omp parallel for schedule(dynamic, 1)
 #else
     std::cout << "Rendering singlethreaded (compiled without OpenMP)." << std::endl;
 #endif
+}
 
-    for (int x=0; x<int(camera.width); ++x) {
-        raytraceColumn(x);
+//-----------------------------------------------------------------------------
+
+void Scene::renderTile(const Tile& _tile, std::vector<vec3>& _pixels)
+{
+    _pixels.resize(_tile.size());
+    prepareTiles();
+
+#if HAVE_OPENMP
+#  pragma omp parallel for schedule(dynamic, 1)
+#endif
+    for (int y=0; y<int(_tile.height); ++y) {
+        for (unsigned int x=0; x<_tile.width; ++x) {
+            _pixels[size_t(y) * _tile.width + x] = renderPixel(_tile.x0 + x, _tile.y0 + y);
+        }
+        flushThreadCounts();
     }
+}
 
-    // Note: compiler will elide copy.
-    return img;
+//-----------------------------------------------------------------------------
+
+void Scene::renderTiles(const std::vector<Tile>& _tiles,
+                        const std::function<void(size_t, const std::vector<vec3>&)>& _done)
+{
+    prepareTiles();
+
+    auto raytraceTile = [&_tiles, &_done, this](const Tile &_tile) {
+        std::vector<vec3> pixels(_tile.size());
+        for (unsigned int y=0; y<_tile.height; ++y) {
+            for (unsigned int x=0; x<_tile.width; ++x) {
+                pixels[size_t(y) * _tile.width + x] = renderPixel(_tile.x0 + x, _tile.y0 + y);
+            }
+        }
+        flushThreadCounts();
+        _done(size_t(&_tile - _tiles.data()), pixels);
+    };
+
+#if HAVE_OPENMP
+    if (settings.numa) {
+        renderTilesNuma(_tiles, raytraceTile);
+        return;
+    }
+#  pragma omp parallel for schedule(dynamic, 1)
+#endif
+    for (int i=0; i<int(_tiles.size()); ++i) {
+        raytraceTile(_tiles[i]);
+    }
 }
 
 //-----------------------------------------------------------------------------
 
-vec3 Scene::trace(const Ray& _ray, int _depth)
+void Scene::prepareTiles()
+{
+    if (screenTilesValid) return;
+    screenTiles.clear();
+    cullingStats = CullingStats();
+    visibility.clear();
+    screenTilesValid = true;
+    if (camera.width == 0 || camera.height == 0) return;
+
+    if (settings.rasterize) visibility.build(compiled, camera);
+    if (!settings.frustum_culling) return;
+
+    const std::vector<Tile> tiles = make_tiles(camera.width, camera.height, SCREEN_TILE_SIZE);
+    screenColumns = (camera.width + SCREEN_TILE_SIZE - 1) / SCREEN_TILE_SIZE;
+    screenTiles.resize(tiles.size());
+
+#if HAVE_OPENMP
+#  pragma omp parallel for schedule(dynamic, 1)
+#endif
+    for (int i=0; i<int(tiles.size()); ++i) {
+        ScreenTile &tile = screenTiles[i];
+        compiled.cull(Frustum(camera, tiles[i]), tile.prims);
+
+        // long lists are slower than the object hierarchy
+        tile.useList = tile.prims.size() <= MAX_CANDIDATES;
+        if (!tile.useList) std::vector<int>().swap(tile.prims);
+    }
+
+    std::vector<int> visible;
+    compiled.cull(Frustum(camera, Tile{0, 0, camera.width, camera.height}), visible);
+    cullingStats.objects = compiled.num_bounded();
+    cullingStats.visible = visible.size();
+    cullingStats.tiles = screenTiles.size();
+    for (const ScreenTile &tile: screenTiles) {
+        if (!tile.useList) continue;
+        ++cullingStats.listTiles;
+        cullingStats.candidates += double(tile.prims.size());
+    }
+    if (cullingStats.listTiles) cullingStats.candidates /= double(cullingStats.listTiles);
+}
+
+//-----------------------------------------------------------------------------
+
+const std::vector<int> *Scene::primaryCandidates(unsigned int _x, unsigned int _y) const
+{
+    if (screenTiles.empty()) return nullptr;
+    const ScreenTile &tile = screenTiles[(_y / SCREEN_TILE_SIZE) * screenColumns + _x / SCREEN_TILE_SIZE];
+    return tile.useList ? &tile.prims : nullptr;
+}
+
+//-----------------------------------------------------------------------------
+
+vec3 Scene::renderPixel(unsigned int _x, unsigned int _y, int* _object)
+{
+    Ray ray = camera.primary_ray(_x, _y);
+
+    // what the pre-passes know about this ray
+    CompiledScene::Primary primary;
+    primary.prims = primaryCandidates(_x, _y);
+    if (!visibility.empty()) {
+        const VisibilityBuffer::Entry entry = visibility(_x, _y);
+        primary.prim = entry.prim;
+        primary.triangle = entry.triangle;
+    }
+
+    threadPixel = (uint64_t(_y) << 32) | _x;
+
+    // compute color by tracing this ray
+    vec3 color = trace(ray, 0, &primary, 1.0, _object);
+
+    // avoid over-saturation
+    return min(color, vec3(1, 1, 1));
+}
+
+//-----------------------------------------------------------------------------
+
+vec3 Scene::trace(const Ray& _ray, int _depth, const CompiledScene::Primary* _primary, double _weight,
+                  int* _object)
 {
     // stop if recursion depth (=number of reflection) is too large
     if (_depth > max_depth) return vec3(0,0,0);
+    ++threadRays;
 
     // Find first intersection with an object. If an intersection is found,
     // it is stored in object, point, normal, and t.
-    Object_ptr  object;
+    int         object;
     vec3        point;
     vec3        normal;
     double      t;
-    if (!intersect(_ray, object, point, normal, t))
+    const CompiledScene &geo = threadGeometry();
+    const bool found = _primary ? geo.intersect(_ray, *_primary, object, point, normal, t)
+                                : geo.intersect(_ray, object, point, normal, t);
+    if (_object) *_object = found ? object : -1;
+    if (!found)
     {
         return background;
     }
+    const Material& material = geo.material(object);
+    const MaterialClass& shading = geo.material_class(object);
 
-    // compute local Phong lighting (ambient+diffuse+specular)
-    vec3 color = lighting(point, normal, -_ray.direction, object->material);
+    // compute local Phong lighting (ambient+diffuse+specular) with the
+    // kernel of the material's class
+    vec3 color = shading.specular ? shade<true>(point, normal, -_ray.direction, material)
+                                  : shade<false>(point, normal, -_ray.direction, material);
 
     //checking if object is reflective
-    if(object->material.mirror > 0 && _depth <= max_depth) {
+    if(shading.mirror && _depth <= max_depth) {
+
+        // Contribution of the reflection to the pixel. Below the threshold
+        // it is dropped like beyond max_depth, or with Russian roulette only
+        // at random, the survivors being scaled up to keep the mean.
+        double weight = _weight * material.mirror;
+        double scale  = 1;
+        if (weight < settings.min_weight) {
+            const double survival = weight / settings.min_weight;
+            if (!settings.roulette || random_uniform(threadPixel, _depth) >= survival) {
+                ++threadCuts;
+                threadRoulette += settings.roulette;
+                return shading.local*color;
+            }
+            scale  = 1 / survival;
+            weight = settings.min_weight;
+        }
+        ++threadReflections;
 
         vec3 reflected, reflected_color;
 
@@ -100,8 +635,8 @@ vec3 Scene::trace(const Ray& _ray, int _depth)
         Ray reflectedRay((point + 1e-6 * normal), reflected);
 
         //local Phong lighting
-        reflected_color = trace(reflectedRay, _depth+1);
-        color = (1 - object->material.mirror)*color + object->material.mirror*reflected_color;
+        reflected_color = trace(reflectedRay, _depth+1, nullptr, weight);
+        color = shading.local*color + (scale * material.mirror)*reflected_color;
 
     }
 
@@ -112,118 +647,501 @@ vec3 Scene::trace(const Ray& _ray, int _depth)
 
 bool Scene::intersect(const Ray& _ray, Object_ptr& _object, vec3& _point, vec3& _normal, double& _t)
 {
-    double  t, tmin(Object::NO_INTERSECTION);
-    vec3    p, n;
-
-    for (const auto &o: objects) // for each object
-    {
-        if (o->intersect(_ray, p, n, t)) // does ray intersect object?
-        {
-            if (t < tmin) // is intersection point the currently closest one?
-            {
-                tmin = t;
-                _object = o.get();
-                _point  = p;
-                _normal = n;
-                _t      = t;
-            }
-        }
-    }
+    const CompiledScene &geo = threadGeometry();
+    ++threadRays;
+    int id;
+    if (!geo.intersect(_ray, id, _point, _normal, _t))
+        return false;
 
-    return (tmin != Object::NO_INTERSECTION);
+    _object = geo.object(id);
+    return true;
 }
 
+//-----------------------------------------------------------------------------
+
 vec3 Scene::lighting(const vec3& _point, const vec3& _normal, const vec3& _view, const Material& _material)
 {
+    return MaterialClass(_material).specular ? shade<true>(_point, _normal, _view, _material)
+                                             : shade<false>(_point, _normal, _view, _material);
+}
+
+//-----------------------------------------------------------------------------
 
+template <bool SPECULAR>
+vec3 Scene::shade(const vec3& _point, const vec3& _normal, const vec3& _view, const Material& _material)
+{
     vec3 color = ambience*_material.ambient;
 
+    // the same for all lights: the origin of the shadow rays (slightly
+    // displaced to avoid float rounding errors) and the view direction
+    const vec3 shadowOrigin = _point + (1e-6 * _normal);
+    const vec3 v = SPECULAR ? normalize(_view) : vec3(0);
+    const CompiledScene &geo = threadGeometry();
+
     /* for every light source:
-     * - first, check whether reflection point is shadowed
+     * - lights behind the surface add nothing, shadowed or not
+     * - check whether reflection point is shadowed
      *     -> is source's light ray blocked between origin and reflection point?
-     * - if NOT shadowed, calculate diffuse and specular
-     * -
-      */
-    for (Light& light: lights) {
-        vec3 diffuse = vec3(0);
-        vec3 specular = vec3(0);
-
-        vec3 shadowOrigin = _point + (1e-6 * _normal); //slightly displace origin to avoid float rounding errors
-        vec3 shadowDir = normalize(light.position - _point);
-        Ray shadowRay(shadowOrigin,shadowDir);
-
-        //dummy objects for intersect function
-        Object_ptr shadowObject;
-        vec3 shadowPoint, shadowNormal;
-        double shadowT;
-
-        bool isShadowed = false;
-
-        //if shadowRay intersects with an object
-        if(intersect(shadowRay,shadowObject,shadowPoint,shadowNormal,shadowT)) {
-            //if intersected object is closer than light source
-            if (norm(light.position - shadowPoint) > shadowT) {
-                isShadowed = true;
+     * - if NOT shadowed, calculate diffuse and (for specular materials) specular
+     */
+    for (const Light& light: lights) {
+        const vec3 l = normalize(light.position - _point);
+        const double theta = dot(_normal,l);
+        if (!(theta > 0)) continue;
+
+        // only the distance of the hit is needed, not its normal
+        Ray shadowRay(shadowOrigin, l);
+        CompiledScene::Hit shadowHit;
+        ++threadRays;
+
+        //if shadowRay intersects with an object closer than the light source
+        if (geo.intersect(shadowRay, shadowHit) && norm(light.position - shadowRay(shadowHit.t)) > shadowHit.t)
+            continue;
+
+        const vec3 diffuse = _material.diffuse * theta;
+        if constexpr (SPECULAR) {
+            vec3 specular = vec3(0);
+            const double alpha = dot(mirror(l,_normal),v);
+            if (alpha > 0) {
+                specular = (_material.specular * pow(alpha,_material.shininess));
             }
+            color += (diffuse + specular) * light.color;
+        }
+        else {
+            color += diffuse * light.color;
         }
+    }
 
-        if(!isShadowed) {
-            vec3 l = normalize(light.position - _point);
-            vec3 v = normalize(_view);
-            vec3 r = mirror(l,_normal);
+    return color;
+}
 
-            double theta = dot(_normal,l);
-            double alpha = dot(r,v);
+//-----------------------------------------------------------------------------
 
-            if (theta > 0) {
-                diffuse = _material.diffuse * theta;
+Mesh::Storage Scene::meshStorage()
+{
+    if (settings.page_budget_mb > 0)
+    {
+        if (!pageCache)
+            pageCache = std::make_unique<PageCache>(size_t(settings.page_budget_mb * 1024 * 1024));
+        return Mesh::PAGED;
+    }
+    return settings.compress_meshes ? Mesh::COMPRESSED : Mesh::RESIDENT;
+}
 
-                if (alpha > 0) {
-                    specular = (_material.specular * pow(alpha,_material.shininess));
-                }
-            }
+//-----------------------------------------------------------------------------
 
+void Scene::loadMeshes(const std::vector<PendingMesh> &_meshes, std::vector<Object_ptr> &_objects)
+{
+    StopWatch timer;
+    timer.start();
 
-            color += (diffuse + specular) * light.color;
+    // Meshes of the same file are loaded one after another by the same task,
+    // since they may (re-)create the same page file. The arena is thread-safe.
+    std::map<std::filesystem::path, std::vector<size_t>> files;
+    for (size_t i=0; i<_meshes.size(); ++i) {
+        std::string file;
+        std::istringstream(_meshes[i].directive->args) >> file;
+        files[(filename.parent_path() / file).lexically_normal()].push_back(i);
+    }
+
+    std::vector<std::ostringstream> logs(_meshes.size());
+    std::vector<std::exception_ptr> errors(_meshes.size());
+    std::vector<double> times(_meshes.size(), 0.0);
+
+    auto load = [&](const std::vector<size_t> &_group) {
+        for (size_t i: _group) {
+            try {
+                StopWatch meshTimer;
+                meshTimer.start();
+                std::istringstream is(_meshes[i].directive->args);
+                _objects[_meshes[i].index] = arena.create<Mesh>(is, filename, &arena, _meshes[i].storage,
+                                                                pageCache.get(), logs[i]);
+                times[i] = meshTimer.stop();
+            }
+            catch (...) {
+                errors[i] = std::current_exception();
+            }
         }
+    };
 
+    int threads = 1;
+#if HAVE_OPENMP
+#  pragma omp parallel if(files.size() > 1)
+#  pragma omp single
+    {
+        threads = omp_get_num_threads();
+        for (const auto &file: files) {
+            const std::vector<size_t> *group = &file.second;
+#  pragma omp task firstprivate(group)
+            load(*group);
+        }
     }
+#else
+    for (const auto &file: files) load(file.second);
+#endif
 
-    return color;
+    // report in the order of the scene file
+    for (size_t i=0; i<_meshes.size(); ++i) {
+        std::cout << logs[i].str();
+        if (errors[i]) std::rethrow_exception(errors[i]);
+    }
+
+    loadStats.mesh_ms = timer.stop();
+    loadStats.threads = std::min(threads, std::max(1, int(files.size())));
+    for (size_t i=0; i<_meshes.size(); ++i) {
+        loadStats.mesh_sum_ms += times[i];
+        const Mesh *mesh = static_cast<const Mesh*>(_objects[_meshes[i].index]);
+        loadStats.triangles  += mesh->num_triangles();
+        loadStats.normals_ms += mesh->normals_time();
+    }
+    loadStats.meshes = _meshes.size();
 }
 
 //-----------------------------------------------------------------------------
 
-void Scene::read(const std::filesystem::path &_filename)
+std::vector<Scene::Directive> Scene::split(const std::filesystem::path &_filename)
 {
     std::ifstream ifs(_filename);
     if (!ifs)
         throw std::runtime_error("Cannot open file " + _filename.string());
+    std::stringstream contents;
+    contents << ifs.rdbuf();
+    const std::string text = contents.str();
+    std::istringstream is(text);
 
+    // Parse the arguments of each directive into throw-away values to find
+    // where they end. Meshes are not loaded here.
     const std::map<std::string, std::function<void(void)>> entityParser = {
-        {"depth",      [&]() { ifs >> max_depth; }},
-        {"camera",     [&]() { ifs >> camera; }},
-        {"background", [&]() { ifs >> background; }},
-        {"ambience",   [&]() { ifs >> ambience; }},
-        {"light",      [&]() { lights .emplace_back(ifs); }},
-        {"plane",      [&]() { objects.emplace_back(new    Plane(ifs)); }},
-        {"sphere",     [&]() { objects.emplace_back(new   Sphere(ifs)); }},
-        {"cylinder",   [&]() { objects.emplace_back(new Cylinder(ifs)); }},
-        {"mesh",       [&]() { objects.emplace_back(new     Mesh(ifs, _filename)); }}
+        {"depth",      [&]() { int d; is >> d; }},
+        {"camera",     [&]() { Camera c; is >> c; }},
+        {"background", [&]() { vec3 c; is >> c; }},
+        {"ambience",   [&]() { vec3 c; is >> c; }},
+        {"light",      [&]() { Light l(is); }},
+        {"plane",      [&]() { Plane p(is); }},
+        {"sphere",     [&]() { Sphere s(is); }},
+        {"cylinder",   [&]() { Cylinder c(is); }},
+        {"mesh",       [&]() { std::string f, m; Material mat; is >> f >> m >> mat; }},
+        {"compress_meshes", [&]() { bool b; is >> b; }},
+        {"page_meshes",     [&]() { double d; is >> d; }},
+        {"accelerator",     [&]() { Accelerator a; is >> a; }}
     };
 
     // parse file
+    std::vector<Directive> directives;
     std::string token;
-    while (ifs && (ifs >> token) && (!ifs.eof())) {
+    while (is && (is >> token) && (!is.eof())) {
         if (token[0] == '#') {
-            ifs.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            is.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
             continue;
         }
 
         if (entityParser.count(token) == 0)
             throw std::runtime_error("Invalid token encountered: " + token);
+
+        const std::streamoff begin = is.tellg();
         entityParser.at(token)();
+        // (tellg() fails at the end of the file)
+        const std::streamoff end = is.good() ? std::streamoff(is.tellg()) : std::streamoff(text.size());
+
+        // normalize white space, so that only real changes are detected by update()
+        std::istringstream args(text.substr(size_t(begin), size_t(end - begin)));
+        Directive d{token, ""};
+        for (std::string word; args >> word; )
+            d.args += (d.args.empty() ? "" : " ") + word;
+        directives.push_back(d);
+    }
+
+    return directives;
+}
+
+//-----------------------------------------------------------------------------
+
+bool Scene::isObject(const std::string &_token)
+{
+    return _token == "plane" || _token == "sphere" || _token == "cylinder" || _token == "mesh";
+}
+
+//-----------------------------------------------------------------------------
+
+void Scene::apply(const Directive &_directive)
+{
+    std::istringstream is(_directive.args);
+    const std::string &token = _directive.token;
+
+    if      (token == "depth")           is >> max_depth;
+    else if (token == "camera")          is >> camera;
+    else if (token == "background")      is >> background;
+    else if (token == "ambience")        is >> ambience;
+    else if (token == "light")           lights.emplace_back(is);
+    else if (token == "compress_meshes") is >> settings.compress_meshes;
+    else if (token == "page_meshes")     is >> settings.page_budget_mb;
+    else if (token == "accelerator")     is >> accelerator;
+}
+
+//-----------------------------------------------------------------------------
+
+Object_ptr Scene::createObject(const Directive &_directive, Source &_source)
+{
+    std::istringstream is(_directive.args);
+    const std::string &token = _directive.token;
+
+    _source.args = _directive.args;
+    _source.token = token;
+
+    if (token == "plane")    return arena.create<Plane>(is);
+    if (token == "sphere")   return arena.create<Sphere>(is);
+    if (token == "cylinder") return arena.create<Cylinder>(is);
+
+    std::string file;
+    std::istringstream(_directive.args) >> file;
+    _source.file = filename.parent_path() / file;
+    _source.mtime = std::filesystem::last_write_time(_source.file);
+    return nullptr;
+}
+
+//-----------------------------------------------------------------------------
+
+std::string Scene::meshKey(const std::string &_args)
+{
+    // mesh arguments: filename, shading, material
+    std::istringstream is(_args);
+    std::string file, mode;
+    is >> file >> mode;
+    return file + " " + mode;
+}
+
+//-----------------------------------------------------------------------------
+
+void Scene::read(const std::filesystem::path &_filename)
+{
+    loadStats = SceneLoadStats();
+    StopWatch timer;
+    timer.start();
+
+    filename = std::filesystem::absolute(_filename);
+    const std::vector<Directive> directives = split(filename);
+    sceneTime = std::filesystem::last_write_time(filename);
+
+    // create objects in file order, but only collect the meshes
+    std::vector<Object_ptr> created;
+    std::vector<PendingMesh> meshes;
+    for (const Directive &d: directives) {
+        if (isObject(d.token)) {
+            Source source;
+            Object_ptr o = createObject(d, source);
+            if (!o) meshes.push_back({created.size(), &d, meshStorage()});
+            created.push_back(o);
+            sources.push_back(source);
+        }
+        else {
+            apply(d);
+            globals.push_back(d);
+        }
     }
+    loadStats.parse_ms = timer.stop();
+
+    // the expensive part: read meshes, compute their normals and bounding boxes
+    loadMeshes(meshes, created);
+    objects.assign(created.begin(), created.end());
+
+    // flatten objects into per-type arrays for rendering
+    timer.start();
+    compiled.compile(objects, settings.bvh, settings.lazy_bvh, objectAccelerator());
+    loadStats.compile_ms = timer.stop();
+    loadedBytes = arena.bytes_allocated();
+}
+
+//-----------------------------------------------------------------------------
+
+bool Scene::outdated() const
+{
+    std::error_code ec;
+    if (std::filesystem::last_write_time(filename, ec) != sceneTime) return true;
+    for (const Source &source: sources)
+        if (!source.file.empty() && std::filesystem::last_write_time(source.file, ec) != source.mtime)
+            return true;
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+
+std::vector<std::filesystem::file_time_type> Scene::inputTimes() const
+{
+    std::error_code ec;
+    std::vector<std::filesystem::file_time_type> times(1, std::filesystem::last_write_time(filename, ec));
+    for (const Source &source: sources)
+        if (!source.file.empty()) times.push_back(std::filesystem::last_write_time(source.file, ec));
+    return times;
+}
+
+//-----------------------------------------------------------------------------
+
+uint64_t Scene::contentHash() const
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    auto add = [&hash](const std::filesystem::path &_file) {
+        std::ifstream file(_file, std::fstream::binary);
+        if (!file) throw std::runtime_error("cannot read " + _file.string());
+        std::vector<char> buffer(1 << 16);
+        while (file.read(buffer.data(), std::streamsize(buffer.size())) || file.gcount() > 0) {
+            for (std::streamsize i=0; i<file.gcount(); ++i)
+                hash = (hash ^ uint64_t(static_cast<unsigned char>(buffer[size_t(i)]))) * 0x100000001b3ull;
+        }
+    };
+
+    add(filename);
+    for (const Source &source: sources)
+        if (!source.file.empty()) add(source.file);
+    return hash;
+}
+
+//-----------------------------------------------------------------------------
+
+bool Scene::update(SceneUpdate &_update)
+{
+    _update = SceneUpdate();
+
+    // replaced objects stay in the arena until the scene is reloaded
+    if (arena.bytes_allocated() > 2 * loadedBytes) return false;
+
+    const auto time = std::filesystem::last_write_time(filename);
+    const std::vector<Directive> directives = split(filename);
+
+    std::vector<Directive> newGlobals, newObjects;
+    for (const Directive &d: directives)
+        (isObject(d.token) ? newObjects : newGlobals).push_back(d);
+
+    // the mesh storage cannot be changed in place
+    auto storage = [](const std::vector<Directive> &_globals) {
+        std::vector<Directive> result;
+        for (const Directive &d: _globals)
+            if (d.token == "compress_meshes" || d.token == "page_meshes") result.push_back(d);
+        return result;
+    };
+    if (storage(newGlobals) != storage(globals)) return false;
+
+    // Match new object directives to loaded objects: first unchanged objects,
+    // then meshes by filename and shading (so that their geometry is reused)
+    // and other objects by their order among the objects of the same type.
+    std::vector<size_t> match(newObjects.size(), objects.size());
+    std::vector<bool> used(objects.size(), false);
+    auto assign = [&](auto _key) {
+        std::map<std::string, std::deque<size_t>> candidates;
+        for (size_t i=0; i<sources.size(); ++i)
+            if (!used[i]) candidates[_key(sources[i].token, sources[i].args)].push_back(i);
+        for (size_t j=0; j<newObjects.size(); ++j) {
+            if (match[j] < objects.size()) continue;
+            auto &c = candidates[_key(newObjects[j].token, newObjects[j].args)];
+            if (c.empty()) continue;
+            match[j] = c.front();
+            used[match[j]] = true;
+            c.pop_front();
+        }
+    };
+    assign([](const std::string &_token, const std::string &_args) { return _token + " " + _args; });
+    assign([](const std::string &_token, const std::string &_args) {
+        return _token == "mesh" ? _token + " " + meshKey(_args) : _token;
+    });
+    _update.removed = size_t(std::count(used.begin(), used.end(), false));
+
+    // First create all new objects (this may fail, e.g. if a mesh cannot be
+    // read), then modify the scene.
+    std::vector<Object_ptr> created(newObjects.size(), nullptr);
+    std::vector<Source> createdSources(newObjects.size());
+    std::vector<PendingMesh> meshes;
+    for (size_t j=0; j<newObjects.size(); ++j) {
+        const Directive &d = newObjects[j];
+        const bool isNew = match[j] == objects.size();
+        const bool meshChanged = !isNew && d.token == "mesh" &&
+            std::filesystem::last_write_time(sources[match[j]].file) != sources[match[j]].mtime;
+
+        if (isNew || meshChanged) {
+            created[j] = createObject(d, createdSources[j]);
+            if (d.token == "mesh") meshes.push_back({j, &d, meshStorage()});
+            if (isNew) ++_update.added;
+        }
+    }
+    loadStats = SceneLoadStats();
+    loadMeshes(meshes, created);
+    _update.meshes = meshes.size();
+
+    // global settings and lights are cheap, apply them again
+    const Accelerator previousAccelerator = objectAccelerator();
+    if (newGlobals != globals) {
+        _update.settings = true;
+        lights.clear();
+        max_depth  = 0;
+        background = ambience = vec3(0, 0, 0);
+        accelerator = Accelerator::AUTO;
+        for (const Directive &d: newGlobals) apply(d);
+        globals = newGlobals;
+    }
+
+    // update matched objects in place
+    std::vector<Object_ptr> newObjectList;
+    std::vector<Source> newSources;
+    std::vector<int> refit;
+    bool restructured = _update.removed > 0 || objectAccelerator() != previousAccelerator;
+    for (size_t j=0; j<newObjects.size(); ++j) {
+        const Directive &d = newObjects[j];
+
+        if (created[j]) {
+            newObjectList.push_back(created[j]);
+            newSources.push_back(createdSources[j]);
+            restructured = true;
+            continue;
+        }
+
+        Object_ptr o = objects[match[j]];
+        Source source = sources[match[j]];
+        if (match[j] != j) restructured = true;
+
+        if (source.args != d.args) {
+            const Material material = o->material;
+            std::istringstream is(d.args);
+            if (d.token == "mesh") {
+                std::string file, mode;
+                is >> file >> mode >> o->material;
+            }
+            else {
+                o->parse(is);
+            }
+
+            // object directives end with the material (3 colors, shininess, mirror)
+            auto geometry = [](const std::string &_args) {
+                std::vector<std::string> words;
+                std::istringstream is(_args);
+                for (std::string w; is >> w; ) words.push_back(w);
+                words.resize(words.size() > 11 ? words.size() - 11 : 0);
+                return words;
+            };
+            if (geometry(source.args) != geometry(d.args)) ++_update.refit;
+            if (material != o->material) ++_update.materials;
+
+            source.args = d.args;
+            refit.push_back(int(j));
+        }
+
+        newObjectList.push_back(o);
+        newSources.push_back(source);
+    }
+
+    // (assign() reuses the arena memory of the object list)
+    objects.assign(newObjectList.begin(), newObjectList.end());
+    sources = std::move(newSources);
+    sceneTime = time;
+
+    screenTilesValid = false;
+    replicas.clear(); // copied again by the next NUMA render
+    if (restructured) {
+        compiled.compile(objects, settings.bvh, settings.lazy_bvh, objectAccelerator());
+        _update.recompiled = true;
+    }
+    else {
+        compiled.refit(refit);
+    }
+
+    return true;
 }
 
 
@@ -15,32 +15,234 @@
 #include "Material.h"
 #include "Image.h"
 #include "Camera.h"
+#include "Tile.h"
+#include "CompiledScene.h"
+#include "SceneArena.h"
+#include "RenderSettings.h"
+#include "PagedMesh.h"
+#include "Mesh.h"
+#include "VisibilityBuffer.h"
+#include "Numa.h"
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <memory_resource>
 #include <filesystem>
 
 //== CLASS DEFINITION =========================================================
 
+/// \class SceneUpdate Scene.h
+/// What an incremental Scene::update() changed.
+struct SceneUpdate
+{
+    /// camera, depth, background, ambience or lights changed
+    bool settings = false;
+    /// objects whose material was changed in place
+    size_t materials = 0;
+    /// objects that were moved or resized in place
+    size_t refit = 0;
+    /// meshes that were (re-)read from disk
+    size_t meshes = 0;
+    /// new and removed objects
+    size_t added = 0, removed = 0;
+    /// whether the compiled scene had to be rebuilt (objects added, removed or reordered)
+    bool recompiled = false;
+};
+
+/// print a summary of an update
+inline std::ostream &operator<<(std::ostream &_os, const SceneUpdate &_update)
+{
+    _os << (_update.settings ? "settings changed, " : "")
+        << _update.materials << " materials, " << _update.refit << " refit, "
+        << _update.meshes << " meshes read, " << _update.added << " added, "
+        << _update.removed << " removed" << (_update.recompiled ? ", recompiled" : "");
+    return _os;
+}
+
+
+/// \class SceneLoadStats Scene.h
+/// Time spent in the stages of loading a scene.
+struct SceneLoadStats
+{
+    /// reading the scene file and creating all objects but meshes
+    double parse_ms = 0;
+    /// loading the meshes (concurrently), and the sum of their individual load times
+    double mesh_ms = 0, mesh_sum_ms = 0;
+    /// sum of the times spent computing vertex normals (see Mesh::compute_normals())
+    double normals_ms = 0;
+    /// flattening the objects and building their hierarchies
+    double compile_ms = 0;
+    /// number of meshes loaded and their triangles
+    size_t meshes = 0, triangles = 0;
+    /// number of threads that loaded meshes
+    int threads = 1;
+};
+
+/// print load statistics
+inline std::ostream &operator<<(std::ostream &_os, const SceneLoadStats &_stats)
+{
+    _os << "parsed in " << _stats.parse_ms << " ms, " << _stats.meshes << " meshes ("
+        << _stats.triangles << " triangles) in " << _stats.mesh_ms << " ms on "
+        << _stats.threads << (_stats.threads == 1 ? " thread" : " threads")
+        << " (" << _stats.mesh_sum_ms << " ms summed, normals " << _stats.normals_ms
+        << " ms), compiled in " << _stats.compile_ms << " ms";
+    return _os;
+}
+
+
+/// \class CullingStats Scene.h
+/// Effect of culling the objects against the frustums of the screen tiles
+/// for primary rays (see Scene::render()).
+struct CullingStats
+{
+    /// bounded objects (spheres, cylinders, meshes) and those in the view frustum
+    size_t objects = 0, visible = 0;
+    /// screen tiles, and those whose primary rays only test a candidate list
+    size_t tiles = 0, listTiles = 0;
+    /// average length of the candidate lists
+    double candidates = 0;
+};
+
+/// print culling statistics
+inline std::ostream &operator<<(std::ostream &_os, const CullingStats &_stats)
+{
+    _os << _stats.visible << " of " << _stats.objects << " objects in view, "
+        << _stats.listTiles << " of " << _stats.tiles << " tiles use candidate lists ("
+        << _stats.candidates << " objects avg)";
+    return _os;
+}
+
+
+/// \class RecursionStats Scene.h
+/// Reflections traced and saved by the weight threshold of the recursion
+/// (see RenderSettings::min_weight).
+struct RecursionStats
+{
+    /// reflected rays traced
+    size_t traced = 0;
+    /// reflections not traced because their weight was below the threshold,
+    /// and those of them ended by Russian roulette (see RenderSettings::roulette)
+    size_t cut = 0, roulette = 0;
+};
+
+/// print recursion statistics
+inline std::ostream &operator<<(std::ostream &_os, const RecursionStats &_stats)
+{
+    const size_t total = _stats.traced + _stats.cut;
+    _os << _stats.traced << " traced, " << _stats.cut << " saved ("
+        << (total ? 100.0 * double(_stats.cut) / double(total) : 0.0) << "%";
+    if (_stats.roulette) _os << ", " << _stats.roulette << " by Russian roulette";
+    _os << ")";
+    return _os;
+}
+
+
+/// \class PreviewStats Scene.h
+/// Pixels traced by a preview render (see RenderSettings::preview)
+struct PreviewStats
+{
+    /// pixels of the image, and of those traced rather than interpolated
+    size_t pixels = 0, traced = 0;
+    /// cells between four samples, and of those interpolated
+    size_t cells = 0, interpolated = 0;
+};
+
+/// print preview statistics
+inline std::ostream &operator<<(std::ostream &_os, const PreviewStats &_stats)
+{
+    _os << (_stats.pixels ? 100.0 * double(_stats.traced) / double(_stats.pixels) : 0.0) << "% of "
+        << _stats.pixels << " pixels traced, " << _stats.interpolated << " of " << _stats.cells
+        << " cells interpolated";
+    return _os;
+}
+
+
+/// \class ScheduleStats Scene.h
+/// How evenly the tiles of a render kept the threads busy (see
+/// RenderSettings::balance). Idle time is the time threads wait at the end
+/// of the frame for the last tile to finish.
+struct ScheduleStats
+{
+    /// threads, and work units (tiles) they rendered
+    size_t threads = 0, units = 0;
+    /// pixels traced by the cost pre-pass, and its time in milliseconds
+    size_t samples = 0;
+    double prepass_ms = 0;
+    /// time from the start of the first to the end of the last tile, summed
+    /// over the bands of a streaming render
+    double frame_ms = 0;
+    /// idle time at the end of the frame, summed over the threads and of the most idle thread
+    double idle_ms = 0, max_idle_ms = 0;
+};
+
+/// print schedule statistics
+inline std::ostream &operator<<(std::ostream &_os, const ScheduleStats &_stats)
+{
+    const double total = double(_stats.threads) * _stats.frame_ms;
+    _os << _stats.units << " tiles on " << _stats.threads << (_stats.threads == 1 ? " thread" : " threads")
+        << ", idle at the end " << _stats.idle_ms << " ms (" << (total > 0 ? 100.0 * _stats.idle_ms / total : 0.0)
+        << "% of thread time, at most " << _stats.max_idle_ms << " ms)";
+    if (_stats.samples)
+        _os << ", cost pre-pass " << _stats.samples << " pixels in " << _stats.prepass_ms << " ms";
+    return _os;
+}
+
+
 /// \class Sphere Sphere.h
 /// This class loads and raytraces scenes consisting of cameras, lights, and
 /// objects
 class Scene {
 public:
     /// Constructor loads scene from file.
-    Scene(const std::filesystem::path &path) {
+    Scene(const std::filesystem::path &path, const RenderSettings &_settings = RenderSettings())
+        : settings(_settings)
+        , lights(&arena)
+        , objects(&arena)
+        , compiled(&arena)
+    {
         read(path);
     }
 
     /// Allocate image and raytrace the scene.
     Image  render();
 
+    /// Raytrace the scene in bands of \c _rows rows and append each band to
+    /// the BMP file \c _filename as soon as it is done, so that only one band
+    /// is held in memory. Returns false if the file cannot be written.
+    bool   renderStreaming(const std::filesystem::path &_filename, unsigned int _rows);
+
+    /// Raytrace the pixels of \c _tile (in parallel if possible) and store
+    /// their colors row by row in \c _pixels.
+    void renderTile(const Tile& _tile, std::vector<vec3>& _pixels);
+
+    /// Raytrace \c _tiles in parallel, one tile per thread at a time. When a
+    /// tile is done, the thread that rendered it calls \c _done with the
+    /// tile's index and its colors (row by row); calls may be concurrent.
+    void renderTiles(const std::vector<Tile>& _tiles,
+                     const std::function<void(size_t, const std::vector<vec3>&)>& _done);
+
+    /// Compute the (clamped) color of pixel (\c _x, \c _y), and if \c _object
+    /// is given, store the object seen there in it (-1: background)
+    vec3 renderPixel(unsigned int _x, unsigned int _y, int* _object = nullptr);
+
+    /// Render \c _img from a lattice of every RenderSettings::preview-th
+    /// pixel: cells between four samples that see the same object with
+    /// similar colors are interpolated, the others are traced.
+    void renderPreview(Image &_img);
+
     /// Determine the color seen by a viewing ray
     /**
     *    @param[in] _ray passed Ray
     *    @param[in] _depth holds the information, how many times the `_ray` had been reflected. Goes from 0 to max_depth. Should be used for recursive function call.
+    *    @param[in] _primary for primary rays: their candidate objects and rasterized hit (see CompiledScene::Primary)
+    *    @param[in] _weight contribution of the ray's color to the pixel, reflections below RenderSettings::min_weight are not traced
+    *    @param[out] _object if given, the object hit by `_ray` (-1: none)
     *    @return    color
     **/    
-    vec3  trace(const Ray& _ray, int _depth);
+    vec3  trace(const Ray& _ray, int _depth, const CompiledScene::Primary* _primary = nullptr, double _weight = 1.0,
+                int* _object = nullptr);
 
     /// Computes the closest intersection point between a ray and all objects in the scene.
     /**
@@ -62,23 +264,245 @@ public:
     */
     vec3  lighting(const vec3& _point, const vec3& _normal, const vec3& _view, const Material& _material);
 
+    /// Phong lighting like lighting(), specialized for materials with or
+    /// without specular highlights (see MaterialClass)
+    template <bool SPECULAR>
+    vec3  shade(const vec3& _point, const vec3& _normal, const vec3& _view, const Material& _material);
+
+    /// Load the scene from a file and compile its objects for rendering.
+    /// The scene file is parsed first, then all meshes are loaded concurrently.
     void read(const std::filesystem::path &filename);
 
+    /// Has the scene file or one of its mesh files been modified since it was read?
+    bool outdated() const;
+
+    /// current modification times of the scene file and its mesh files
+    std::vector<std::filesystem::file_time_type> inputTimes() const;
+
+    /// Hash of the contents of the scene file and its mesh files (64-bit
+    /// FNV-1a), which identifies the scene e.g. for a Checkpoint.
+    uint64_t contentHash() const;
+
+    /// Bring the scene up to date with its (modified) scene file by applying
+    /// only the differences: changed camera, lights and materials are applied
+    /// in place, moved objects are refit in the compiled scene, and only
+    /// meshes that are new or whose file changed are read. Returns false if
+    /// the scene cannot be updated incrementally (changed mesh storage, or too
+    /// much memory held by replaced objects) and has to be loaded again.
+    bool update(SceneUpdate &_update);
+
     size_t numObjects() const { return objects.size(); }
 
     // Accessors for scene objects and camera for debugging.
-    const std::vector<std::unique_ptr<Object>> &getObjects() const { return objects; }
+    const std::pmr::vector<Object_ptr> &getObjects() const { return objects; }
     const Camera &getCamera() const { return camera; }
+    /// Replace the camera, e.g. to render the scene from another view point.
+    void setCamera(const Camera &_camera) { camera = _camera; screenTilesValid = false; }
+    const CompiledScene &getCompiled() const { return compiled; }
+    const SceneArena &getArena() const { return arena; }
+    /// culling of the last render() (see RenderSettings::frustum_culling)
+    const CullingStats &getCullingStats() const { return cullingStats; }
+
+    /// Work per NUMA node of the last render (see RenderSettings::numa)
+    const NumaStats &getNumaStats() const { return numaStats; }
+
+    /// Rays (primary, reflected and shadow rays) traced by the last render()
+    /// or renderStreaming(), plus those of renderTile() calls since then
+    size_t getRayCount() const { return rayCount; }
+
+    /// Reflections traced and saved by RenderSettings::min_weight, counted like getRayCount()
+    RecursionStats getRecursionStats() const { return {reflectionCount, cutCount, rouletteCount}; }
+
+    /// Pixels traced by the last render() if it was a preview (see RenderSettings::preview)
+    const PreviewStats &getPreviewStats() const { return previewStats; }
+
+    /// Load balance of the last render() or renderStreaming()
+    const ScheduleStats &getScheduleStats() const { return scheduleStats; }
+
+    /// Statistics of rasterizing the primary hits of the last render
+    const VisibilityStats &getVisibilityStats() const { return visibility.stats(); }
+    /// timing of loading the scene (update() only records the meshes it read)
+    const SceneLoadStats &getLoadStats() const { return loadStats; }
+    /// page cache of out-of-core meshes, nullptr if meshes are not paged
+    const PageCache *getPageCache() const { return pageCache.get(); }
+
+    /// Memory held by the scene: its arena plus the budget of the page cache.
+    size_t memory_bytes() const
+    {
+        return arena.bytes_reserved() + (pageCache ? pageCache->budget() : 0);
+    }
+
+private:
+    /// A directive of the scene file and its arguments (white space normalized).
+    struct Directive
+    {
+        std::string token;
+        std::string args;
+        bool operator==(const Directive &_d) const { return token == _d.token && args == _d.args; }
+        bool operator!=(const Directive &_d) const { return !(*this == _d); }
+    };
+
+    /// The directive an object was created from.
+    struct Source
+    {
+        std::string token;
+        std::string args;
+        /// mesh file and its modification time when it was read (meshes only)
+        std::filesystem::path file;
+        std::filesystem::file_time_type mtime;
+    };
+
+    /// Split a scene file into its directives, without loading meshes.
+    static std::vector<Directive> split(const std::filesystem::path &filename);
+
+    /// Is \c _token an object directive?
+    static bool isObject(const std::string &_token);
+
+    /// Filename and shading of a mesh directive, which identify its geometry.
+    static std::string meshKey(const std::string &_args);
+
+    /// Apply a non-object directive.
+    void apply(const Directive &_directive);
+
+    /// A mesh directive whose mesh is created by loadMeshes().
+    struct PendingMesh
+    {
+        /// index of the mesh in the object list
+        size_t index;
+        const Directive *directive;
+        /// storage selected by the settings in effect at the directive
+        Mesh::Storage storage;
+    };
+
+    /// Create the object of an object directive and describe its source.
+    /// Meshes are only described; they are created by loadMeshes() and
+    /// nullptr is returned.
+    Object_ptr createObject(const Directive &_directive, Source &_source);
+
+    /// Mesh storage selected in the settings (creates the page cache if needed).
+    Mesh::Storage meshStorage();
+
+    /// Raytrace the rows \c _y0 to \c _y0 + _band.height() of the image into
+    /// \c _band, tile by tile in parallel if possible.
+    void renderBand(Image &_band, unsigned int _y0);
+
+    /// Report the number of threads used by renderBand()
+    static void printThreads();
+
+    /// Tiles of \c _width x \c _height pixels of the band at row \c _y0
+    /// of roughly equal render cost, most expensive first: the cost of
+    /// blocks is estimated by timing a sparse sample of their pixels, and
+    /// runs of cheap blocks in a row are merged (see RenderSettings::balance).
+    std::vector<Tile> balancedTiles(unsigned int _width, unsigned int _height, unsigned int _y0);
+
+    /// Render \c _tiles with \c _render on threads pinned to the NUMA nodes
+    /// (see RenderSettings::numa), replicating the geometry if requested.
+    void renderTilesNuma(const std::vector<Tile> &_tiles, const std::function<void(const Tile&)> &_render);
+
+    /// The compiled scene to intersect on the calling thread: the replica
+    /// on its NUMA node while rendering with replicas, else `compiled`.
+    const CompiledScene &threadGeometry() const;
+
+    /// Cull the objects against the frustum of each screen tile and rasterize
+    /// the visibility buffer (as enabled in the settings), unless they are
+    /// still up to date. Tiles with few candidates keep them in a list.
+    void prepareTiles();
+
+    /// Candidates of the primary rays of pixel (\c _x, \c _y), or nullptr
+    /// if they have to be intersected with the whole scene.
+    const std::vector<int> *primaryCandidates(unsigned int _x, unsigned int _y) const;
+
+    /// Load \c _meshes concurrently and store them at their index in \c _objects.
+    /// Progress messages are printed in order, and the first error is rethrown.
+    void loadMeshes(const std::vector<PendingMesh> &_meshes, std::vector<Object_ptr> &_objects);
 
 private:
+    /// Memory for all scene data (objects, meshes, lights, compiled scene).
+    /// Declared first, so that it is destroyed last: dropping the scene
+    /// frees a handful of blocks instead of every object individually.
+    SceneArena arena;
+
+    /// loading and rendering options
+    RenderSettings settings;
+
+    /// page cache for out-of-core meshes (see RenderSettings::page_budget_mb)
+    std::unique_ptr<PageCache> pageCache;
+
     /// camera stores eye position, view direction, and can generate primary rays
     Camera camera;
 
     /// array for all lights in the scene
-    std::vector<Light> lights;
+    std::pmr::vector<Light> lights;
+
+    /// array for all the objects in the scene (allocated in `arena`)
+    std::pmr::vector<Object_ptr> objects;
+
+    /// flattened copy of `objects` that is used for ray intersections
+    CompiledScene compiled;
+
+    /// absolute path of the scene file and its modification time when it was read
+    std::filesystem::path filename;
+    std::filesystem::file_time_type sceneTime;
+
+    /// non-object directives of the scene file, in order
+    std::vector<Directive> globals;
+
+    /// source directive of each object in `objects`
+    std::vector<Source> sources;
+
+    /// arena memory in use after loading (see update())
+    size_t loadedBytes = 0;
+
+    /// timing of loading the scene (see getLoadStats())
+    SceneLoadStats loadStats;
 
-    /// array for all the objects in the scene
-    std::vector<std::unique_ptr<Object>> objects;
+    /// candidate objects of the primary rays of a screen tile
+    struct ScreenTile
+    {
+        /// whether primary rays only test `prims` (or the whole scene)
+        bool useList = false;
+        std::vector<int> prims;
+    };
+
+    /// screen tiles row by row (see prepareTiles()), and whether they belong
+    /// to the current camera and objects
+    std::vector<ScreenTile> screenTiles;
+    unsigned int screenColumns = 0;
+    bool screenTilesValid = false;
+    CullingStats cullingStats;
+
+    /// primitive seen at each pixel (see RenderSettings::rasterize)
+    VisibilityBuffer visibility;
+
+    /// copies of `compiled` per NUMA node (see RenderSettings::numa_replicate),
+    /// and the work per node of the last render
+    std::vector<std::unique_ptr<CompiledScene>> replicas;
+    NumaStats numaStats;
+
+    /// pixels traced by the last preview
+    PreviewStats previewStats;
+
+    /// load balance of the last render
+    ScheduleStats scheduleStats;
+
+    /// rays traced (see getRayCount()) and reflections traced and cut (see
+    /// getRecursionStats()); threads add their counts after each tile
+    std::atomic<size_t> rayCount{0};
+    std::atomic<size_t> reflectionCount{0}, cutCount{0}, rouletteCount{0};
+
+    /// add the counts of the calling thread to rayCount etc., and reset the counters
+    void flushThreadCounts();
+    /// reset rayCount etc. before a render
+    void resetCounts();
+
+    /// structure over the objects requested by the scene's `accelerator` directive
+    Accelerator accelerator = Accelerator::AUTO;
+
+    /// the structure to build: RenderSettings::accelerator, unless that is AUTO
+    Accelerator objectAccelerator() const
+    {
+        return settings.accelerator != Accelerator::AUTO ? settings.accelerator : accelerator;
+    }
 
     /// max recursion depth for mirroring
     int max_depth = 0;
@@ -0,0 +1,140 @@
+#pragma once
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <iostream>
+
+
+/// \class SceneArena SceneArena.h
+/// Monotonic memory resource that holds all data of one scene: objects, mesh
+/// buffers, lights, materials and acceleration structures. Allocations are
+/// carved out of a few large blocks, deallocation is a no-op, and all memory
+/// is returned at once when the arena is released or destroyed.
+///
+/// Objects created with create() are never destroyed individually, so they
+/// must keep all of their heap storage inside the arena as well (e.g. by
+/// using std::pmr containers constructed with the arena as resource).
+/// Allocation is thread-safe, so meshes may be loaded concurrently.
+class SceneArena : public std::pmr::memory_resource
+{
+public:
+
+    /// Construct an empty arena. The first block will have \c _initial_size bytes,
+    /// subsequent blocks grow geometrically.
+    explicit SceneArena(size_t _initial_size = 1 << 20)
+        : blocks_(std::pmr::new_delete_resource())
+        , monotonic_(_initial_size, &blocks_)
+    {}
+
+    SceneArena(const SceneArena&) = delete;
+    SceneArena& operator=(const SceneArena&) = delete;
+
+    /// Allocate and construct an object of type \c T inside the arena.
+    /// Its destructor will never be called.
+    template <class T, class... Args>
+    T* create(Args&&... _args)
+    {
+        void* p = allocate(sizeof(T), alignof(T));
+        return new (p) T(std::forward<Args>(_args)...);
+    }
+
+    /// Return all memory to the system in one go. Everything allocated from
+    /// the arena becomes invalid.
+    void release()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        monotonic_.release();
+        num_allocations_ = bytes_allocated_ = 0;
+    }
+
+    /// Number of allocations served by the arena
+    size_t num_allocations() const { return num_allocations_; }
+
+    /// Number of bytes handed out by the arena
+    size_t bytes_allocated() const { return bytes_allocated_; }
+
+    /// Number of blocks requested from the system
+    size_t num_blocks() const { return blocks_.num_blocks; }
+
+    /// Number of bytes currently requested from the system
+    size_t bytes_reserved() const { return blocks_.bytes; }
+
+private:
+
+    void* do_allocate(size_t _bytes, size_t _alignment) override
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++num_allocations_;
+        bytes_allocated_ += _bytes;
+        return monotonic_.allocate(_bytes, _alignment);
+    }
+
+    void do_deallocate(void*, size_t, size_t) override
+    {
+        // memory is only returned by release()
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& _other) const noexcept override
+    {
+        return this == &_other;
+    }
+
+private:
+
+    /// upstream resource that counts the blocks of the monotonic resource
+    struct BlockCounter : public std::pmr::memory_resource
+    {
+        explicit BlockCounter(std::pmr::memory_resource* _upstream) : upstream(_upstream) {}
+
+        void* do_allocate(size_t _bytes, size_t _alignment) override
+        {
+            ++num_blocks;
+            bytes += _bytes;
+            return upstream->allocate(_bytes, _alignment);
+        }
+
+        void do_deallocate(void* _p, size_t _bytes, size_t _alignment) override
+        {
+            --num_blocks;
+            bytes -= _bytes;
+            upstream->deallocate(_p, _bytes, _alignment);
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource& _other) const noexcept override
+        {
+            return this == &_other;
+        }
+
+        std::pmr::memory_resource* upstream;
+        size_t num_blocks = 0;
+        size_t bytes      = 0;
+    };
+
+    BlockCounter blocks_;
+    std::pmr::monotonic_buffer_resource monotonic_;
+    std::mutex mutex_;
+
+    size_t num_allocations_ = 0;
+    size_t bytes_allocated_ = 0;
+};
+
+
+/// print allocation statistics of an arena
+inline std::ostream& operator<<(std::ostream& _os, const SceneArena& _arena)
+{
+    _os << _arena.num_allocations() << " allocations, "
+        << _arena.bytes_allocated() / (1024.0*1024.0) << " MB in "
+        << _arena.num_blocks() << " blocks";
+    return _os;
+}
@@ -40,3 +40,21 @@ inline size_t solveQuadratic(double a, double b, double c, std::array<double, 2>
     solns = { a_x1 / a, c / a_x1 };
     return 2;
 }
+
+// Variant of solveQuadratic() for SIMD loops over rays: returns the number of
+// solutions and stores them in t0 and t1 (which are unchanged if there is none).
+// Written without branches, so that compilers can vectorize the calling loop.
+inline int solveQuadratic(double a, double b, double c, double &t0, double &t1) {
+    const bool linear = std::abs(a) < 1e-10;
+    const double discriminant = b * b - 4 * a * c;
+    const double a_x1 = -0.5 * (b + copysign(std::sqrt(discriminant < 0 ? 0.0 : discriminant), b));
+
+    // all candidates are computed, so that only selections depend on the case
+    const double linear_x = - c / b, x1 = a_x1 / a, x2 = c / a_x1;
+
+    const bool none = (linear & (std::abs(b) < 1e-10)) | (!linear & (discriminant < 0));
+    const bool two  = !linear & (discriminant >= 0);
+    t0 = none ? t0 : (linear ? linear_x : x1);
+    t1 = two ? x2 : t1;
+    return none ? 0 : (two ? 2 : 1);
+}
@@ -13,6 +13,7 @@
 
 #include "Sphere.h"
 #include "SolveQuadratic.h"
+#include <algorithm>
 
 //== IMPLEMENTATION =========================================================
 
@@ -26,35 +27,58 @@ Sphere::Sphere(const vec3& _center, double _radius)
 //-----------------------------------------------------------------------------
 
 
-bool
+void
 Sphere::
-intersect(const Ray&  _ray,
-          vec3&       _intersection_point,
-          vec3&       _intersection_normal,
-          double&     _intersection_t) const
+intersect(const RayBatch& _batch, int _id) const
 {
-
-    const vec3 &dir = _ray.direction;
-    const vec3   oc = _ray.origin - center;
-
-    std::array<double, 2> t;
-    size_t nsol = solveQuadratic(dot(dir, dir),
-                                 2 * dot(dir, oc),
-                                 dot(oc, oc) - radius * radius, t);
-
-    _intersection_t = NO_INTERSECTION;
-
-    // Find the closest valid solution (in front of the viewer)
-    for (size_t i = 0; i < nsol; ++i) {
-        if (t[i] > 0) _intersection_t = std::min(_intersection_t, t[i]);
+    const double cx = center[0], cy = center[1], cz = center[2];
+    const double rr = radius * radius;
+
+    const double *ox = _batch.ox, *oy = _batch.oy, *oz = _batch.oz;
+    const double *dx = _batch.dx, *dy = _batch.dy, *dz = _batch.dz;
+    double *tmin   = _batch.t;
+    int    *object = _batch.object;
+    int    *prim   = _batch.prim;
+    const int n    = _batch.size;
+
+#if HAVE_OPENMP
+#  pragma omp simd
+#endif
+    for (int i = 0; i < n; ++i)
+    {
+        // m = origin - center
+        const double mx = ox[i] - cx, my = oy[i] - cy, mz = oz[i] - cz;
+
+        double t0 = NO_INTERSECTION, t1 = NO_INTERSECTION;
+        solveQuadratic(dx[i]*dx[i] + dy[i]*dy[i] + dz[i]*dz[i],
+                       2 * (dx[i]*mx + dy[i]*my + dz[i]*mz),
+                       (mx*mx + my*my + mz*mz) - rr, t0, t1);
+
+        // Find the closest valid solution (in front of the viewer)
+        const double t = std::min(t0 > 0 ? t0 : NO_INTERSECTION,
+                                  t1 > 0 ? t1 : NO_INTERSECTION);
+
+        // replace the closest hit by selections (not branches), so that the loop vectorizes
+        const double t_hit = tmin[i];
+        const int    o_hit = object[i], p_hit = prim[i];
+        const bool   closer = t < t_hit;
+        tmin[i]   = closer ? t   : t_hit;
+        object[i] = closer ? _id : o_hit;
+        prim[i]   = closer ? 0   : p_hit;
     }
+}
 
-    if (_intersection_t == NO_INTERSECTION) return false;
 
-    _intersection_point  = _ray(_intersection_t);
-    _intersection_normal = (_intersection_point - center) / radius;
+//-----------------------------------------------------------------------------
+
 
-    return true;
+void
+Sphere::
+hit_attributes(const Ray& _ray, const HitRecord& _hit, vec3& _point, vec3& _normal) const
+{
+    _point  = _ray(_hit.t);
+    _normal = (_point - center) / radius;
 }
 
+
 //=============================================================================
@@ -0,0 +1,53 @@
+#pragma once
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+#include <algorithm>
+#include <vector>
+
+
+/// \class Tile Tile.h
+/// A rectangular block of pixels [x0, x0+width) x [y0, y0+height) of an image.
+struct Tile
+{
+    /// left-most column
+    unsigned int x0 = 0;
+    /// bottom-most row
+    unsigned int y0 = 0;
+    /// number of columns
+    unsigned int width = 0;
+    /// number of rows
+    unsigned int height = 0;
+
+    /// number of pixels in the tile
+    size_t size() const { return size_t(width) * height; }
+};
+
+
+/// Cut an image of \c _width x \c _height pixels into tiles of at most
+/// \c _tile_size x \c _tile_size pixels, row by row starting at the bottom.
+inline std::vector<Tile> make_tiles(unsigned int _width, unsigned int _height, unsigned int _tile_size)
+{
+    std::vector<Tile> tiles;
+    _tile_size = std::max(_tile_size, 1u);
+    for (unsigned int y=0; y<_height; y+=_tile_size)
+    {
+        for (unsigned int x=0; x<_width; x+=_tile_size)
+        {
+            Tile t;
+            t.x0     = x;
+            t.y0     = y;
+            t.width  = std::min(_tile_size, _width  - x);
+            t.height = std::min(_tile_size, _height - y);
+            tiles.push_back(t);
+        }
+    }
+    return tiles;
+}
@@ -0,0 +1,291 @@
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+#include "VisibilityBuffer.h"
+#include "StopWatch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if HAVE_OPENMP
+#  include <omp.h>
+#endif
+
+
+namespace {
+
+/// edge length of the screen tiles that are rasterized in parallel
+constexpr unsigned int RASTER_TILE_SIZE = 32;
+
+/// pixel range [_lo, _hi] of the continuous coordinates [_min, _max] on a
+/// screen of \c _size pixels; false if it is empty
+bool pixel_range(double _min, double _max, unsigned int _size, unsigned int& _lo, unsigned int& _hi)
+{
+    if (!(_max >= 0) || !(_min <= double(_size) - 1)) return false;
+    _lo = _min <= 0 ? 0u : (unsigned int)std::ceil(_min);
+    _hi = _max >= double(_size) - 1 ? _size - 1 : (unsigned int)std::floor(_max);
+    return _lo <= _hi;
+}
+
+/// quadric binned into a screen tile, with the pixel rectangle it projects to
+struct QuadricEntry
+{
+    int prim;
+    unsigned int x0, y0, x1, y1;
+};
+
+} // namespace
+
+
+//-----------------------------------------------------------------------------
+
+
+void VisibilityBuffer::clear()
+{
+    width_ = height_ = 0;
+    std::vector<float>().swap(depth_);
+    std::vector<int>().swap(prim_);
+    std::vector<int>().swap(triangle_);
+    stats_ = VisibilityStats();
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void VisibilityBuffer::build(const CompiledScene& _scene, const Camera& _camera)
+{
+    StopWatch timer;
+    timer.start();
+
+    clear();
+    width_  = _camera.width;
+    height_ = _camera.height;
+    const size_t pixels = size_t(width_) * height_;
+    if (pixels == 0) return;
+
+    depth_.assign(pixels, std::numeric_limits<float>::infinity());
+    prim_.assign(pixels, -1);
+    triangle_.assign(pixels, -1);
+
+    const auto& tris   = _scene.triangles_;
+    const auto& meshes = _scene.meshes_;
+    const auto& prims  = _scene.object_prims_;
+
+    // project the triangles of resident meshes (in parallel per mesh)
+    std::vector<int> mesh_prims;
+    std::vector<size_t> first_screen;
+    size_t n_screen = 0;
+    for (int j = 0; j < int(prims.size()); ++j)
+    {
+        if (prims[j].kind != CompiledScene::TRIANGLE) continue;
+        const int m = prims[j].slot;
+        if (meshes.compressed[m] || meshes.paged[m]) continue;
+        mesh_prims.push_back(j);
+        first_screen.push_back(n_screen);
+        n_screen += size_t(meshes.end[m] - meshes.begin[m]);
+    }
+
+    std::vector<ScreenTriangle> screen(n_screen);
+    std::vector<char> visible(n_screen, 0);
+
+#if HAVE_OPENMP
+#  pragma omp parallel for schedule(dynamic, 1)
+#endif
+    for (int k = 0; k < int(mesh_prims.size()); ++k)
+    {
+        const int j = mesh_prims[k];
+        const int m = prims[j].slot;
+        for (int i = meshes.begin[m]; i < meshes.end[m]; ++i)
+        {
+            const size_t s = first_screen[k] + size_t(i - meshes.begin[m]);
+            const vec3 p0(tris.px[i], tris.py[i], tris.pz[i]);
+            const vec3 v[3] = { p0,
+                                p0 - vec3(tris.e1x[i], tris.e1y[i], tris.e1z[i]),
+                                p0 - vec3(tris.e2x[i], tris.e2y[i], tris.e2z[i]) };
+
+            ScreenTriangle& t = screen[s];
+            bool in_front = true;
+            for (int c = 0; c < 3 && in_front; ++c)
+            {
+                double depth;
+                in_front = _camera.project(v[c], t.x[c], t.y[c], depth);
+                t.inv_depth[c] = 1.0 / depth;
+            }
+            t.prim     = j;
+            t.triangle = i - meshes.begin[m];
+            visible[s] = in_front ? 1 : 2;
+        }
+    }
+
+    // bin triangles and quadrics into screen tiles
+    const unsigned int columns = (width_  + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+    const unsigned int rows    = (height_ + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+    std::vector<std::vector<int>> tri_bins(size_t(columns) * rows);
+    std::vector<std::vector<QuadricEntry>> quad_bins(size_t(columns) * rows);
+
+    auto bin = [&](auto& _bins, const auto& _item,
+                   unsigned int _x0, unsigned int _y0, unsigned int _x1, unsigned int _y1) {
+        for (unsigned int r = _y0 / RASTER_TILE_SIZE; r <= _y1 / RASTER_TILE_SIZE; ++r)
+            for (unsigned int c = _x0 / RASTER_TILE_SIZE; c <= _x1 / RASTER_TILE_SIZE; ++c)
+                _bins[size_t(r) * columns + c].push_back(_item);
+    };
+
+    for (size_t s = 0; s < n_screen; ++s)
+    {
+        if (visible[s] == 2) { ++stats_.clipped; continue; }
+        const ScreenTriangle& t = screen[s];
+        unsigned int x0, x1, y0, y1;
+        if (!pixel_range(std::min({t.x[0], t.x[1], t.x[2]}), std::max({t.x[0], t.x[1], t.x[2]}), width_,  x0, x1)) continue;
+        if (!pixel_range(std::min({t.y[0], t.y[1], t.y[2]}), std::max({t.y[0], t.y[1], t.y[2]}), height_, y0, y1)) continue;
+        bin(tri_bins, int(s), x0, y0, x1, y1);
+        ++stats_.triangles;
+    }
+
+    for (int j = 0; j < int(prims.size()); ++j)
+    {
+        if (prims[j].kind == CompiledScene::TRIANGLE) continue;
+
+        // projected bounding box; the whole screen if it reaches behind the eye
+        const Aabb box = _scene.bounds(prims[j]);
+        double x_min = 0, x_max = width_ - 1.0, y_min = 0, y_max = height_ - 1.0;
+        bool in_front = true;
+        Aabb rect;
+        for (int c = 0; c < 8 && in_front; ++c)
+        {
+            const vec3 p((c & 1) ? box.max[0] : box.min[0],
+                         (c & 2) ? box.max[1] : box.min[1],
+                         (c & 4) ? box.max[2] : box.min[2]);
+            double x, y, depth;
+            in_front = _camera.project(p, x, y, depth);
+            if (in_front) rect.grow(vec3(x, y, 0));
+        }
+        if (in_front)
+        {
+            // (the exact ray test decides about the border pixels)
+            x_min = std::floor(rect.min[0]); x_max = std::ceil(rect.max[0]);
+            y_min = std::floor(rect.min[1]); y_max = std::ceil(rect.max[1]);
+        }
+
+        unsigned int x0, x1, y0, y1;
+        if (!pixel_range(x_min, x_max, width_, x0, x1)) continue;
+        if (!pixel_range(y_min, y_max, height_, y0, y1)) continue;
+        bin(quad_bins, QuadricEntry{j, x0, y0, x1, y1}, x0, y0, x1, y1);
+        ++stats_.quadrics;
+    }
+
+    // rasterize the tiles in parallel, each writes its own pixels only
+#if HAVE_OPENMP
+#  pragma omp parallel for schedule(dynamic, 1)
+#endif
+    for (int b = 0; b < int(tri_bins.size()); ++b)
+    {
+        const unsigned int x0 = (unsigned int)(b % columns) * RASTER_TILE_SIZE;
+        const unsigned int y0 = (unsigned int)(b / columns) * RASTER_TILE_SIZE;
+        const unsigned int x1 = std::min(x0 + RASTER_TILE_SIZE, width_)  - 1;
+        const unsigned int y1 = std::min(y0 + RASTER_TILE_SIZE, height_) - 1;
+
+        for (int s: tri_bins[b])  rasterize(screen[s], x0, y0, x1, y1);
+        for (const QuadricEntry& q: quad_bins[b])
+            raycast(_scene, _camera, q.prim, std::max(q.x0, x0), std::max(q.y0, y0),
+                    std::min(q.x1, x1), std::min(q.y1, y1));
+    }
+
+    size_t covered = 0;
+    for (int p: prim_) covered += p >= 0;
+    stats_.coverage = double(covered) / double(pixels);
+    stats_.build_ms = timer.stop();
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void VisibilityBuffer::rasterize(const ScreenTriangle& _t, unsigned int _x0, unsigned int _y0,
+                                 unsigned int _x1, unsigned int _y1)
+{
+    // edge function of the edge opposite to vertex c is a[c]*x + b[c]*y + c[c],
+    // normalized to 1 at vertex c, so that they are the barycentric coordinates
+    const double area = (_t.x[1] - _t.x[0]) * (_t.y[2] - _t.y[0]) - (_t.x[2] - _t.x[0]) * (_t.y[1] - _t.y[0]);
+    if (!(std::fabs(area) > 0)) return;
+
+    double ea[3], eb[3], ec[3];
+    for (int c = 0; c < 3; ++c)
+    {
+        const int i = (c + 1) % 3, k = (c + 2) % 3;
+        ea[c] = (_t.y[i] - _t.y[k]) / area;
+        eb[c] = (_t.x[k] - _t.x[i]) / area;
+        ec[c] = (_t.x[i] * _t.y[k] - _t.x[k] * _t.y[i]) / area;
+    }
+
+    // clip the tile to the triangle's bounding rectangle
+    unsigned int x0, x1, y0, y1;
+    if (!pixel_range(std::min({_t.x[0], _t.x[1], _t.x[2]}), std::max({_t.x[0], _t.x[1], _t.x[2]}), width_,  x0, x1)) return;
+    if (!pixel_range(std::min({_t.y[0], _t.y[1], _t.y[2]}), std::max({_t.y[0], _t.y[1], _t.y[2]}), height_, y0, y1)) return;
+    x0 = std::max(x0, _x0); x1 = std::min(x1, _x1);
+    y0 = std::max(y0, _y0); y1 = std::min(y1, _y1);
+    if (x0 > x1 || y0 > y1) return;
+
+    const int prim = _t.prim, triangle = _t.triangle;
+    for (unsigned int y = y0; y <= y1; ++y)
+    {
+        const double r0 = eb[0] * y + ec[0], r1 = eb[1] * y + ec[1], r2 = eb[2] * y + ec[2];
+        const size_t row = size_t(y) * width_;
+        float* depth = depth_.data() + row;
+        int*   prims = prim_.data() + row;
+        int*   tris  = triangle_.data() + row;
+
+#if HAVE_OPENMP
+#  pragma omp simd
+#endif
+        for (unsigned int x = x0; x <= x1; ++x)
+        {
+            const double w0 = ea[0] * x + r0, w1 = ea[1] * x + r1, w2 = ea[2] * x + r2;
+            // 1/depth is affine in screen space
+            const float d = float(1.0 / (w0 * _t.inv_depth[0] + w1 * _t.inv_depth[1] + w2 * _t.inv_depth[2]));
+            if (w0 >= 0 && w1 >= 0 && w2 >= 0 && d < depth[x])
+            {
+                depth[x] = d;
+                prims[x] = prim;
+                tris[x]  = triangle;
+            }
+        }
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+void VisibilityBuffer::raycast(const CompiledScene& _scene, const Camera& _camera, int _prim,
+                               unsigned int _x0, unsigned int _y0, unsigned int _x1, unsigned int _y1)
+{
+    for (unsigned int y = _y0; y <= _y1; ++y)
+    {
+        for (unsigned int x = _x0; x <= _x1; ++x)
+        {
+            const Ray ray = _camera.primary_ray(x, y);
+
+            CompiledScene::Hit hit;
+            _scene.intersect_prim(ray, _prim, hit);
+            if (hit.object < 0) continue;
+
+            const size_t i = size_t(y) * width_ + x;
+            const float d = float(hit.t * dot(ray.direction, _camera.view_direction()));
+            if (d < depth_[i])
+            {
+                depth_[i]    = d;
+                prim_[i]     = _prim;
+                triangle_[i] = -1;
+            }
+        }
+    }
+}
@@ -0,0 +1,107 @@
+#pragma once
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+#include "Camera.h"
+#include "CompiledScene.h"
+
+#include <iostream>
+#include <vector>
+
+
+/// \class VisibilityStats VisibilityBuffer.h
+/// Work and coverage of rasterizing the primary hits
+struct VisibilityStats
+{
+    /// triangles rasterized, and triangles skipped because they reach behind the eye
+    size_t triangles = 0, clipped = 0;
+    /// spheres and cylinders rasterized
+    size_t quadrics = 0;
+    /// fraction of the pixels that are covered by a rasterized primitive
+    double coverage = 0;
+    /// wall-clock time of binning and rasterization in milliseconds
+    double build_ms = 0;
+};
+
+/// print visibility buffer statistics
+inline std::ostream& operator<<(std::ostream& _os, const VisibilityStats& _s)
+{
+    _os << _s.triangles << " triangles (" << _s.clipped << " clipped) and "
+        << _s.quadrics << " spheres/cylinders rasterized in " << _s.build_ms
+        << " ms, " << 100.0 * _s.coverage << "% of the pixels covered";
+    return _os;
+}
+
+
+/// \class VisibilityBuffer VisibilityBuffer.h
+/// The primitive seen at each pixel, found by rasterizing the compiled scene
+/// from the camera. Primary rays start from this hit (see
+/// CompiledScene::Primary), which bounds their search through the hierarchies.
+/// Triangles of resident meshes are scan converted, spheres and cylinders are
+/// ray cast within their projected bounding rectangles; planes, compressed and
+/// paged meshes, and triangles reaching behind the eye are left to the ray tracer.
+/// The screen is split into tiles that are rasterized in parallel.
+class VisibilityBuffer
+{
+public:
+
+    /// Visible primitive at a pixel
+    struct Entry
+    {
+        /// primitive of the object hierarchy (-1 if none)
+        int prim = -1;
+        /// triangle within its mesh (-1 if the primitive is no mesh)
+        int triangle = -1;
+    };
+
+    /// Rasterize the primary hits of \c _scene seen through \c _camera.
+    void build(const CompiledScene& _scene, const Camera& _camera);
+
+    /// drop the buffer
+    void clear();
+
+    /// Is there a buffer (see build())?
+    bool empty() const { return prim_.empty(); }
+
+    /// Visible primitive at pixel (\c _x, \c _y)
+    Entry operator()(unsigned int _x, unsigned int _y) const
+    {
+        const size_t i = size_t(_y) * width_ + _x;
+        return Entry{prim_[i], triangle_[i]};
+    }
+
+    /// statistics of the last build()
+    const VisibilityStats& stats() const { return stats_; }
+
+private:
+
+    /// triangle in screen space: pixel coordinates and inverse depths of its vertices
+    struct ScreenTriangle
+    {
+        double x[3], y[3], inv_depth[3];
+        int prim, triangle;
+    };
+
+    void rasterize(const ScreenTriangle& _t, unsigned int _x0, unsigned int _y0,
+                   unsigned int _x1, unsigned int _y1);
+
+    void raycast(const CompiledScene& _scene, const Camera& _camera, int _prim,
+                 unsigned int _x0, unsigned int _y0, unsigned int _x1, unsigned int _y1);
+
+private:
+
+    unsigned int width_ = 0, height_ = 0;
+
+    /// per pixel, row by row: depth of the closest primitive and its Entry
+    std::vector<float> depth_;
+    std::vector<int>   prim_, triangle_;
+
+    VisibilityStats stats_;
+};
@@ -70,15 +70,15 @@ int main(int argc, char **argv)
 
         const auto &c = s.getCamera();
         Image img(c.width, c.height);
-        std::vector<size_t> numIntersected(c.width * c.height);
+        std::vector<size_t> numIntersected(size_t(c.width) * c.height);
         for (int x=0; x<int(c.width); ++x) {
             for (int y=0; y<int(c.height); ++y) {
                 Ray ray = c.primary_ray(x,y);
 
                 for (const auto &o: s.getObjects()) {
-                    if (auto mesh = dynamic_cast<const Mesh *>(o.get())) {
+                    if (auto mesh = dynamic_cast<const Mesh *>(o)) {
                         if (mesh->intersect_bounding_box(ray))
-                            ++numIntersected[y * c.width + x];
+                            ++numIntersected[size_t(y) * c.width + x];
                     }
                 }
             }
@@ -86,7 +86,7 @@ int main(int argc, char **argv)
         size_t maxIntersectionCount = *std::max_element(numIntersected.begin(), numIntersected.end());
         for (int x=0; x<int(c.width); ++x)
             for (int y=0; y<int(c.height); ++y)
-                img(x, y) = vec3(numIntersected[y * c.width + x] / float(maxIntersectionCount), 0, 0);
+                img.set(x, y, vec3(numIntersected[size_t(y) * c.width + x] / float(maxIntersectionCount), 0, 0));
 
         std::cout << "Writing image to " << job.outPath << std::flush;
         img.write_bmp(job.outPath);
@@ -0,0 +1,105 @@
+//=============================================================================
+//
+//   Exercise code for the lecture
+//   "Introduction to Computer Graphics"
+//   by Prof. Dr. Mario Botsch, Bielefeld University
+//
+//   Copyright (C) Computer Graphics Group, Bielefeld University.
+//
+//=============================================================================
+
+//== includes =================================================================
+
+#include "PartialImage.h"
+
+#include <vector>
+#include <iostream>
+#include <string>
+#include <stdexcept>
+
+#ifdef _WIN32
+#  include <windows.h>
+#  include <stdlib.h>
+#  include <errhandlingapi.h>
+#endif
+
+/// Print command line usage and exit.
+static void usage(const char *_program)
+{
+    std::cerr << "Usage: " << _program << " [--base image.bmp] output.bmp|output.png part...\n";
+    std::cerr << "Assembles partial images rendered with `raytrace --region` or `raytrace --tiles`.\n";
+    std::cerr << "Later parts overwrite earlier ones; pixels outside all parts are taken from\n";
+    std::cerr << "the base image (e.g. a previous full render), or are black.\n";
+    std::cerr << std::flush;
+    exit(1);
+}
+
+
+/// Program entry point.
+int main(int argc, char **argv)
+{
+#ifdef _WIN32
+    // This make crashes very visible - without them, starting the
+    // application from cmd.exe or powershell can surprisingly hide
+    // any signs of a an application crash!
+    SetErrorMode(0);
+#endif
+
+    std::filesystem::path base, output;
+    std::vector<std::filesystem::path> parts;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--base" && i + 1 < argc) base = argv[++i];
+        else if (arg.compare(0, 2, "--") == 0) usage(argv[0]);
+        else if (output.empty()) output = arg;
+        else parts.push_back(arg);
+    }
+    if (output.empty() || parts.empty()) usage(argv[0]);
+
+    const std::string extension = output.extension().string();
+    if (extension != ".bmp" && extension != ".png") usage(argv[0]);
+
+    try {
+        Canvas canvas;
+        std::vector<bool> covered;
+        if (!base.empty()) canvas.read_bmp(base);
+
+        size_t tiles = 0;
+        for (const auto &path: parts) {
+            PartialImage part;
+            part.read(path);
+
+            if (canvas.bgr.empty() && base.empty())
+                canvas = Canvas(part.width(), part.height());
+            if (part.width() != canvas.width || part.height() != canvas.height)
+                throw std::runtime_error(path.string() + " belongs to an image of another size");
+
+            part.paste(canvas);
+            if (base.empty()) {
+                covered.resize(size_t(canvas.width) * canvas.height, false);
+                for (const Tile &t: part.tiles())
+                    for (unsigned int y = t.y0; y < t.y0 + t.height; ++y)
+                        for (unsigned int x = t.x0; x < t.x0 + t.width; ++x)
+                            covered[size_t(y) * canvas.width + x] = true;
+            }
+            tiles += part.tiles().size();
+        }
+
+        std::cout << "Merged " << tiles << " tiles of " << parts.size() << " parts into a "
+                  << canvas.width << "x" << canvas.height << " image" << std::endl;
+        if (base.empty()) {
+            size_t missing = 0;
+            for (bool c: covered) missing += !c;
+            if (missing)
+                std::cerr << "WARNING: " << missing << " pixels are not covered by any part" << std::endl;
+        }
+
+        const bool written = extension == ".png" ? canvas.write_png(output) : canvas.write_bmp(output);
+        if (!written) return 1;
+    }
+    catch (const std::exception &e) {
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
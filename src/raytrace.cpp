@@ -14,10 +14,20 @@
 #include "Scene.h"
 #include "Paths.h"
 #include "Job.h"
+#include "Distributed.h"
+#include "RenderServer.h"
+#include "PartialImage.h"
+#include "Checkpoint.h"
 
+#include <chrono>
+#include <iomanip>
+#include <sstream>
 #include <vector>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 
 
 #ifdef _WIN32
@@ -28,6 +38,73 @@
 
 
 
+/// Print command line usage and exit.
+static void usage(const char *_program)
+{
+    std::cerr << "Usage: " << _program << " [options] path/to/input.sce path/to/output.bmp (to render a single scene)\n";
+    std::cerr << "Or:    " << _program << " [options] 0                    (to render all scenes)\n";
+    RenderSettings::print_options(std::cerr);
+    std::cerr << std::flush;
+    exit(1);
+}
+
+
+/// Render the tiles selected by --region or --tiles.
+static PartialImage renderPart(Scene &_scene, const RenderSettings &_settings)
+{
+    const Camera &camera = _scene.getCamera();
+    PartialImage part(camera.width, camera.height);
+    std::vector<vec3> pixels;
+    for (const Tile &tile: _settings.partial_tiles(camera.width, camera.height)) {
+        _scene.renderTile(tile, pixels);
+        part.add(tile, pixels);
+    }
+    return part;
+}
+
+
+/// Render the image in tiles, saving finished tiles to the checkpoint of
+/// --checkpoint every --checkpoint-interval seconds and skipping those an
+/// earlier run of the same render has saved there.
+static std::unique_ptr<Checkpoint> renderCheckpointed(Scene &_scene, const RenderSettings &_settings)
+{
+    // the render is identified by the scene's contents and the options that change the image
+    std::ostringstream key;
+    key << "scene " << std::hex << std::setw(16) << std::setfill('0') << _scene.contentHash() << std::dec << " options";
+    for (const std::string &option: _settings.forwarded) key << ' ' << option;
+
+    const Camera &camera = _scene.getCamera();
+    auto checkpoint = std::make_unique<Checkpoint>(_settings.checkpoint, key.str(),
+                                                   camera.width, camera.height, _settings.tile_size);
+    if (checkpoint->resumed())
+        std::cout << " resuming " << checkpoint->resumed() << " of " << checkpoint->tiles().size()
+                  << " tiles from " << _settings.checkpoint << "..." << std::flush;
+
+    std::vector<Tile> tiles;
+    std::vector<size_t> indices;
+    for (size_t i = 0; i < checkpoint->tiles().size(); ++i) {
+        if (checkpoint->done(i)) continue;
+        tiles.push_back(checkpoint->tiles()[i]);
+        indices.push_back(i);
+    }
+
+    // the thread that finishes a tile after the interval expired writes the file
+    std::mutex mutex;
+    StopWatch sinceSave;
+    sinceSave.start();
+    _scene.renderTiles(tiles, [&](size_t _i, const std::vector<vec3> &_pixels) {
+        std::lock_guard<std::mutex> lock(mutex);
+        checkpoint->add(indices[_i], _pixels);
+        if (sinceSave.stop() >= 1000.0 * _settings.checkpoint_interval) {
+            if (!checkpoint->flush())
+                std::cerr << "\nWARNING: cannot write checkpoint " << _settings.checkpoint << std::endl;
+            sinceSave.start();
+        }
+    });
+    return checkpoint;
+}
+
+
 /// Program entry point.
 int main(int argc, char **argv)
 {
@@ -39,12 +116,60 @@ int main(int argc, char **argv)
 #endif
     const auto sceneDir = std::filesystem::path(SCENES_PATH, std::filesystem::path::format::native_format);
     const auto resultsDir = sceneDir.parent_path() / "results";
+
+    // Split command line into options and positional arguments
+    RenderSettings settings;
+    std::vector<std::string> args;
+    const std::vector<std::string> argList(argv + 1, argv + argc);
+    for (size_t i = 0; i < argList.size(); ++i) {
+        const std::string& arg = argList[i];
+        if (arg.size() > 2 && arg.compare(0, 2, "--") == 0) {
+            if (!settings.parse_option(argList, i))
+                usage(argv[0]);
+        }
+        else
+            args.push_back(arg);
+    }
+
+    // Worker mode: render tiles for a coordinator
+    if (settings.worker_fd >= 0 || settings.worker_port > 0) {
+        try {
+            TileWorker worker(settings);
+            if (settings.worker_fd >= 0)
+                worker.serve(settings.worker_fd);
+            else
+                worker.listen(settings.worker_listen_address, settings.worker_port);
+        }
+        catch (const std::exception& e) {
+            std::cerr << "ERROR: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // Server mode: keep scenes resident and render requests from clients
+    if (!settings.server_socket.empty()) {
+        try {
+            RenderServer(settings).serve(settings.server_socket);
+        }
+        catch (const std::exception& e) {
+            std::cerr << "ERROR: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (settings.partial() && (settings.distributed() || !settings.request_socket.empty() || settings.band_rows)) {
+        std::cerr << "ERROR: --region and --tiles render locally into a partial image" << std::endl;
+        return 1;
+    }
+
     // Parse input scene file/output path from command line arguments
     std::vector<RaytraceJob> jobs;
 
-    if (argc == 3) {
-        jobs.emplace_back(RaytraceJob{argv[1], argv[2]});
-    } else if ((argc == 2) && argv[1][0] == '0') {
+    if (args.size() == 2) {
+        jobs.emplace_back(RaytraceJob{args[0], args[1]});
+    } else if ((args.size() == 1) && args[0][0] == '0') {
         std::cout << "Using scene folder " << sceneDir.string() << std::endl;
         std::cout << "Saving to results folder " << resultsDir.string() << std::endl;
         for (const auto *name: {
@@ -66,27 +191,177 @@ int main(int argc, char **argv)
         }
     }
     else {
-        std::cerr << "Usage: " << argv[0] << " path/to/input.sce path/to/output.bmp (to render a single scene)\n";
-        std::cerr << "Or:    " << argv[0] << " 0                    (to render all scenes)\n";
-        std::cerr << std::flush;
-        exit(1);
+        usage(argv[0]);
     }
 
 
     for (const auto &job : jobs) {
+        if (!settings.request_socket.empty()) {
+            // let the render server do the work; the paths are quoted, they may contain spaces
+            std::ostringstream request;
+            request << "render " << std::quoted(std::filesystem::absolute(job.scenePath).string())
+                    << ' ' << std::quoted("output=" + std::filesystem::absolute(job.outPath).string())
+                    << " priority=" << settings.priority;
+            try {
+                std::string payload;
+                const std::string answer = RenderServer::request(settings.request_socket, request.str(), payload);
+                std::cout << job.scenePath << ": " << answer << "\n";
+                if (answer.compare(0, 2, "ok") != 0) return 1;
+            }
+            catch (const std::exception& e) {
+                std::cerr << "ERROR: " << e.what() << std::endl;
+                return 1;
+            }
+            continue;
+        }
+
+        if (settings.distributed()) {
+            // workers load the scene themselves
+            StopWatch timer;
+            std::cout << "Ray tracing " << job.scenePath << " distributed..." << std::flush;
+            timer.start();
+            Image image;
+            try {
+#ifdef __linux__
+                TileCoordinator coordinator("/proc/self/exe", settings);
+#else
+                TileCoordinator coordinator(argv[0], settings);
+#endif
+                image = coordinator.render(job.scenePath);
+            }
+            catch (const std::exception& e) {
+                std::cerr << "\nERROR: " << e.what() << std::endl;
+                return 1;
+            }
+            timer.stop();
+            std::cout << " done (" << timer << ")\n";
+
+            std::cout << "Writing image to " << job.outPath << std::flush;
+            if (!image.write_bmp(job.outPath)) return 1;
+            std::cout << "\n\n";
+            continue;
+        }
+
         std::cout << "Read scene " << job.scenePath << "..." << std::flush;
-        Scene s(job.scenePath);
-        std::cout << "\ndone (" << s.numObjects() << " objects)\n";
-
-        StopWatch timer;
-        std::cout << "Ray tracing..." << std::flush;
-        timer.start();
-        auto image = s.render();
-        timer.stop();
-        std::cout << " done (" << timer << ")\n";
-
-        std::cout << "Writing image to " << job.outPath << std::flush;
-        image.write_bmp(job.outPath);
+        auto s = std::make_unique<Scene>(job.scenePath, settings);
+        std::cout << "\ndone (" << s->numObjects() << " objects, " << s->getArena() << ")\n";
+        std::cout << "Load: " << s->getLoadStats() << "\n";
+        if (s->getCompiled().uses_grid())
+            std::cout << "Object grid: " << s->getCompiled().object_grid_stats() << "\n";
+        else
+            std::cout << "Object BVH: " << s->getCompiled().object_bvh_stats() << "\n";
+        if (s->getCompiled().mesh_bvh_stats().trees)
+            std::cout << "Mesh BVHs:  " << s->getCompiled().mesh_bvh_stats() << "\n";
+
+        for (;;) {
+            StopWatch timer;
+            std::cout << "Ray tracing..." << std::flush;
+            timer.start();
+            Image image;
+            PartialImage part;
+            std::unique_ptr<Checkpoint> checkpoint;
+            if (settings.partial()) {
+                try {
+                    part = renderPart(*s, settings);
+                }
+                catch (const std::exception& e) {
+                    std::cerr << "\nERROR: " << e.what() << std::endl;
+                    return 1;
+                }
+            }
+            else if (!settings.checkpoint.empty()) {
+                try {
+                    checkpoint = renderCheckpointed(*s, settings);
+                }
+                catch (const std::exception& e) {
+                    std::cerr << "\nERROR: " << e.what() << std::endl;
+                    return 1;
+                }
+            }
+            else if (settings.band_rows) {
+                if (!s->renderStreaming(job.outPath, settings.band_rows)) return 1;
+            }
+            else {
+                image = s->render();
+            }
+            timer.stop();
+            std::cout << " done (" << timer << ")\n";
+            std::cout << "Rays: " << s->getRayCount() << " through the "
+                      << (s->getCompiled().uses_grid() ? "object grid, " : "object BVH, ")
+                      << double(s->getRayCount()) / timer.elapsed() / 1000.0 << " Mrays/s\n";
+            if (settings.preview > 1 && s->getPreviewStats().pixels)
+                std::cout << "Preview: " << s->getPreviewStats() << "\n";
+            const RecursionStats recursion = s->getRecursionStats();
+            if (recursion.traced || recursion.cut)
+                std::cout << "Reflections: " << recursion << "\n";
+            if (settings.frustum_culling)
+                std::cout << "Frustum culling: " << s->getCullingStats() << "\n";
+            if (settings.rasterize)
+                std::cout << "Visibility buffer: " << s->getVisibilityStats() << "\n";
+            if (s->getScheduleStats().units)
+                std::cout << "Schedule: " << s->getScheduleStats() << "\n";
+            if (settings.numa && !settings.partial())
+                std::cout << "NUMA nodes:" << s->getNumaStats() << "\n";
+            if (s->getCompiled().lazy_bvh()) {
+                const CompiledScene &compiled = s->getCompiled();
+                const size_t built = compiled.mesh_bvh_stats().trees;
+                std::cout << "Lazy mesh BVHs: " << built << " of " << compiled.num_lazy_meshes()
+                          << " built, " << compiled.num_lazy_meshes() - built << " never hit";
+                if (built) std::cout << "; " << compiled.mesh_bvh_stats();
+                std::cout << "\n";
+            }
+            if (s->getPageCache())
+                std::cout << "Page cache: " << *s->getPageCache() << "\n";
+
+            if (settings.partial()) {
+                std::cout << "Writing " << part.tiles().size() << " tiles of the image to " << job.outPath << std::flush;
+                part.write(job.outPath);
+            }
+            else if (checkpoint) {
+                std::cout << "Writing image to " << job.outPath << std::flush;
+                if (!checkpoint->canvas().write_bmp(job.outPath)) return 1;
+                checkpoint->remove();
+            }
+            else if (settings.band_rows) {
+                std::cout << "Streamed image to " << job.outPath << std::flush;
+            }
+            else {
+                std::cout << "Writing image to " << job.outPath << std::flush;
+                if (!image.write_bmp(job.outPath)) return 1;
+            }
+
+            if (!settings.watch) break;
+
+            // wait for the scene or its meshes to change, then update incrementally
+            std::cout << "\nWatching " << job.scenePath << " for changes..." << std::flush;
+            // times of the inputs when an update failed, to retry once any of them changes
+            std::vector<std::filesystem::file_time_type> failed;
+            for (bool updated = false; !updated; ) {
+                while (!s->outdated() || s->inputTimes() == failed)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+
+                try {
+                    SceneUpdate update;
+                    timer.start();
+                    if (s->update(update)) {
+                        timer.stop();
+                        std::cout << "\nUpdated scene (" << update << ") in " << timer << "\n";
+                    }
+                    else {
+                        std::cout << "\nRead scene " << job.scenePath << "..." << std::flush;
+                        s = std::make_unique<Scene>(job.scenePath, settings);
+                        std::cout << "\ndone (" << s->numObjects() << " objects, " << s->getArena() << ")\n";
+                    }
+                    updated = true;
+                }
+                catch (const std::exception& e) {
+                    // keep the previous scene until the scene file or one of its
+                    // meshes is saved again, e.g. while it is being edited
+                    std::cerr << "\nERROR: " << e.what() << std::endl;
+                    failed = s->inputTimes();
+                }
+            }
+        }
         std::cout << "\n\n";
     }
 }